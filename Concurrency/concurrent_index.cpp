@@ -0,0 +1,84 @@
+#include "concurrent_index.h"
+
+static void destroyKDNode(void* p) {
+    delete static_cast<KDNode*>(p);
+}
+
+
+static void destroyQuadNode(void* p) {
+    delete static_cast<QuadNode*>(p);
+}
+
+
+ConcurrentKDTree::~ConcurrentKDTree() {
+    deleteTree(root.load());
+}
+
+
+void ConcurrentKDTree::insert(const vector<double>& point) {
+    lock_guard<mutex> lock(writeLock);
+    vector<KDNode*> replaced;
+    root.store(insertCopyOnWrite(root.load(), point, replaced));
+    for (KDNode* n : replaced) {
+        epochs.retire(n, destroyKDNode);
+    }
+    epochs.advance();
+}
+
+
+void ConcurrentKDTree::remove(const vector<double>& point) {
+    lock_guard<mutex> lock(writeLock);
+    vector<KDNode*> replaced;
+    root.store(removeCopyOnWrite(root.load(), point, replaced));
+    for (KDNode* n : replaced) {
+        epochs.retire(n, destroyKDNode);
+    }
+    epochs.advance();
+}
+
+
+bool ConcurrentKDTree::findNearest(int reader, vector<double>& target, vector<double>& nearest, double& bestDist) {
+    EpochGuard guard(epochs, reader);
+    KDNode* found = ::findNearest(root.load(), target, bestDist);
+    if (!found) return false;
+    nearest.assign(found->point.begin(), found->point.end());
+    return true;
+}
+
+
+ConcurrentQuadTree::ConcurrentQuadTree(double x1, double x2, double y1, double y2, int cap)
+    : root(new QuadNode(x1, x2, y1, y2, cap)) {}
+
+
+ConcurrentQuadTree::~ConcurrentQuadTree() {
+    deleteTree(root.load());
+}
+
+
+void ConcurrentQuadTree::insert(const vector<double>& point) {
+    lock_guard<mutex> lock(writeLock);
+    vector<QuadNode*> replaced;
+    root.store(insertCopyOnWrite(root.load(), point, replaced));
+    for (QuadNode* n : replaced) {
+        epochs.retire(n, destroyQuadNode);
+    }
+    epochs.advance();
+}
+
+
+void ConcurrentQuadTree::remove(const vector<double>& point) {
+    lock_guard<mutex> lock(writeLock);
+    vector<QuadNode*> replaced;
+    root.store(removeCopyOnWrite(root.load(), point, replaced));
+    for (QuadNode* n : replaced) {
+        epochs.retire(n, destroyQuadNode);
+    }
+    epochs.advance();
+}
+
+
+bool ConcurrentQuadTree::findNearest(int reader, vector<double>& target, vector<double>& nearest, double& bestDist) {
+    EpochGuard guard(epochs, reader);
+    nearest = ::findNearest(root.load(), target, bestDist);
+    return !nearest.empty();
+}
@@ -0,0 +1,52 @@
+#ifndef CONCURRENT_INDEX_H
+#define CONCURRENT_INDEX_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "epoch.h"
+#include "../KD-Tree/kd_tree.h"
+#include "../Quad-Tree/quadtree.h"
+
+using namespace std;
+
+// Single-writer / many-reader wrappers around the pointer trees. Writers are
+// serialized by writeLock and publish a new root built with the copy-on-write
+// insert/remove; readers call findNearest with the slot they got from
+// registerReader() and never take a lock, and give the slot back with
+// releaseReader() when they stop.
+struct ConcurrentKDTree {
+    atomic<KDNode*> root;
+    mutex writeLock;
+    EpochManager epochs;
+
+    ConcurrentKDTree() : root(nullptr) {}
+    ~ConcurrentKDTree();
+
+    int registerReader() { return epochs.registerReader(); }
+    void releaseReader(int reader) { epochs.releaseReader(reader); }
+
+    void insert(const vector<double>& point);
+    void remove(const vector<double>& point);
+    bool findNearest(int reader, vector<double>& target, vector<double>& nearest, double& bestDist);
+};
+
+
+struct ConcurrentQuadTree {
+    atomic<QuadNode*> root;
+    mutex writeLock;
+    EpochManager epochs;
+
+    ConcurrentQuadTree(double x1, double x2, double y1, double y2, int cap);
+    ~ConcurrentQuadTree();
+
+    int registerReader() { return epochs.registerReader(); }
+    void releaseReader(int reader) { epochs.releaseReader(reader); }
+
+    void insert(const vector<double>& point);
+    void remove(const vector<double>& point);
+    bool findNearest(int reader, vector<double>& target, vector<double>& nearest, double& bestDist);
+};
+
+#endif
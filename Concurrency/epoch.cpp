@@ -0,0 +1,80 @@
+#include "epoch.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+
+EpochManager::EpochManager() : globalEpoch(0), readerCount(0) {
+    for (int i = 0; i < MAX_READERS; ++i) {
+        readerEpochs[i].store(IDLE);
+        readerClaimed[i].store(false);
+    }
+}
+
+
+EpochManager::~EpochManager() {
+    for (auto& r : retired) {
+        r.destroy(r.ptr);
+    }
+}
+
+
+int EpochManager::registerReader() {
+    for (int i = 0; i < MAX_READERS; ++i) {
+        bool expected = false;
+        if (readerClaimed[i].load(memory_order_relaxed) ||
+            !readerClaimed[i].compare_exchange_strong(expected, true)) continue;
+        int seen = readerCount.load();
+        while (seen <= i && !readerCount.compare_exchange_weak(seen, i + 1)) {
+        }
+        return i;
+    }
+    fprintf(stderr, "EpochManager: more than %d concurrent readers\n", MAX_READERS);
+    abort();
+}
+
+
+void EpochManager::releaseReader(int reader) {
+    assert(reader >= 0 && reader < MAX_READERS);
+    readerEpochs[reader].store(IDLE, memory_order_release);
+    readerClaimed[reader].store(false, memory_order_release);
+}
+
+
+void EpochManager::enter(int reader) {
+    assert(reader >= 0 && reader < MAX_READERS);
+    readerEpochs[reader].store(globalEpoch.load());
+}
+
+
+void EpochManager::exit(int reader) {
+    assert(reader >= 0 && reader < MAX_READERS);
+    readerEpochs[reader].store(IDLE, memory_order_release);
+}
+
+
+void EpochManager::retire(void* ptr, void (*destroy)(void*)) {
+    retired.push_back(Retired{ ptr, destroy, globalEpoch.load() });
+}
+
+
+void EpochManager::advance() {
+    globalEpoch.fetch_add(1);
+
+    uint64_t oldest = globalEpoch.load();
+    int readers = readerCount.load();
+    for (int i = 0; i < readers; ++i) {
+        uint64_t e = readerEpochs[i].load();
+        if (e < oldest) oldest = e;
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < retired.size(); ++i) {
+        if (retired[i].epoch < oldest) {
+            retired[i].destroy(retired[i].ptr);
+        } else {
+            retired[kept++] = retired[i];
+        }
+    }
+    retired.resize(kept);
+}
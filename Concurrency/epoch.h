@@ -0,0 +1,59 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+// Epoch-based reclamation for trees that are updated copy-on-write.
+// Readers announce the global epoch before loading a root and clear the
+// announcement when done; the writer retires the nodes it replaced with the
+// epoch they were unlinked in, and frees them once every active reader has
+// announced a later epoch. Readers never block and never touch freed memory.
+// retire() and advance() belong to the writer and must be serialized by it.
+//
+// Each reader thread holds one of MAX_READERS slots from registerReader()
+// until it calls releaseReader(). Asking for a slot while all are held
+// aborts: handing out an invalid slot would let enter() write outside the
+// table.
+struct EpochManager {
+    static const int MAX_READERS = 128;
+    static const uint64_t IDLE = UINT64_MAX;
+
+    struct Retired {
+        void* ptr;
+        void (*destroy)(void*);
+        uint64_t epoch;
+    };
+
+    atomic<uint64_t> globalEpoch;
+    atomic<uint64_t> readerEpochs[MAX_READERS];
+    atomic<bool> readerClaimed[MAX_READERS];
+    atomic<int> readerCount; // slots ever claimed, the range advance() scans
+    vector<Retired> retired;
+
+    EpochManager();
+    ~EpochManager();
+
+    int registerReader();
+    void releaseReader(int reader);
+    void enter(int reader);
+    void exit(int reader);
+
+    void retire(void* ptr, void (*destroy)(void*));
+    void advance();
+    size_t pending() const { return retired.size(); }
+};
+
+
+struct EpochGuard {
+    EpochManager& epochs;
+    int reader;
+
+    EpochGuard(EpochManager& e, int r) : epochs(e), reader(r) { epochs.enter(reader); }
+    ~EpochGuard() { epochs.exit(reader); }
+};
+
+#endif
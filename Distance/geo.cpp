@@ -0,0 +1,51 @@
+#include "geo.h"
+
+#include <algorithm>
+
+static const double DEG_TO_RAD = 3.14159265358979323846 / 180.0;
+
+
+GeoTree::Point geoToUnit(double latDeg, double lonDeg) {
+    double lat = latDeg * DEG_TO_RAD;
+    double lon = lonDeg * DEG_TO_RAD;
+    return GeoTree::Point{ cos(lat) * cos(lon), cos(lat) * sin(lon), sin(lat) };
+}
+
+
+void unitToGeo(const GeoTree::Point& p, double& latDeg, double& lonDeg) {
+    latDeg = asin(max(-1.0, min(1.0, p[2]))) / DEG_TO_RAD;
+    lonDeg = atan2(p[1], p[0]) / DEG_TO_RAD;
+}
+
+
+double chordSqToMeters(double chordSq) {
+    double halfChord = sqrt(chordSq) / 2;
+    return 2 * asin(min(1.0, halfChord)) * EARTH_RADIUS_M;
+}
+
+
+double haversineMeters(double lat1, double lon1, double lat2, double lon2) {
+    double dLat = (lat2 - lat1) * DEG_TO_RAD;
+    double dLon = (lon2 - lon1) * DEG_TO_RAD;
+    double a = sin(dLat / 2) * sin(dLat / 2) +
+               cos(lat1 * DEG_TO_RAD) * cos(lat2 * DEG_TO_RAD) * sin(dLon / 2) * sin(dLon / 2);
+    return 2 * asin(min(1.0, sqrt(a))) * EARTH_RADIUS_M;
+}
+
+
+GeoNode* geoInsert(GeoNode* root, double latDeg, double lonDeg) {
+    return GeoTree::insert(root, geoToUnit(latDeg, lonDeg));
+}
+
+
+GeoNode* geoRemove(GeoNode* root, double latDeg, double lonDeg) {
+    return GeoTree::removeNode(root, geoToUnit(latDeg, lonDeg));
+}
+
+
+GeoNode* geoFindNearest(GeoNode* root, double latDeg, double lonDeg, double& meters) {
+    double chordSq;
+    GeoNode* nearest = GeoTree::findNearest(root, geoToUnit(latDeg, lonDeg), chordSq);
+    meters = nearest ? chordSqToMeters(chordSq) : numeric_limits<double>::max();
+    return nearest;
+}
@@ -0,0 +1,38 @@
+#ifndef GEO_H
+#define GEO_H
+
+#include "../KD-Tree/kd_tree.h"
+
+using namespace std;
+
+// Geographic mode: latitude/longitude in degrees are indexed as unit vectors
+// in a 3D K-D tree. Straight-line (chord) distance between unit vectors is a
+// monotonic function of great-circle distance, so the ordinary L2 search is
+// exact by meters everywhere, including near the poles and the antimeridian.
+const double EARTH_RADIUS_M = 6371008.8;
+
+typedef KDTree<double, 3> GeoTree;
+typedef GeoTree::Node GeoNode;
+
+
+GeoTree::Point geoToUnit(double latDeg, double lonDeg);
+
+
+void unitToGeo(const GeoTree::Point& p, double& latDeg, double& lonDeg);
+
+
+double chordSqToMeters(double chordSq);
+
+
+double haversineMeters(double lat1, double lon1, double lat2, double lon2);
+
+
+GeoNode* geoInsert(GeoNode* root, double latDeg, double lonDeg);
+
+
+GeoNode* geoRemove(GeoNode* root, double latDeg, double lonDeg);
+
+
+GeoNode* geoFindNearest(GeoNode* root, double latDeg, double lonDeg, double& meters);
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef METRIC_H
+#define METRIC_H
+
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+
+using namespace std;
+
+// Distance policies shared by the K-D tree and the quadtree. A metric maps
+// each per-axis difference to a term and folds the terms together; the same
+// two operations give the point distance, the lower bound to a splitting
+// plane (a single term) and the lower bound to a box (the fold of the gaps).
+// Distances are reported in the metric's own comparable units: squared for
+// the L2 metrics, plain for L1 and Chebyshev. approxScale(eps) is the factor
+// (1 + eps) expressed in those units, used by the approximate searches.
+struct L2Metric {
+    template <typename D> D term(D diff, int) const { return diff * diff; }
+    template <typename D> D combine(D a, D b) const { return a + b; }
+    double approxScale(double eps) const { return (1 + eps) * (1 + eps); }
+};
+
+
+struct L1Metric {
+    template <typename D> D term(D diff, int) const { return diff < 0 ? -diff : diff; }
+    template <typename D> D combine(D a, D b) const { return a + b; }
+    double approxScale(double eps) const { return 1 + eps; }
+};
+
+
+struct ChebyshevMetric {
+    template <typename D> D term(D diff, int) const { return diff < 0 ? -diff : diff; }
+    template <typename D> D combine(D a, D b) const { return a > b ? a : b; }
+    double approxScale(double eps) const { return 1 + eps; }
+};
+
+
+// Squared Euclidean distance with a per-axis weight, e.g. to stretch one
+// axis relative to the other. Meant for floating point coordinates.
+template <int Dims>
+struct WeightedL2Metric {
+    array<double, Dims> weights;
+
+    template <typename D> D term(D diff, int axis) const { return (D)(weights[axis] * diff * diff); }
+    template <typename D> D combine(D a, D b) const { return a + b; }
+    double approxScale(double eps) const { return (1 + eps) * (1 + eps); }
+};
+
+
+// The approximate searches skip a region unless its lower bound, inflated
+// by approxScale, still beats the best distance. Rather than scale every
+// bound, they compare bounds with pruneLimit(best, 1 / approxScale), worked
+// out once each time best improves. Integer limits round up, so no region the
+// inflated comparison would keep is skipped; with shrink 1 the limit is best
+// itself and the exact search pays nothing. shrink above 1 (negative eps)
+// would prune regions that can hold the answer, so callers clamp eps at 0.
+template <typename D>
+inline D pruneLimit(D best, double shrink) {
+    assert(shrink <= 1.0);
+    if (shrink == 1.0) return best;
+    double limit = (double)best * shrink;
+    if (limit >= (double)numeric_limits<D>::max()) return best;
+    return is_integral<D>::value ? (D)ceil(limit) : (D)limit;
+}
+
+
+// Folds the metric over every axis, unrolled at compile time.
+template <int Dims, int Axis = 0>
+struct MetricDistance {
+    template <typename D, class Metric, class P, class Q>
+    static D eval(const Metric& metric, const P& a, const Q& b) {
+        D diff = (D)a[Axis] - (D)b[Axis];
+        return metric.combine(metric.template term<D>(diff, Axis),
+                              MetricDistance<Dims, Axis + 1>::template eval<D>(metric, a, b));
+    }
+
+    // The same fold over per-axis differences that are already known.
+    template <typename D, class Metric, class P>
+    static D fold(const Metric& metric, const P& diffs) {
+        return metric.combine(metric.template term<D>((D)diffs[Axis], Axis),
+                              MetricDistance<Dims, Axis + 1>::template fold<D>(metric, diffs));
+    }
+};
+
+template <int Dims>
+struct MetricDistance<Dims, Dims> {
+    template <typename D, class Metric, class P, class Q>
+    static D eval(const Metric&, const P&, const Q&) { return 0; }
+
+    template <typename D, class Metric, class P>
+    static D fold(const Metric&, const P&) { return 0; }
+};
+
+#endif
@@ -0,0 +1,235 @@
+#include "point_loader.h"
+#include "../Storage/mapped_file.h"
+
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <atomic>
+#include <thread>
+
+static_assert(sizeof(KDTree2D::Point) == 2 * sizeof(double), "binary records are copied as points");
+
+const double POW10[] = { 1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                         1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+const char* parseNumber(const char* p, const char* end, double& value) {
+    const char* start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+
+    // Up to 19 significant digits fit in the mantissa; the rest only shift
+    // the exponent, and mark the value for the slow path if they are nonzero.
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    bool any = false, truncated = false;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+        any = true;
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa != 0) digits++;
+        } else {
+            exponent++;
+            truncated |= *p != '0';
+        }
+    }
+    if (p < end && *p == '.') {
+        ++p;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+            any = true;
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa != 0) digits++;
+                exponent--;
+            } else {
+                truncated |= *p != '0';
+            }
+        }
+    }
+    if (!any) return nullptr;
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char* q = p + 1;
+        bool expNegative = false;
+        if (q < end && (*q == '-' || *q == '+')) {
+            expNegative = *q == '-';
+            ++q;
+        }
+        if (q < end && *q >= '0' && *q <= '9') {
+            int e = 0;
+            for (; q < end && *q >= '0' && *q <= '9'; ++q) {
+                if (e < 100000) e = e * 10 + (*q - '0');
+            }
+            exponent += expNegative ? -e : e;
+            p = q;
+        }
+    }
+
+    // Both the mantissa and the power of ten are exact doubles here, so one
+    // multiplication or division rounds correctly.
+    if (!truncated && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+        double v = (double)mantissa;
+        v = exponent < 0 ? v / POW10[-exponent] : v * POW10[exponent];
+        value = negative ? -v : v;
+        return p;
+    }
+
+    char buffer[128];
+    size_t length = p - start;
+    if (length < sizeof(buffer)) {
+        memcpy(buffer, start, length);
+        buffer[length] = '\0';
+        value = strtod(buffer, nullptr);
+    } else {
+        value = strtod(string(start, length).c_str(), nullptr);
+    }
+    return p;
+}
+
+
+static bool isSeparator(char c) {
+    return c == ',' || c == ';' || c == ' ' || c == '\t' || c == '\r';
+}
+
+
+struct IngestChunk {
+    const char* begin;
+    const char* end;
+    vector<KDTree2D::Point> points;
+    vector<uint32_t> attrs;
+    uint64_t skipped = 0;
+    bool hasAttrs = false;
+    size_t offset = 0; // first index in the merged result
+};
+
+
+static void parseChunk(IngestChunk& chunk) {
+    chunk.points.reserve((chunk.end - chunk.begin) / 16);
+    chunk.attrs.reserve(chunk.points.capacity());
+
+    const char* p = chunk.begin;
+    while (p < chunk.end) {
+        const char* lineEnd = (const char*)memchr(p, '\n', chunk.end - p);
+        if (!lineEnd) lineEnd = chunk.end;
+
+        const char* q = p;
+        while (q < lineEnd && isSeparator(*q)) ++q;
+        if (q < lineEnd && *q != '#') {
+            double x, y, a;
+            q = parseNumber(q, lineEnd, x);
+            if (q) {
+                while (q < lineEnd && isSeparator(*q)) ++q;
+                q = parseNumber(q, lineEnd, y);
+            }
+            if (q) {
+                uint32_t attrs = 0;
+                while (q < lineEnd && isSeparator(*q)) ++q;
+                if (q < lineEnd && parseNumber(q, lineEnd, a) && a >= 0) {
+                    attrs = (uint32_t)a;
+                    chunk.hasAttrs = true;
+                }
+                chunk.points.push_back(KDTree2D::Point{ x, y });
+                chunk.attrs.push_back(attrs);
+            } else {
+                chunk.skipped++;
+            }
+        }
+        p = lineEnd + 1;
+    }
+}
+
+
+// Runs work(i) for i in [0, count) on up to `threads` threads.
+template <class Work>
+static void runParallel(int threads, size_t count, const Work& work) {
+    atomic<size_t> next(0);
+    auto loop = [&] {
+        for (size_t i = next++; i < count; i = next++) work(i);
+    };
+    vector<thread> pool;
+    for (int t = 1; t < threads && (size_t)t < count; ++t) pool.emplace_back(loop);
+    loop();
+    for (auto& t : pool) t.join();
+}
+
+
+static bool endsWith(const string& s, const string& suffix) {
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+
+bool loadPoints(const string& path, const IngestOptions& options, IngestResult& result, string& error) {
+    auto start = chrono::steady_clock::now();
+    result = IngestResult();
+
+    MappedFile file;
+    if (!mapFile(path, file, error, true)) return false;
+    result.bytes = file.size;
+
+    int threads = options.threads > 0 ? options.threads : (int)thread::hardware_concurrency();
+    if (threads < 1) threads = 1;
+    size_t chunkBytes = options.chunkBytes > 0 ? options.chunkBytes : 4 << 20;
+    IngestFormat format = options.format;
+    if (format == INGEST_AUTO) format = endsWith(path, ".bin") ? INGEST_BINARY : INGEST_TEXT;
+
+    if (format == INGEST_BINARY) {
+        const size_t record = sizeof(KDTree2D::Point);
+        if (file.size % record != 0) {
+            error = path + " is not a whole number of " + to_string(record) + "-byte records";
+            unmapFile(file);
+            return false;
+        }
+        size_t count = file.size / record;
+        size_t perChunk = chunkBytes / record + 1;
+        result.points.resize(count);
+        result.attrs.assign(count, 0);
+        runParallel(threads, (count + perChunk - 1) / perChunk, [&](size_t c) {
+            size_t first = c * perChunk;
+            size_t n = min(perChunk, count - first);
+            memcpy(result.points.data() + first, file.data + first * record, n * record);
+        });
+    } else {
+        // Chunks start just after a newline, so no line is split between two.
+        const char* data = (const char*)file.data;
+        const char* end = data + file.size;
+        vector<IngestChunk> chunks;
+        const char* p = data;
+        while (p < end) {
+            const char* chunkEnd = end;
+            if ((size_t)(end - p) > chunkBytes) {
+                const char* nl = (const char*)memchr(p + chunkBytes - 1, '\n', end - (p + chunkBytes - 1));
+                if (nl) chunkEnd = nl + 1;
+            }
+            IngestChunk chunk;
+            chunk.begin = p;
+            chunk.end = chunkEnd;
+            chunks.push_back(move(chunk));
+            p = chunkEnd;
+        }
+
+        runParallel(threads, chunks.size(), [&](size_t c) { parseChunk(chunks[c]); });
+
+        size_t total = 0;
+        for (auto& chunk : chunks) {
+            chunk.offset = total;
+            total += chunk.points.size();
+            result.skippedLines += chunk.skipped;
+            result.hasAttrs |= chunk.hasAttrs;
+        }
+        result.points.resize(total);
+        result.attrs.resize(total);
+        runParallel(threads, chunks.size(), [&](size_t c) {
+            IngestChunk& chunk = chunks[c];
+            copy(chunk.points.begin(), chunk.points.end(), result.points.begin() + chunk.offset);
+            copy(chunk.attrs.begin(), chunk.attrs.end(), result.attrs.begin() + chunk.offset);
+            vector<KDTree2D::Point>().swap(chunk.points);
+            vector<uint32_t>().swap(chunk.attrs);
+        });
+    }
+
+    unmapFile(file);
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return true;
+}
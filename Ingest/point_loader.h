@@ -0,0 +1,52 @@
+#ifndef POINT_LOADER_H
+#define POINT_LOADER_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "../KD-Tree/kd_tree.h"
+
+using namespace std;
+
+// INGEST_TEXT:   one point per line, "x,y" or "x,y,attrs". Fields may be
+//                separated by commas, semicolons, tabs or spaces. Blank lines
+//                and lines starting with '#' are ignored; lines that do not
+//                start with two numbers (a header, say) are counted as skipped.
+// INGEST_BINARY: packed records of two doubles, x then y, in native byte order.
+// INGEST_AUTO:   binary for files ending in .bin, text otherwise.
+enum IngestFormat { INGEST_AUTO, INGEST_TEXT, INGEST_BINARY };
+
+
+struct IngestOptions {
+    IngestFormat format = INGEST_AUTO;
+    int threads = 0;             // 0 uses every hardware thread
+    size_t chunkBytes = 4 << 20; // unit of work handed to a thread
+};
+
+
+struct IngestResult {
+    vector<KDTree2D::Point> points; // in file order
+    vector<uint32_t> attrs;         // parallel to points, 0 where not given
+    bool hasAttrs = false;          // at least one line carried an attrs field
+    uint64_t bytes = 0;
+    uint64_t skippedLines = 0;
+    double seconds = 0;             // mapping and parsing
+
+    double megabytesPerSecond() const { return seconds > 0 ? bytes / 1048576.0 / seconds : 0; }
+    double pointsPerSecond() const { return seconds > 0 ? points.size() / seconds : 0; }
+};
+
+
+// Maps the file and parses it in line-aligned chunks on several threads,
+// reading straight from the mapping. Returns false and sets error when the
+// file cannot be mapped or a binary file is not a whole number of records.
+bool loadPoints(const string& path, const IngestOptions& options, IngestResult& result, string& error);
+
+
+// Parses a decimal number starting exactly at p without allocating or
+// needing a terminator. Returns the position after it, or nullptr when p does
+// not start a number. Results are correctly rounded.
+const char* parseNumber(const char* p, const char* end, double& value);
+
+#endif
@@ -0,0 +1,161 @@
+#include "latency_histogram.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+static const int HALF = 1 << (LATENCY_SUB_BITS - 1);
+
+static int highestBit(uint64_t v) {
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(v);
+#else
+    int bit = 0;
+    while (v >>= 1) bit++;
+    return bit;
+#endif
+}
+
+
+LatencyHistogram::LatencyHistogram() {
+    clearLatency(*this);
+}
+
+
+void clearLatency(LatencyHistogram& histogram) {
+    for (auto& stripe : histogram.stripes) {
+        for (auto& c : stripe.counts) c.store(0, memory_order_relaxed);
+        stripe.sumNs.store(0, memory_order_relaxed);
+        stripe.maxNs.store(0, memory_order_relaxed);
+    }
+}
+
+
+int latencyBucket(uint64_t ns) {
+    if (ns < (1u << LATENCY_SUB_BITS)) return (int)ns;
+    int e = highestBit(ns);
+    if (e >= LATENCY_MAX_BITS) return LATENCY_BUCKETS - 1;
+    int shift = e - (LATENCY_SUB_BITS - 1);
+    return (1 << LATENCY_SUB_BITS) + (e - LATENCY_SUB_BITS) * HALF + (int)(ns >> shift) - HALF;
+}
+
+
+uint64_t latencyBucketLow(int bucket) {
+    if (bucket < (1 << LATENCY_SUB_BITS)) return bucket;
+    int k = bucket - (1 << LATENCY_SUB_BITS);
+    int shift = k / HALF + 1;
+    return (uint64_t)(k % HALF + HALF) << shift;
+}
+
+
+uint64_t latencyBucketHigh(int bucket) {
+    if (bucket < (1 << LATENCY_SUB_BITS)) return bucket;
+    int shift = (bucket - (1 << LATENCY_SUB_BITS)) / HALF + 1;
+    return latencyBucketLow(bucket) + ((uint64_t)1 << shift) - 1;
+}
+
+
+static atomic<int> nextStripe{ 0 };
+
+void recordLatency(LatencyHistogram& histogram, uint64_t ns) {
+    static thread_local int stripeIndex = nextStripe.fetch_add(1, memory_order_relaxed) % LATENCY_STRIPES;
+    LatencyStripe& stripe = histogram.stripes[stripeIndex];
+    stripe.counts[latencyBucket(ns)].fetch_add(1, memory_order_relaxed);
+    stripe.sumNs.fetch_add(ns, memory_order_relaxed);
+    uint64_t seen = stripe.maxNs.load(memory_order_relaxed);
+    while (ns > seen && !stripe.maxNs.compare_exchange_weak(seen, ns, memory_order_relaxed)) {
+    }
+}
+
+
+void recordLatency(RollingLatency& rolling, uint64_t ns) {
+    recordLatency(rolling.windows[rolling.current.load(memory_order_relaxed)], ns);
+}
+
+
+// A record racing with the rotation may land in the window being cleared;
+// losing it is the price of not locking.
+void rotateLatency(RollingLatency& rolling) {
+    int next = 1 - rolling.current.load(memory_order_relaxed);
+    clearLatency(rolling.windows[next]);
+    rolling.current.store(next, memory_order_relaxed);
+}
+
+
+static void addInto(LatencySummary& summary, const LatencyHistogram& histogram, uint64_t& sum) {
+    if (summary.counts.empty()) summary.counts.assign(LATENCY_BUCKETS, 0);
+    for (const auto& stripe : histogram.stripes) {
+        for (int b = 0; b < LATENCY_BUCKETS; ++b) {
+            uint64_t c = stripe.counts[b].load(memory_order_relaxed);
+            summary.counts[b] += c;
+            summary.count += c;
+        }
+        sum += stripe.sumNs.load(memory_order_relaxed);
+        summary.maxNs = max(summary.maxNs, stripe.maxNs.load(memory_order_relaxed));
+    }
+}
+
+
+static void finish(LatencySummary& summary, uint64_t sum) {
+    if (summary.count == 0) return;
+    summary.meanNs = (double)sum / summary.count;
+    auto at = [&summary](double p) {
+        uint64_t rank = max((uint64_t)1, (uint64_t)ceil(p * summary.count));
+        uint64_t seen = 0;
+        for (int b = 0; b < LATENCY_BUCKETS; ++b) {
+            seen += summary.counts[b];
+            if (seen >= rank) return min(latencyBucketHigh(b), summary.maxNs);
+        }
+        return summary.maxNs;
+    };
+    summary.p50Ns = at(0.5);
+    summary.p90Ns = at(0.9);
+    summary.p99Ns = at(0.99);
+    summary.p999Ns = at(0.999);
+}
+
+
+LatencySummary summarizeLatency(const LatencyHistogram& histogram) {
+    LatencySummary summary;
+    uint64_t sum = 0;
+    addInto(summary, histogram, sum);
+    finish(summary, sum);
+    return summary;
+}
+
+
+LatencySummary summarizeLatency(const RollingLatency& rolling) {
+    LatencySummary summary;
+    uint64_t sum = 0;
+    addInto(summary, rolling.windows[0], sum);
+    addInto(summary, rolling.windows[1], sum);
+    finish(summary, sum);
+    return summary;
+}
+
+
+string latencyJson(const vector<string>& names, const vector<LatencySummary>& summaries) {
+    string json = "{\n";
+    char line[256];
+    for (size_t i = 0; i < names.size() && i < summaries.size(); ++i) {
+        const LatencySummary& s = summaries[i];
+        snprintf(line, sizeof(line),
+                 "  \"%s\": {\n    \"count\": %llu, \"mean_ns\": %.1f, \"p50_ns\": %llu, \"p90_ns\": %llu, "
+                 "\"p99_ns\": %llu, \"p99_9_ns\": %llu, \"max_ns\": %llu,\n    \"buckets\": [",
+                 names[i].c_str(), (unsigned long long)s.count, s.meanNs, (unsigned long long)s.p50Ns,
+                 (unsigned long long)s.p90Ns, (unsigned long long)s.p99Ns, (unsigned long long)s.p999Ns,
+                 (unsigned long long)s.maxNs);
+        json += line;
+        bool first = true;
+        for (int b = 0; b < (int)s.counts.size(); ++b) {
+            if (!s.counts[b]) continue;
+            snprintf(line, sizeof(line), "%s[%llu, %llu, %llu]", first ? "" : ", ",
+                     (unsigned long long)latencyBucketLow(b), (unsigned long long)latencyBucketHigh(b),
+                     (unsigned long long)s.counts[b]);
+            json += line;
+            first = false;
+        }
+        json += i + 1 < names.size() ? "]\n  },\n" : "]\n  }\n";
+    }
+    return json + "}\n";
+}
@@ -0,0 +1,92 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Log-linear latency histogram in the style of HdrHistogram. Values below
+// 2^LATENCY_SUB_BITS ns get a bucket each; above that every power of two is
+// split into 2^(LATENCY_SUB_BITS - 1) buckets, so a reported percentile is
+// within 1/64 of the true value. Values from 2^LATENCY_MAX_BITS ns (about 18
+// minutes) up share the last bucket.
+//
+// recordLatency only does relaxed atomic adds, so any number of threads can
+// record into one histogram without a lock. Each thread adds into one of
+// LATENCY_STRIPES copies, so concurrent recorders rarely share a cache line;
+// readers sum the stripes and see a slightly torn but never corrupt view.
+const int LATENCY_SUB_BITS = 7;
+const int LATENCY_MAX_BITS = 40;
+const int LATENCY_BUCKETS = (1 << LATENCY_SUB_BITS) + (LATENCY_MAX_BITS - LATENCY_SUB_BITS) * (1 << (LATENCY_SUB_BITS - 1));
+const int LATENCY_STRIPES = 8;
+
+struct alignas(64) LatencyStripe {
+    atomic<uint64_t> counts[LATENCY_BUCKETS];
+    atomic<uint64_t> sumNs;
+    atomic<uint64_t> maxNs;
+};
+
+struct LatencyHistogram {
+    LatencyStripe stripes[LATENCY_STRIPES];
+
+    LatencyHistogram();
+};
+
+
+void clearLatency(LatencyHistogram& histogram);
+
+
+void recordLatency(LatencyHistogram& histogram, uint64_t ns);
+
+
+// Bucket holding ns, and the range of values that bucket stands for.
+int latencyBucket(uint64_t ns);
+
+
+uint64_t latencyBucketLow(int bucket);
+
+
+uint64_t latencyBucketHigh(int bucket);
+
+
+// Two histograms taking turns, for percentiles over the recent past: records
+// go to the current one, and rotateLatency clears the other and makes it
+// current. A summary covers between one and two rotation periods.
+struct RollingLatency {
+    LatencyHistogram windows[2];
+    atomic<int> current{ 0 };
+};
+
+
+void recordLatency(RollingLatency& rolling, uint64_t ns);
+
+
+void rotateLatency(RollingLatency& rolling);
+
+
+// Percentiles are the highest value of the bucket they fall in, as
+// HdrHistogram reports them.
+struct LatencySummary {
+    uint64_t count = 0;
+    double meanNs = 0;
+    uint64_t p50Ns = 0, p90Ns = 0, p99Ns = 0, p999Ns = 0;
+    uint64_t maxNs = 0;
+    vector<uint64_t> counts; // per bucket
+};
+
+
+LatencySummary summarizeLatency(const LatencyHistogram& histogram);
+
+
+// Both windows merged.
+LatencySummary summarizeLatency(const RollingLatency& rolling);
+
+
+// One JSON object per named summary: count, mean, percentiles and max in
+// nanoseconds, and the non-empty buckets as [low, high, count].
+string latencyJson(const vector<string>& names, const vector<LatencySummary>& summaries);
+
+#endif
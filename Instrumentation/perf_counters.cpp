@@ -0,0 +1,132 @@
+#include "perf_counters.h"
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+const char* perfEventName(PerfEvent event) {
+    switch (event) {
+        case PERF_CYCLES: return "cycles";
+        case PERF_INSTRUCTIONS: return "instructions";
+        case PERF_L1D_MISSES: return "L1D misses";
+        case PERF_LLC_MISSES: return "LLC misses";
+        case PERF_BRANCH_MISSES: return "branch misses";
+        case PERF_DTLB_MISSES: return "dTLB misses";
+        default: return "?";
+    }
+}
+
+
+bool perfAvailable(const PerfCounters& counters, PerfEvent event) {
+    return counters.fds[event] >= 0;
+}
+
+
+#ifdef __linux__
+
+static uint64_t cacheMiss(uint64_t cache) {
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+
+static int openEvent(uint32_t type, uint64_t config, string& error) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    int fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd < 0) {
+        if (errno == EACCES || errno == EPERM) {
+            error = "not permitted (see /proc/sys/kernel/perf_event_paranoid)";
+        } else if (errno == ENOENT || errno == EOPNOTSUPP || errno == EINVAL) {
+            error = "not supported on this CPU or VM";
+        } else if (errno == ENOSYS) {
+            error = "perf_event_open unavailable";
+        } else {
+            error = strerror(errno);
+        }
+    }
+    return fd;
+}
+
+
+int openPerfCounters(PerfCounters& counters) {
+    const uint32_t types[PERF_EVENT_COUNT] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+                                               PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE };
+    const uint64_t configs[PERF_EVENT_COUNT] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                 cacheMiss(PERF_COUNT_HW_CACHE_L1D), PERF_COUNT_HW_CACHE_MISSES,
+                                                 PERF_COUNT_HW_BRANCH_MISSES, cacheMiss(PERF_COUNT_HW_CACHE_DTLB) };
+    int opened = 0;
+    for (int e = 0; e < PERF_EVENT_COUNT; ++e) {
+        counters.errors[e].clear();
+        counters.fds[e] = openEvent(types[e], configs[e], counters.errors[e]);
+        if (counters.fds[e] >= 0) opened++;
+    }
+    return opened;
+}
+
+
+void startPerfCounters(PerfCounters& counters) {
+    for (int fd : counters.fds) {
+        if (fd < 0) continue;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+
+void stopPerfCounters(PerfCounters& counters, uint64_t values[PERF_EVENT_COUNT]) {
+    for (int fd : counters.fds) {
+        if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+    for (int e = 0; e < PERF_EVENT_COUNT; ++e) {
+        values[e] = 0;
+        uint64_t data[3]; // value, time enabled, time running
+        if (counters.fds[e] < 0 || read(counters.fds[e], data, sizeof(data)) != (ssize_t)sizeof(data)) continue;
+        values[e] = data[2] > 0 && data[2] < data[1] ? (uint64_t)((double)data[0] * data[1] / data[2]) : data[0];
+    }
+}
+
+
+void closePerfCounters(PerfCounters& counters) {
+    for (int& fd : counters.fds) {
+        if (fd >= 0) close(fd);
+        fd = -1;
+    }
+}
+
+#else
+
+int openPerfCounters(PerfCounters& counters) {
+    for (int e = 0; e < PERF_EVENT_COUNT; ++e) {
+        counters.fds[e] = -1;
+        counters.errors[e] = "hardware counters need Linux perf_event_open";
+    }
+    return 0;
+}
+
+
+void startPerfCounters(PerfCounters&) {
+}
+
+
+void stopPerfCounters(PerfCounters&, uint64_t values[PERF_EVENT_COUNT]) {
+    for (int e = 0; e < PERF_EVENT_COUNT; ++e) values[e] = 0;
+}
+
+
+void closePerfCounters(PerfCounters&) {
+}
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+// Hardware event counters for the calling thread, through Linux
+// perf_event_open. Each event is opened on its own, so a machine or VM that
+// lacks some of them still reports the rest. Elsewhere, or when the kernel
+// refuses (perf_event_paranoid, containers), nothing opens and callers carry
+// on with wall-clock timing.
+enum PerfEvent {
+    PERF_CYCLES, PERF_INSTRUCTIONS, PERF_L1D_MISSES, PERF_LLC_MISSES, PERF_BRANCH_MISSES, PERF_DTLB_MISSES,
+    PERF_EVENT_COUNT
+};
+
+struct PerfCounters {
+    int fds[PERF_EVENT_COUNT];
+    string errors[PERF_EVENT_COUNT]; // why an event did not open
+};
+
+
+const char* perfEventName(PerfEvent event);
+
+
+// Returns the number of events that opened.
+int openPerfCounters(PerfCounters& counters);
+
+
+bool perfAvailable(const PerfCounters& counters, PerfEvent event);
+
+
+// Zeroes and enables every open counter.
+void startPerfCounters(PerfCounters& counters);
+
+
+// Disables the counters and reads them. When the kernel had to share the
+// hardware between events, counts are scaled up to the whole interval.
+// Events that are not open read as 0.
+void stopPerfCounters(PerfCounters& counters, uint64_t values[PERF_EVENT_COUNT]);
+
+
+void closePerfCounters(PerfCounters& counters);
+
+#endif
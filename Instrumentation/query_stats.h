@@ -0,0 +1,77 @@
+#ifndef QUERY_STATS_H
+#define QUERY_STATS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+// Build with -DQUERY_STATS=0 to compile the counters out of the searches.
+#ifndef QUERY_STATS
+#define QUERY_STATS 1
+#endif
+
+// Work done by nearest-neighbour searches. A search fills one of these when
+// it is given a non-null stats pointer; accumulate() sums them per category.
+//   nodesVisited    nodes entered and not rejected by mask or distance
+//   leavesScanned   visited nodes without children
+//   distanceEvals   point-to-target distance computations
+//   prunedSubtrees  subtrees skipped by the distance bound or attribute mask
+//   backtracks      visited subtrees that do not contain the target
+//   maxDepth        deepest node visited, the root being depth 0
+//
+// With trace set, the search also lists every node it visited or pruned, in
+// order. Nodes it never reached do not appear. The pointers identify nodes
+// of the tree as it was searched and are only compared, never followed.
+enum TraceOutcome : uint8_t { TRACE_VISITED = 1, TRACE_PRUNED = 2 };
+
+struct TraceEvent {
+    const void* node;
+    TraceOutcome outcome;
+};
+
+struct QueryStats {
+    uint64_t queries = 0;
+    uint64_t nodesVisited = 0;
+    uint64_t leavesScanned = 0;
+    uint64_t distanceEvals = 0;
+    uint64_t prunedSubtrees = 0;
+    uint64_t backtracks = 0;
+    int maxDepth = 0;
+    vector<TraceEvent>* trace = nullptr;
+};
+
+#if QUERY_STATS
+#define QUERY_STAT(stats, statement) do { if (stats) { statement; } } while (0)
+#define QUERY_TRACE(stats, node, outcome) \
+    do { if (stats && stats->trace) stats->trace->push_back(TraceEvent{ node, outcome }); } while (0)
+#else
+#define QUERY_STAT(stats, statement) do {} while (0)
+#define QUERY_TRACE(stats, node, outcome) do {} while (0)
+#endif
+
+
+inline void accumulate(QueryStats& total, const QueryStats& query) {
+    total.queries += query.queries;
+    total.nodesVisited += query.nodesVisited;
+    total.leavesScanned += query.leavesScanned;
+    total.distanceEvals += query.distanceEvals;
+    total.prunedSubtrees += query.prunedSubtrees;
+    total.backtracks += query.backtracks;
+    total.maxDepth = max(total.maxDepth, query.maxDepth);
+}
+
+
+// One line for a status bar. Totals over several queries are shown as
+// per-query averages.
+inline string describeStats(const QueryStats& stats) {
+    uint64_t n = max(stats.queries, (uint64_t)1);
+    auto avg = [n](uint64_t v) { return to_string((v + n / 2) / n); };
+    return avg(stats.nodesVisited) + " nodes, " + avg(stats.leavesScanned) + " leaves, " +
+           avg(stats.distanceEvals) + " dists, " + avg(stats.prunedSubtrees) + " pruned, " +
+           avg(stats.backtracks) + " backtracks, depth " + to_string(stats.maxDepth);
+}
+
+#endif
@@ -0,0 +1,179 @@
+#include "tree_shape.h"
+
+#include <cstdlib>
+#include <cstdio>
+#include <map>
+#include <utility>
+
+#if defined(_WIN32) || defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+// What the allocator reserves for a request of this size. Rounding depends
+// only on the size, so one probe stands for every block of that size.
+static size_t allocatedSize(size_t requested) {
+#if defined(_WIN32) || defined(__GLIBC__)
+    void* p = malloc(requested);
+    if (!p) return requested;
+#ifdef _WIN32
+    size_t size = _msize(p);
+#else
+    size_t size = malloc_usable_size(p);
+#endif
+    free(p);
+    return max(size, requested);
+#else
+    return requested;
+#endif
+}
+
+
+// The node std::list allocates per element: two links, then the value.
+template <typename T>
+struct ListNodeLayout {
+    void* next;
+    void* prev;
+    T value;
+};
+
+
+static void countNode(TreeShape& shape, int depth) {
+    shape.nodes++;
+    if ((int)shape.depthHistogram.size() <= depth) shape.depthHistogram.resize(depth + 1);
+    shape.depthHistogram[depth]++;
+    shape.height = max(shape.height, depth + 1);
+}
+
+
+static void countLeaf(TreeShape& shape, size_t points) {
+    shape.leaves++;
+    if (shape.leafOccupancy.size() <= points) shape.leafOccupancy.resize(points + 1);
+    shape.leafOccupancy[points]++;
+}
+
+
+double TreeShape::balanceFactor() const {
+    if (nodes == 0) return 1.0;
+    // Least height of a fanout-ary tree holding this many nodes.
+    int ideal = 0;
+    double capacity = 0, level = 1;
+    while (capacity < (double)nodes) {
+        capacity += level;
+        level *= fanout;
+        ideal++;
+    }
+    return (double)height / ideal;
+}
+
+
+// Both walks keep their own stack: a degenerate K-D tree can be deeper than
+// the call stack allows.
+TreeShape measureTree(const KDNode* root) {
+    TreeShape shape;
+    shape.fanout = 2;
+    vector<pair<const KDNode*, int>> stack;
+    if (root) stack.push_back({ root, 0 });
+    while (!stack.empty()) {
+        const KDNode* node = stack.back().first;
+        int depth = stack.back().second;
+        stack.pop_back();
+
+        countNode(shape, depth);
+        shape.points++;
+        if (!node->left && !node->right) countLeaf(shape, 1);
+        if (node->left) stack.push_back({ node->left, depth + 1 });
+        if (node->right) stack.push_back({ node->right, depth + 1 });
+    }
+
+    size_t payload = sizeof(KDTree2D::Point) + sizeof(uint32_t);
+    shape.pointBytes = shape.nodes * payload;
+    shape.nodeBytes = shape.nodes * (sizeof(KDNode) - payload);
+    shape.slackBytes = shape.nodes * (allocatedSize(sizeof(KDNode)) - sizeof(KDNode));
+    return shape;
+}
+
+
+TreeShape measureTree(const QuadNode* root) {
+    TreeShape shape;
+    shape.fanout = 4;
+    map<size_t, size_t> coordinateBuffers; // vector capacity -> how many
+    vector<pair<const QuadNode*, int>> stack;
+    if (root) stack.push_back({ root, 0 });
+    while (!stack.empty()) {
+        const QuadNode* node = stack.back().first;
+        int depth = stack.back().second;
+        stack.pop_back();
+
+        countNode(shape, depth);
+        shape.points += node->points.size();
+        if (node->count == 0) shape.emptyNodes++;
+        for (const auto& p : node->points) {
+            if (p.capacity() > 0) coordinateBuffers[p.capacity()]++;
+        }
+        if (!node->divided) {
+            countLeaf(shape, node->points.size());
+            continue;
+        }
+        for (const QuadNode* child : { node->nw, node->ne, node->sw, node->se }) {
+            stack.push_back({ child, depth + 1 });
+        }
+    }
+
+    size_t pointNode = sizeof(ListNodeLayout<vector<double>>);
+    size_t attrNode = sizeof(ListNodeLayout<uint32_t>);
+    shape.nodeBytes = shape.nodes * sizeof(QuadNode);
+    shape.pointBytes = shape.points * (pointNode + attrNode);
+    shape.slackBytes = shape.nodes * (allocatedSize(sizeof(QuadNode)) - sizeof(QuadNode)) +
+                       shape.points * (allocatedSize(pointNode) - pointNode + allocatedSize(attrNode) - attrNode);
+    for (const auto& buffer : coordinateBuffers) {
+        size_t bytes = buffer.first * sizeof(double);
+        shape.pointBytes += buffer.second * bytes;
+        shape.slackBytes += buffer.second * (allocatedSize(bytes) - bytes);
+    }
+    return shape;
+}
+
+
+static string formatBytes(size_t bytes) {
+    char text[32];
+    if (bytes >= (size_t)1 << 20) {
+        snprintf(text, sizeof(text), "%.1f MB", bytes / 1048576.0);
+    } else if (bytes >= 1024) {
+        snprintf(text, sizeof(text), "%.1f KB", bytes / 1024.0);
+    } else {
+        snprintf(text, sizeof(text), "%zu B", bytes);
+    }
+    return text;
+}
+
+
+// "0-4: 31, 5-9: 992, ..." with the ranges sized so there are at most
+// `buckets` of them.
+static string foldHistogram(const vector<size_t>& histogram, int buckets) {
+    size_t width = (histogram.size() + buckets - 1) / max(buckets, 1);
+    width = max(width, (size_t)1);
+    string text;
+    for (size_t lo = 0; lo < histogram.size(); lo += width) {
+        size_t hi = min(lo + width, histogram.size()) - 1;
+        size_t total = 0;
+        for (size_t i = lo; i <= hi; ++i) total += histogram[i];
+        if (!text.empty()) text += ", ";
+        text += to_string(lo);
+        if (hi > lo) text += "-" + to_string(hi);
+        text += ": " + to_string(total);
+    }
+    return text.empty() ? "none" : text;
+}
+
+
+string describeShape(const TreeShape& shape, int buckets) {
+    char text[256];
+    snprintf(text, sizeof(text),
+             "%zu points in %zu nodes, height %d (balance %.2f), %zu leaves, %zu empty nodes (%.1f%%)\n"
+             "Memory %s: nodes %s, points %s, slack %s\n",
+             shape.points, shape.nodes, shape.height, shape.balanceFactor(), shape.leaves, shape.emptyNodes,
+             100.0 * shape.emptyRatio(), formatBytes(shape.totalBytes()).c_str(), formatBytes(shape.nodeBytes).c_str(),
+             formatBytes(shape.pointBytes).c_str(), formatBytes(shape.slackBytes).c_str());
+    return string(text) + "Nodes by depth: " + foldHistogram(shape.depthHistogram, buckets) + "\n" +
+           "Leaves by points held: " + foldHistogram(shape.leafOccupancy, buckets);
+}
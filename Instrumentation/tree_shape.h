@@ -0,0 +1,56 @@
+#ifndef TREE_SHAPE_H
+#define TREE_SHAPE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "../KD-Tree/kd_tree.h"
+#include "../Quad-Tree/quadtree.h"
+
+using namespace std;
+
+// Shape and memory of one tree, for spotting a K-D tree that sequential
+// inserts have turned into a list, or a quadtree left full of empty nodes by
+// removals.
+//
+// Memory is split three ways, and the three parts add up to everything the
+// tree has allocated:
+//   nodeBytes   node objects, without the points stored inside them
+//   pointBytes  coordinates and attribute words, with the containers holding
+//               them (the quadtree's list nodes and coordinate vectors)
+//   slackBytes  what the allocator hands out beyond each request, as
+//               reported by malloc_usable_size / _msize
+struct TreeShape {
+    int fanout = 2;
+    size_t nodes = 0;
+    size_t leaves = 0;
+    size_t emptyNodes = 0;         // nodes with no point in their subtree
+    size_t points = 0;
+    int height = 0;                // levels; 0 for an empty tree
+    vector<size_t> depthHistogram; // nodes at each depth, the root at 0
+    vector<size_t> leafOccupancy;  // leaves holding 0, 1, 2, ... points
+    size_t nodeBytes = 0;
+    size_t pointBytes = 0;
+    size_t slackBytes = 0;
+
+    size_t totalBytes() const { return nodeBytes + pointBytes + slackBytes; }
+    double emptyRatio() const { return nodes ? (double)emptyNodes / nodes : 0.0; }
+
+    // Height divided by the least height any tree with this many nodes and
+    // this fanout can have: 1 is perfectly balanced, a list is nodes / log.
+    double balanceFactor() const;
+};
+
+
+TreeShape measureTree(const KDNode* root);
+
+
+TreeShape measureTree(const QuadNode* root);
+
+
+// A few lines of text for a panel: counts, balance, memory, and the depth
+// and occupancy histograms folded into at most `buckets` ranges.
+string describeShape(const TreeShape& shape, int buckets = 8);
+
+#endif
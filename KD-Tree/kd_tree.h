@@ -2,28 +2,549 @@
 #define KD_TREE_H
 
 #include <vector>
+#include <array>
 #include <limits>
 #include <cmath>
+#include <cstdint>
+#include <queue>
+#include <functional>
+#include <algorithm>
+
+#include "../Distance/metric.h"
+#include "../Instrumentation/query_stats.h"
 
 using namespace std;
 
-struct KDNode {
-    vector<double> point;
-    KDNode* left;
-    KDNode* right;
-    KDNode(const vector<double>& pt) : point(pt), left(nullptr), right(nullptr) {}
+// Squared distances are accumulated in a type wide enough to stay exact:
+// double for floating point coordinates, int64_t for int32_t grids.
+template <typename T>
+struct KDDistance { typedef double type; };
+
+template <>
+struct KDDistance<int32_t> { typedef int64_t type; };
+
+
+template <typename T, int Dims>
+struct KDTree {
+    typedef array<T, Dims> Point;
+    typedef typename KDDistance<T>::type Distance;
+
+    // attrs is the point's attribute word; mask is the OR of attrs over the
+    // node's subtree, so subtrees without a matching point can be skipped.
+    struct Node {
+        Point point;
+        uint32_t attrs;
+        uint32_t mask;
+        Node* left;
+        Node* right;
+        Node(const Point& pt, uint32_t a = 0) : point(pt), attrs(a), mask(a), left(nullptr), right(nullptr) {}
+    };
+
+    // A key equal to the node's goes to a side picked at random, so repeated
+    // points form a randomly built subtree instead of a chain as long as their
+    // multiplicity.
+    static Node* insert(Node* root, const Point& point, int depth = 0, uint32_t attrs = 0);
+    static bool goesLeft(const Point& point, const Node* node, int axis);
+    static void deleteTree(Node* root);
+
+    // Balanced bulk build: every node is the median of its range on the split
+    // axis. Keys equal to the median may land on either side, so the height
+    // stays ceil(log2(n + 1)) however many coordinates tie. Searches only need
+    // left <= key <= right, and removal looks on both sides of a tie. attrs
+    // may be null, giving every point attribute word 0.
+    static Node* build(const Point* points, const uint32_t* attrs, size_t count);
+    static Node* buildRange(Node** nodes, size_t count, int depth);
+    static Node* findMin(Node* root, int axis, int depth);
+    static Node* removeNode(Node* root, const Point& point_rmv, int depth = 0, const uint32_t* attrs = nullptr);
+    static bool removeOne(Node*& root, const Point& point_rmv, int depth, const uint32_t* attrs);
+    static void updateMask(Node* node);
+
+    // bestDist is reported in the metric's units (squared for L2). With
+    // eps > 0 the result is within (1 + eps) of the true nearest distance;
+    // negative eps counts as 0.
+    // Only points whose attrs contain every bit of mask are considered.
+    // When stats is given, the search's counters are added to it.
+    template <class Metric = L2Metric>
+    static Node* findNearest(Node* root, const Point& target_point, Distance& bestDist,
+                             const Metric& metric = Metric(), double eps = 0.0, uint32_t mask = 0,
+                             QueryStats* stats = nullptr);
+
+    // State of one findNearest call. gaps holds, per axis, how far the target
+    // lies outside the cell being searched; folded with the metric it bounds
+    // the distance to anything in the cell, which prunes far more than the
+    // distance to the last splitting plane alone. Regions are compared with
+    // limit, the best distance with the approximation already folded in.
+    template <class Metric>
+    struct Search {
+        const Point& target;
+        const Metric& metric;
+        double shrink; // 1 / approxScale(eps)
+        uint32_t mask;
+        QueryStats* stats;
+        Node* nearest;
+        Distance best;
+        Distance limit;
+        array<Distance, Dims> gaps;
+    };
+
+    template <class Metric>
+    static void nearestPoint(Node* root, int depth, Search<Metric>& search);
+
+    // Best-bin-first search: regions are explored closest-bound first and at
+    // most maxVisits nodes are examined. exact is true when the search ended
+    // because no remaining region could improve the result.
+    template <class Metric = L2Metric>
+    static Node* findNearestBBF(Node* root, const Point& target_point, int maxVisits, Distance& bestDist, bool& exact,
+                                const Metric& metric = Metric());
+
+    static Node* insertCopyOnWrite(Node* root, const Point& point, vector<Node*>& replaced, int depth = 0,
+                                   uint32_t attrs = 0);
+    static Node* removeCopyOnWrite(Node* root, const Point& point_rmv, vector<Node*>& replaced, int depth = 0,
+                                   const uint32_t* attrs = nullptr);
 };
 
 
-KDNode* insert(KDNode* root, vector<double> point, int depth = 0);
+template <typename T, int Dims>
+typename KDTree<T, Dims>::Node* KDTree<T, Dims>::insert(Node* root, const Point& point, int depth, uint32_t attrs) {
+    if (root == nullptr) {
+        return new Node(point, attrs);
+    }
+    int axis = depth % Dims;
+
+    root->mask |= attrs;
+    if (goesLeft(point, root, axis)) {
+        root->left = insert(root->left, point, depth + 1, attrs);
+    } else {
+        root->right = insert(root->right, point, depth + 1, attrs);
+    }
+
+    return root;
+}
+
+
+template <typename T, int Dims>
+bool KDTree<T, Dims>::goesLeft(const Point& point, const Node* node, int axis) {
+    if (point[axis] != node->point[axis]) return point[axis] < node->point[axis];
+    static thread_local uint32_t state = 2463534242u; // xorshift32
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state & 1;
+}
+
+
+template <typename T, int Dims>
+typename KDTree<T, Dims>::Node* KDTree<T, Dims>::build(const Point* points, const uint32_t* attrs, size_t count) {
+    vector<Node*> nodes(count);
+    for (size_t i = 0; i < count; ++i) {
+        nodes[i] = new Node(points[i], attrs ? attrs[i] : 0);
+    }
+    return buildRange(nodes.data(), count, 0);
+}
+
+
+template <typename T, int Dims>
+typename KDTree<T, Dims>::Node* KDTree<T, Dims>::buildRange(Node** nodes, size_t count, int depth) {
+    if (count == 0) return nullptr;
+    int axis = depth % Dims;
+    size_t mid = count / 2;
+    nth_element(nodes, nodes + mid, nodes + count,
+                [axis](const Node* a, const Node* b) { return a->point[axis] < b->point[axis]; });
+
+    Node* root = nodes[mid];
+    root->left = buildRange(nodes, mid, depth + 1);
+    root->right = buildRange(nodes + mid + 1, count - mid - 1, depth + 1);
+    updateMask(root);
+    return root;
+}
+
+
+template <typename T, int Dims>
+void KDTree<T, Dims>::deleteTree(Node* root) {
+    if (!root) return;
+    deleteTree(root->left);
+    deleteTree(root->right);
+    delete root;
+}
+
+
+template <typename T, int Dims>
+void KDTree<T, Dims>::updateMask(Node* node) {
+    node->mask = node->attrs;
+    if (node->left) node->mask |= node->left->mask;
+    if (node->right) node->mask |= node->right->mask;
+}
+
+
+template <typename T, int Dims>
+template <class Metric>
+void KDTree<T, Dims>::nearestPoint(Node* root, int depth, Search<Metric>& search) {
+    if (root == nullptr) return;
+    QueryStats* stats = search.stats;
+    if ((root->mask & search.mask) != search.mask) {
+        QUERY_STAT(stats, stats->prunedSubtrees++);
+        QUERY_TRACE(stats, root, TRACE_PRUNED);
+        return;
+    }
+    QUERY_TRACE(stats, root, TRACE_VISITED);
+    QUERY_STAT(stats, {
+        stats->nodesVisited++;
+        if (!root->left && !root->right) stats->leavesScanned++;
+        stats->maxDepth = max(stats->maxDepth, depth);
+    });
+
+    int axis = depth % Dims;
+    if ((root->attrs & search.mask) == search.mask) {
+        QUERY_STAT(stats, stats->distanceEvals++);
+        Distance d = MetricDistance<Dims>::template eval<Distance>(search.metric, root->point, search.target);
+        if (d < search.best) {
+            search.best = d;
+            search.nearest = root;
+            search.limit = pruneLimit(d, search.shrink);
+        }
+    }
+
+    Distance diff = (Distance)search.target[axis] - (Distance)root->point[axis];
+    Node* next = diff < 0 ? root->left : root->right;
+    Node* other = diff < 0 ? root->right : root->left;
+
+    nearestPoint(next, depth + 1, search);
+    if (other == nullptr) return;
+
+    Distance gap = search.gaps[axis];
+    search.gaps[axis] = diff;
+    if (MetricDistance<Dims>::template fold<Distance>(search.metric, search.gaps) < search.limit) {
+        QUERY_STAT(stats, if ((other->mask & search.mask) == search.mask) stats->backtracks++);
+        nearestPoint(other, depth + 1, search);
+    } else {
+        QUERY_STAT(stats, stats->prunedSubtrees++);
+        QUERY_TRACE(stats, other, TRACE_PRUNED);
+    }
+    search.gaps[axis] = gap;
+}
+
+
+template <typename T, int Dims>
+template <class Metric>
+typename KDTree<T, Dims>::Node* KDTree<T, Dims>::findNearest(Node* root, const Point& target_point, Distance& bestDist,
+                                                             const Metric& metric, double eps, uint32_t mask,
+                                                             QueryStats* stats) {
+    Distance none = numeric_limits<Distance>::max();
+    Search<Metric> search{ target_point, metric, 1 / metric.approxScale(max(eps, 0.0)), mask, stats, nullptr, none, none,
+                           {} };
+    search.limit = pruneLimit(none, search.shrink);
+    QUERY_STAT(stats, stats->queries++);
+    nearestPoint(root, 0, search);
+    bestDist = search.best;
+    return search.nearest;
+}
+
+
+template <typename T, int Dims>
+template <class Metric>
+typename KDTree<T, Dims>::Node* KDTree<T, Dims>::findNearestBBF(Node* root, const Point& target_point, int maxVisits,
+                                                                Distance& bestDist, bool& exact, const Metric& metric) {
+    struct Bin {
+        Distance bound;
+        Node* node;
+        int depth;
+        bool operator>(const Bin& other) const { return bound > other.bound; }
+    };
+
+    Node* nearestNode = nullptr;
+    bestDist = numeric_limits<Distance>::max();
+    exact = true;
+    if (root == nullptr) return nullptr;
+
+    priority_queue<Bin, vector<Bin>, greater<Bin>> bins;
+    bins.push(Bin{ 0, root, 0 });
+    int visits = 0;
+
+    while (!bins.empty()) {
+        Bin bin = bins.top();
+        bins.pop();
+        if (!(bin.bound < bestDist)) break;
+
+        Node* node = bin.node;
+        int depth = bin.depth;
+        while (node != nullptr) {
+            if (visits == maxVisits) {
+                exact = false;
+                return nearestNode;
+            }
+            visits++;
+
+            int axis = depth % Dims;
+            Distance d = MetricDistance<Dims>::template eval<Distance>(metric, node->point, target_point);
+            if (d < bestDist) {
+                bestDist = d;
+                nearestNode = node;
+            }
+
+            Distance diff = (Distance)target_point[axis] - (Distance)node->point[axis];
+            Node* next = diff < 0 ? node->left : node->right;
+            Node* other = diff < 0 ? node->right : node->left;
+
+            Distance planeBound = metric.template term<Distance>(diff, axis);
+            Distance otherBound = planeBound > bin.bound ? planeBound : bin.bound;
+            if (other != nullptr && otherBound < bestDist) {
+                bins.push(Bin{ otherBound, other, depth + 1 });
+            }
+
+            node = next;
+            depth++;
+        }
+    }
+
+    return nearestNode;
+}
+
+
+template <typename T, int Dims>
+typename KDTree<T, Dims>::Node* KDTree<T, Dims>::findMin(Node* root, int axis, int depth) {
+    if (root == nullptr) return nullptr;
+
+    int currAxis = depth % Dims;
+
+    if (currAxis == axis) {
+        if (root->left == nullptr) {
+            return root;
+        }
+        return findMin(root->left, axis, depth + 1);
+    }
+
+    Node* left = findMin(root->left, axis, depth + 1);
+    Node* right = findMin(root->right, axis, depth + 1);
+    Node* minNode = root;
+
+    if (left != nullptr && left->point[axis] < minNode->point[axis]) {
+        minNode = left;
+    }
+    if (right != nullptr && right->point[axis] < minNode->point[axis]) {
+        minNode = right;
+    }
+
+    return minNode;
+}
+
+
+// With attrs set, only a node carrying exactly those attributes matches; the
+// replacement step uses this so the copied point and its attributes stay
+// together when duplicates exist.
+template <typename T, int Dims>
+typename KDTree<T, Dims>::Node* KDTree<T, Dims>::removeNode(Node* root, const Point& point_rmv, int depth,
+                                                            const uint32_t* attrs) {
+    removeOne(root, point_rmv, depth, attrs);
+    return root;
+}
+
+
+// Returns whether a node was removed. A point whose key ties with a node's
+// may sit in either subtree, so both are tried, right first.
+template <typename T, int Dims>
+bool KDTree<T, Dims>::removeOne(Node*& root, const Point& point_rmv, int depth, const uint32_t* attrs) {
+    if (root == nullptr) return false;
+
+    int axis = depth % Dims;
+
+    if (root->point == point_rmv && (attrs == nullptr || root->attrs == *attrs)) {
+        if (root->right != nullptr) {
+            Node* minNode = findMin(root->right, axis, depth + 1);
+            root->point = minNode->point;
+            root->attrs = minNode->attrs;
+            removeOne(root->right, root->point, depth + 1, &root->attrs);
+        } else if (root->left != nullptr) {
+            Node* minNode = findMin(root->left, axis, depth + 1);
+            root->point = minNode->point;
+            root->attrs = minNode->attrs;
+            root->right = root->left;
+            root->left = nullptr;
+            removeOne(root->right, root->point, depth + 1, &root->attrs);
+        } else {
+            delete root;
+            root = nullptr;
+            return true;
+        }
+        updateMask(root);
+        return true;
+    }
+
+    bool removed;
+    if (point_rmv[axis] < root->point[axis]) {
+        removed = removeOne(root->left, point_rmv, depth + 1, attrs);
+    } else {
+        removed = removeOne(root->right, point_rmv, depth + 1, attrs);
+        if (!removed && point_rmv[axis] == root->point[axis]) {
+            removed = removeOne(root->left, point_rmv, depth + 1, attrs);
+        }
+    }
+    if (removed) updateMask(root);
+
+    return removed;
+}
+
+
+template <typename T, int Dims>
+typename KDTree<T, Dims>::Node* KDTree<T, Dims>::insertCopyOnWrite(Node* root, const Point& point, vector<Node*>& replaced,
+                                                                   int depth, uint32_t attrs) {
+    if (root == nullptr) {
+        return new Node(point, attrs);
+    }
+    int axis = depth % Dims;
+
+    Node* copy = new Node(*root);
+    replaced.push_back(root);
+    copy->mask |= attrs;
+    if (goesLeft(point, root, axis)) {
+        copy->left = insertCopyOnWrite(root->left, point, replaced, depth + 1, attrs);
+    } else {
+        copy->right = insertCopyOnWrite(root->right, point, replaced, depth + 1, attrs);
+    }
+
+    return copy;
+}
+
+
+template <typename T, int Dims>
+typename KDTree<T, Dims>::Node* KDTree<T, Dims>::removeCopyOnWrite(Node* root, const Point& point_rmv, vector<Node*>& replaced,
+                                                                   int depth, const uint32_t* attrs) {
+    if (root == nullptr) return nullptr;
+
+    int axis = depth % Dims;
+
+    if (root->point == point_rmv && (attrs == nullptr || root->attrs == *attrs)) {
+        replaced.push_back(root);
+        if (root->right != nullptr) {
+            Node* minNode = findMin(root->right, axis, depth + 1);
+            Node* copy = new Node(minNode->point, minNode->attrs);
+            copy->left = root->left;
+            copy->right = removeCopyOnWrite(root->right, copy->point, replaced, depth + 1, &copy->attrs);
+            updateMask(copy);
+            return copy;
+        } else if (root->left != nullptr) {
+            Node* minNode = findMin(root->left, axis, depth + 1);
+            Node* copy = new Node(minNode->point, minNode->attrs);
+            copy->right = removeCopyOnWrite(root->left, copy->point, replaced, depth + 1, &copy->attrs);
+            updateMask(copy);
+            return copy;
+        }
+        return nullptr;
+    }
+
+    bool goLeft = point_rmv[axis] < root->point[axis];
+    Node* child = goLeft ? root->left : root->right;
+    Node* updated = removeCopyOnWrite(child, point_rmv, replaced, depth + 1, attrs);
+    if (updated == child && point_rmv[axis] == root->point[axis]) {
+        goLeft = true;
+        child = root->left;
+        updated = removeCopyOnWrite(child, point_rmv, replaced, depth + 1, attrs);
+    }
+    if (updated == child) {
+        return root;
+    }
+
+    Node* copy = new Node(*root);
+    replaced.push_back(root);
+    if (goLeft) {
+        copy->left = updated;
+    } else {
+        copy->right = updated;
+    }
+    updateMask(copy);
+    return copy;
+}
+
+
+// Distance browsing: yields the points of a tree one at a time in increasing
+// distance from the target, so callers can stop at the first point that
+// satisfies a predicate. Nodes and points share one priority queue, keyed by
+// a lower bound for nodes and the exact distance for points. The tree must
+// not change while an iterator is in use.
+template <typename T, int Dims, class Metric = L2Metric>
+struct KDNearestIterator {
+    typedef KDTree<T, Dims> Tree;
+    typedef typename Tree::Node Node;
+    typedef typename Tree::Point Point;
+    typedef typename Tree::Distance Distance;
+
+    struct Entry {
+        Distance key;
+        Node* node;
+        int depth; // -1 for a point entry
+        bool operator>(const Entry& other) const { return key > other.key; }
+    };
+
+    Point target;
+    Metric metric;
+    priority_queue<Entry, vector<Entry>, greater<Entry>> queue;
+
+    KDNearestIterator(Node* root, const Point& target_point, const Metric& m = Metric())
+        : target(target_point), metric(m) {
+        if (root != nullptr) queue.push(Entry{ 0, root, 0 });
+    }
+
+    // Returns false once every point has been yielded. dist is in the
+    // metric's units (squared for L2).
+    bool next(Node*& node, Distance& dist) {
+        while (!queue.empty()) {
+            Entry entry = queue.top();
+            queue.pop();
+            if (entry.depth < 0) {
+                node = entry.node;
+                dist = entry.key;
+                return true;
+            }
+
+            Node* current = entry.node;
+            queue.push(Entry{ MetricDistance<Dims>::template eval<Distance>(metric, current->point, target), current, -1 });
+
+            int axis = entry.depth % Dims;
+            Distance diff = (Distance)target[axis] - (Distance)current->point[axis];
+            Node* nearChild = diff < 0 ? current->left : current->right;
+            Node* farChild = diff < 0 ? current->right : current->left;
+            if (nearChild != nullptr) queue.push(Entry{ entry.key, nearChild, entry.depth + 1 });
+            if (farChild != nullptr) {
+                Distance planeBound = metric.template term<Distance>(diff, axis);
+                queue.push(Entry{ planeBound > entry.key ? planeBound : entry.key, farChild, entry.depth + 1 });
+            }
+        }
+        return false;
+    }
+};
+
+
+// The 2D double tree used by the application is compiled once in kd_tree.cpp.
+extern template struct KDTree<double, 2>;
+
+typedef KDTree<double, 2> KDTree2D;
+typedef KDTree2D::Node KDNode;
+
+
+KDNode* insert(KDNode* root, vector<double> point, int depth = 0, uint32_t attrs = 0);
 
 
 void deleteTree(KDNode* root);
 
 
-KDNode* removeNode(KDNode* root, vector<double>& point_rmv, int depth = 0);
+// With attrs set, only a point carrying exactly that attribute word is
+// removed, so the right one of several points at the same spot goes.
+KDNode* removeNode(KDNode* root, vector<double>& point_rmv, int depth = 0, const uint32_t* attrs = nullptr);
+
+
+KDNode* findNearest(KDNode* root, vector<double>& target_point, double& bestDist, double eps = 0.0, uint32_t mask = 0,
+                    QueryStats* stats = nullptr);
+
+
+KDNode* findNearestBBF(KDNode* root, vector<double>& target_point, int maxVisits, double& bestDist, bool& exact);
+
+
+// Copy-on-write variants: nodes on the modified path are copied instead of
+// mutated, the originals are appended to `replaced` (still linked from the old
+// root), and the new root is returned. Unchanged subtrees are shared.
+KDNode* insertCopyOnWrite(KDNode* root, const vector<double>& point, vector<KDNode*>& replaced, int depth = 0,
+                          uint32_t attrs = 0);
 
 
-KDNode* findNearest(KDNode* root, vector<double>& target_point, double& bestDist);
+KDNode* removeCopyOnWrite(KDNode* root, const vector<double>& point_rmv, vector<KDNode*>& replaced, int depth = 0);
 
-#endif
\ No newline at end of file
+#endif
@@ -1,15 +1,15 @@
 #include "quadtree.h"
 QuadNode::QuadNode(double x1, double x2, double y1, double y2, int cap)
     : x_min(x1), x_max(x2), y_min(y1), y_max(y2), capacity(cap),
-      divided(false), nw(nullptr), ne(nullptr), sw(nullptr), se(nullptr) {}
+      mask(0), divided(false), count(0), nw(nullptr), ne(nullptr), sw(nullptr), se(nullptr) {}
 
-bool samePoint(vector<double>& a, vector<double>& b, double eps = 1e-9) {
+bool samePoint(const vector<double>& a, const vector<double>& b, double eps = 1e-9) {
     if (a.size() < 2 || b.size() < 2) return false;
     return (fabs(a[0] - b[0]) < eps && fabs(a[1] - b[1]) < eps);
 }
 
 
-double distSq(vector<double>& a, vector<double>& b) {
+double distSq(const vector<double>& a, const vector<double>& b) {
     if (a.size() < 2 || b.size() < 2) return numeric_limits<double>::max();
     double dx = a[0] - b[0];
     double dy = a[1] - b[1];
@@ -17,13 +17,19 @@ double distSq(vector<double>& a, vector<double>& b) {
 }
 
 
-bool contains(QuadNode* node, vector<double>& p) {
+bool contains(QuadNode* node, const vector<double>& p) {
     if (p.size() < 2) return false;
     return (p[0] >= node->x_min && p[0] <= node->x_max &&
             p[1] >= node->y_min && p[1] <= node->y_max);
 }
 
 
+static bool isFull(const QuadNode* node) {
+    if (node->points.size() < (size_t)node->capacity) return false;
+    return node->divided || (node->x_max - node->x_min > MIN_CELL_SIZE && node->y_max - node->y_min > MIN_CELL_SIZE);
+}
+
+
 void subdivide(QuadNode* node) {
     double midX = (node->x_min + node->x_max) / 2;
     double midY = (node->y_min + node->y_max) / 2;
@@ -38,13 +44,26 @@ void subdivide(QuadNode* node) {
 
 
 
-QuadNode* insert(QuadNode* node, vector<double> point) {
+void updateMask(QuadNode* node) {
+    node->mask = 0;
+    for (uint32_t a : node->pointAttrs) node->mask |= a;
+    if (node->divided) {
+        node->mask |= node->nw->mask | node->ne->mask | node->sw->mask | node->se->mask;
+    }
+}
+
+
+QuadNode* insert(QuadNode* node, vector<double> point, uint32_t attrs) {
     if (point.size() < 2 || !contains(node, point)) {
         return node; 
     }
 
-    if (node->points.size() < node->capacity) {
+    node->count++;
+    node->mask |= attrs;
+
+    if (!isFull(node)) {
         node->points.push_back(point); 
+        node->pointAttrs.push_back(attrs);
         return node;
     }
 
@@ -58,13 +77,13 @@ QuadNode* insert(QuadNode* node, vector<double> point) {
     double midY = (node->y_min + node->y_max) / 2;
 
     if (point[0] <= midX && point[1] <= midY)
-        node->nw = insert(node->nw, point);
+        node->nw = insert(node->nw, point, attrs);
     else if (point[0] > midX && point[1] <= midY)
-        node->ne = insert(node->ne, point);
+        node->ne = insert(node->ne, point, attrs);
     else if (point[0] <= midX && point[1] > midY)
-        node->sw = insert(node->sw, point);
+        node->sw = insert(node->sw, point, attrs);
     else
-        node->se = insert(node->se, point);
+        node->se = insert(node->se, point, attrs);
 
     return node;
 }
@@ -82,63 +101,131 @@ void deleteTree(QuadNode* node) {
 }
 
 
-QuadNode* removeNode(QuadNode* root, vector<double>& point_rmv) {
-    if (!root || point_rmv.size() < 2) return nullptr;
+// Stops at the first match: a point on a cell edge lies inside two
+// children, and only one copy of it may go.
+static bool removeOne(QuadNode* node, const vector<double>& point_rmv, const uint32_t* attrs) {
+    if (!node || !contains(node, point_rmv)) return false;
 
+    auto attr = node->pointAttrs.begin();
+    for (auto it = node->points.begin(); it != node->points.end(); ++it, ++attr) {
+        if (samePoint(*it, point_rmv) && (attrs == nullptr || *attr == *attrs)) {
+            node->points.erase(it);
+            node->pointAttrs.erase(attr);
+            node->count--;
+            updateMask(node);
+            return true;
+        }
+    }
 
-    if (!contains(root, point_rmv)) {
-        return root;
+    if (node->divided) {
+        for (QuadNode* child : { node->nw, node->ne, node->sw, node->se }) {
+            if (removeOne(child, point_rmv, attrs)) {
+                node->count--;
+                updateMask(node);
+                return true;
+            }
+        }
     }
+    return false;
+}
+
+
+QuadNode* removeNode(QuadNode* root, vector<double>& point_rmv, const uint32_t* attrs) {
+    if (!root || point_rmv.size() < 2) return nullptr;
+    removeOne(root, point_rmv, attrs);
+    return root;
+}
 
-    for (auto it = root->points.begin(); it != root->points.end(); ++it) {
-        if (samePoint(*it, point_rmv)) {
-            root->points.erase(it);
-            return root; 
+
+vector<double> firstPoint(QuadNode* node) {
+    if (!node || node->count == 0) return vector<double>();
+    if (!node->points.empty()) return node->points.front();
+    if (node->divided) {
+        for (QuadNode* child : { node->nw, node->ne, node->sw, node->se }) {
+            if (child->count > 0) return firstPoint(child);
         }
     }
+    return vector<double>();
+}
+
 
-    if (root->divided) {
-        root->nw = removeNode(root->nw, point_rmv);
-        root->ne = removeNode(root->ne, point_rmv);
-        root->sw = removeNode(root->sw, point_rmv);
-        root->se = removeNode(root->se, point_rmv);
+void collectCells(QuadNode* node, double cellSize, vector<QuadCell>& cells) {
+    if (!node || node->count == 0) return;
+
+    bool small = (node->x_max - node->x_min) <= cellSize && (node->y_max - node->y_min) <= cellSize;
+    if (small && node->count > 1) {
+        cells.push_back({ node->x_min, node->x_max, node->y_min, node->y_max, node->count, firstPoint(node) });
+        return;
     }
 
-    return root;
+    for (auto& p : node->points) {
+        cells.push_back({ p[0], p[0], p[1], p[1], 1, p });
+    }
+    if (node->divided) {
+        collectCells(node->nw, cellSize, cells);
+        collectCells(node->ne, cellSize, cells);
+        collectCells(node->sw, cellSize, cells);
+        collectCells(node->se, cellSize, cells);
+    }
 }
 
-void nearestPoint(QuadNode* node, vector<double>& target, vector<double>& best, double& bestDist) {
+template <class Metric>
+void nearestPoint(QuadNode* node, vector<double>& target, vector<double>& best, double& bestDist, const Metric& metric, double scale,
+                  uint32_t mask, QueryStats* stats, int depth) {
     if (!node) return;
+    if ((node->mask & mask) != mask) {
+        QUERY_STAT(stats, stats->prunedSubtrees++);
+        QUERY_TRACE(stats, node, TRACE_PRUNED);
+        return;
+    }
 
-    double dx = max({0.0, node->x_min - target[0], target[0] - node->x_max});
-    double dy = max({0.0, node->y_min - target[1], target[1] - node->y_max});
+    double gap[2] = {
+        max({0.0, node->x_min - target[0], target[0] - node->x_max}),
+        max({0.0, node->y_min - target[1], target[1] - node->y_max})
+    };
+    double origin[2] = { 0.0, 0.0 };
     
 
-    double regionDist = dx * dx + dy * dy;
+    double regionDist = MetricDistance<2>::eval<double>(metric, gap, origin);
 
 
-    if (regionDist > bestDist) {
+    if (regionDist * scale > bestDist) {
+        QUERY_STAT(stats, stats->prunedSubtrees++);
+        QUERY_TRACE(stats, node, TRACE_PRUNED);
         return; 
     }
+    QUERY_TRACE(stats, node, TRACE_VISITED);
+    QUERY_STAT(stats, {
+        stats->nodesVisited++;
+        if (!node->divided) stats->leavesScanned++;
+        if (regionDist > 0) stats->backtracks++;
+        stats->maxDepth = max(stats->maxDepth, depth);
+    });
 
 
+    auto attr = node->pointAttrs.begin();
     for (auto& p : node->points) {
-        double d = distSq(p, target);
+        uint32_t attrs = *attr++;
+        if (p.size() < 2 || (attrs & mask) != mask) continue;
+        QUERY_STAT(stats, stats->distanceEvals++);
+        double d = MetricDistance<2>::eval<double>(metric, p, target);
         if (d < bestDist) {
             bestDist = d;
             best = p;
         }
     }
     if (node->divided) {
-        nearestPoint(node->nw, target, best, bestDist);
-        nearestPoint(node->ne, target, best, bestDist);
-        nearestPoint(node->sw, target, best, bestDist);
-        nearestPoint(node->se, target, best, bestDist);
+        nearestPoint(node->nw, target, best, bestDist, metric, scale, mask, stats, depth + 1);
+        nearestPoint(node->ne, target, best, bestDist, metric, scale, mask, stats, depth + 1);
+        nearestPoint(node->sw, target, best, bestDist, metric, scale, mask, stats, depth + 1);
+        nearestPoint(node->se, target, best, bestDist, metric, scale, mask, stats, depth + 1);
     }
 }
 
 
-vector<double> findNearest(QuadNode* root, vector<double>& target_point, double& bestDist) {
+template <class Metric>
+vector<double> findNearest(QuadNode* root, vector<double>& target_point, double& bestDist, const Metric& metric, double eps,
+                           uint32_t mask, QueryStats* stats) {
     vector<double> nearest_point;
     bestDist = numeric_limits<double>::max();
     
@@ -147,7 +234,192 @@ vector<double> findNearest(QuadNode* root, vector<double>& target_point, double&
     }
 
     
-    nearestPoint(root, target_point, nearest_point, bestDist);
+    QUERY_STAT(stats, stats->queries++);
+    nearestPoint(root, target_point, nearest_point, bestDist, metric, metric.approxScale(max(eps, 0.0)), mask, stats, 0);
     
     return nearest_point;
-}
\ No newline at end of file
+}
+
+
+template vector<double> findNearest<L2Metric>(QuadNode*, vector<double>&, double&, const L2Metric&, double, uint32_t, QueryStats*);
+template vector<double> findNearest<L1Metric>(QuadNode*, vector<double>&, double&, const L1Metric&, double, uint32_t, QueryStats*);
+template vector<double> findNearest<ChebyshevMetric>(QuadNode*, vector<double>&, double&, const ChebyshevMetric&, double, uint32_t,
+                                                      QueryStats*);
+template vector<double> findNearest<WeightedL2Metric<2>>(QuadNode*, vector<double>&, double&, const WeightedL2Metric<2>&, double,
+                                                         uint32_t, QueryStats*);
+
+
+static double boxDistSq(QuadNode* node, const vector<double>& target) {
+    double dx = max({0.0, node->x_min - target[0], target[0] - node->x_max});
+    double dy = max({0.0, node->y_min - target[1], target[1] - node->y_max});
+    return dx * dx + dy * dy;
+}
+
+
+vector<double> findNearestBBF(QuadNode* root, vector<double>& target_point, int maxVisits, double& bestDist, bool& exact) {
+    typedef pair<double, QuadNode*> Bin;
+
+    vector<double> nearest_point;
+    bestDist = numeric_limits<double>::max();
+    exact = true;
+    if (root == nullptr || target_point.size() < 2) {
+        return nearest_point;
+    }
+
+    priority_queue<Bin, vector<Bin>, greater<Bin>> bins;
+    bins.push({ boxDistSq(root, target_point), root });
+    int visits = 0;
+
+    while (!bins.empty()) {
+        Bin bin = bins.top();
+        bins.pop();
+        if (!(bin.first < bestDist)) break;
+
+        if (visits == maxVisits) {
+            exact = false;
+            break;
+        }
+        visits++;
+
+        QuadNode* node = bin.second;
+        for (auto& p : node->points) {
+            double d = distSq(p, target_point);
+            if (d < bestDist) {
+                bestDist = d;
+                nearest_point = p;
+            }
+        }
+        if (node->divided) {
+            for (QuadNode* child : { node->nw, node->ne, node->sw, node->se }) {
+                if (child->count == 0) continue;
+                double bound = boxDistSq(child, target_point);
+                if (bound < bestDist) bins.push({ bound, child });
+            }
+        }
+    }
+
+    return nearest_point;
+}
+
+
+QuadNearestIterator::QuadNearestIterator(QuadNode* root, const vector<double>& target_point) : target(target_point) {
+    if (root != nullptr && root->count > 0 && target.size() >= 2) {
+        queue.push(Entry{ boxDistSq(root, target), root, nullptr });
+    }
+}
+
+
+bool QuadNearestIterator::next(vector<double>& point, double& dist) {
+    while (!queue.empty()) {
+        Entry entry = queue.top();
+        queue.pop();
+        if (entry.point != nullptr) {
+            point = *entry.point;
+            dist = entry.key;
+            return true;
+        }
+
+        QuadNode* node = entry.node;
+        for (auto& p : node->points) {
+            queue.push(Entry{ distSq(p, target), nullptr, &p });
+        }
+        if (node->divided) {
+            for (QuadNode* child : { node->nw, node->ne, node->sw, node->se }) {
+                if (child->count > 0) queue.push(Entry{ boxDistSq(child, target), child, nullptr });
+            }
+        }
+    }
+    return false;
+}
+
+
+vector<double> findNearest(QuadNode* root, vector<double>& target_point, double& bestDist, double eps, uint32_t mask,
+                           QueryStats* stats) {
+    return findNearest(root, target_point, bestDist, L2Metric(), eps, mask, stats);
+}
+
+
+QuadNode* insertCopyOnWrite(QuadNode* node, const vector<double>& point, vector<QuadNode*>& replaced, uint32_t attrs) {
+    if (point.size() < 2 || !contains(node, point)) {
+        return node;
+    }
+
+    QuadNode* copy = new QuadNode(*node);
+    replaced.push_back(node);
+    copy->count++;
+    copy->mask |= attrs;
+
+    if (!isFull(copy)) {
+        copy->points.push_back(point);
+        copy->pointAttrs.push_back(attrs);
+        return copy;
+    }
+
+    if (!copy->divided) {
+        subdivide(copy);
+    }
+
+    double midX = (copy->x_min + copy->x_max) / 2;
+    double midY = (copy->y_min + copy->y_max) / 2;
+
+    if (point[0] <= midX && point[1] <= midY)
+        copy->nw = insertCopyOnWrite(copy->nw, point, replaced, attrs);
+    else if (point[0] > midX && point[1] <= midY)
+        copy->ne = insertCopyOnWrite(copy->ne, point, replaced, attrs);
+    else if (point[0] <= midX && point[1] > midY)
+        copy->sw = insertCopyOnWrite(copy->sw, point, replaced, attrs);
+    else
+        copy->se = insertCopyOnWrite(copy->se, point, replaced, attrs);
+
+    return copy;
+}
+
+
+QuadNode* removeCopyOnWrite(QuadNode* root, const vector<double>& point_rmv, vector<QuadNode*>& replaced,
+                            const uint32_t* attrs) {
+    if (!root || point_rmv.size() < 2 || !contains(root, point_rmv)) {
+        return root;
+    }
+
+    auto attr = root->pointAttrs.begin();
+    for (auto it = root->points.begin(); it != root->points.end(); ++it, ++attr) {
+        if (samePoint(*it, point_rmv) && (attrs == nullptr || *attr == *attrs)) {
+            QuadNode* copy = new QuadNode(*root);
+            replaced.push_back(root);
+            auto index = distance(root->points.begin(), it);
+            auto pos = copy->points.begin();
+            advance(pos, index);
+            copy->points.erase(pos);
+            auto copyAttr = copy->pointAttrs.begin();
+            advance(copyAttr, index);
+            copy->pointAttrs.erase(copyAttr);
+            copy->count--;
+            updateMask(copy);
+            return copy;
+        }
+    }
+
+    if (!root->divided) {
+        return root;
+    }
+
+    // Stops at the first quadrant that removes a copy, as removeOne does: a
+    // point on a split line lies inside two of them.
+    QuadNode* children[4] = { root->nw, root->ne, root->sw, root->se };
+    for (int q = 0; q < 4; ++q) {
+        QuadNode* updated = removeCopyOnWrite(children[q], point_rmv, replaced, attrs);
+        if (updated == children[q]) continue;
+
+        children[q] = updated;
+        QuadNode* copy = new QuadNode(*root);
+        replaced.push_back(root);
+        copy->nw = children[0];
+        copy->ne = children[1];
+        copy->sw = children[2];
+        copy->se = children[3];
+        copy->count--;
+        updateMask(copy);
+        return copy;
+    }
+    return root;
+}
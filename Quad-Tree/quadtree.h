@@ -5,7 +5,13 @@
 #include <list> 
 #include <limits>
 #include <cmath>
+#include <cstdint>
 #include <algorithm> 
+#include <queue>
+#include <functional>
+
+#include "../Distance/metric.h"
+#include "../Instrumentation/query_stats.h"
 
 using namespace std;
 
@@ -18,10 +24,18 @@ struct QuadNode {
     
   
     list<vector<double>> points; 
+
+    // Attribute word of each entry in points, in the same order, and the OR
+    // of every attribute word in the subtree.
+    list<uint32_t> pointAttrs;
+    uint32_t mask;
     
     
     bool divided;
 
+    
+    int count;
+
     QuadNode* nw;
     QuadNode* ne;
     QuadNode* sw;
@@ -30,15 +44,87 @@ struct QuadNode {
 };
 
 
-QuadNode* insert(QuadNode* root, vector<double> point);
+// Cells no wider or taller than this are never split: they keep every point
+// that reaches them, past capacity. Many copies of one location would
+// otherwise subdivide until the recursion ran out; this way a tree whose
+// root's shorter side is s is at most ceil(log2(s / MIN_CELL_SIZE)) + 1
+// levels deep.
+const double MIN_CELL_SIZE = 1e-6;
+
+
+QuadNode* insert(QuadNode* root, vector<double> point, uint32_t attrs = 0);
 
 
 void deleteTree(QuadNode* root);
 
 
-QuadNode* removeNode(QuadNode* root, vector<double>& point_rmv);
+// Removes one point at point_rmv; with attrs set, only one carrying exactly
+// that attribute word.
+QuadNode* removeNode(QuadNode* root, vector<double>& point_rmv, const uint32_t* attrs = nullptr);
+
+
+// One aggregated rendering cell: either a whole subtree no larger than the
+// requested cell size, or a single point stored above that resolution.
+struct QuadCell {
+    double x_min, x_max, y_min, y_max;
+    int count;
+    vector<double> representative;
+};
+
+
+void collectCells(QuadNode* root, double cellSize, vector<QuadCell>& cells);
+
+
+// With eps > 0 the result is within (1 + eps) of the true nearest distance;
+// negative eps counts as 0. Only points whose attribute word contains every
+// bit of mask are considered. When stats is given, the search's counters are
+// added to it.
+vector<double> findNearest(QuadNode* root, vector<double>& target_point, double& bestDist, double eps = 0.0, uint32_t mask = 0,
+                           QueryStats* stats = nullptr);
+
+
+// Nearest point under a distance policy from Distance/metric.h; bestDist is in
+// the metric's units. Instantiated in quadtree.cpp for L2Metric, L1Metric,
+// ChebyshevMetric and WeightedL2Metric<2>.
+template <class Metric>
+vector<double> findNearest(QuadNode* root, vector<double>& target_point, double& bestDist, const Metric& metric, double eps = 0.0,
+                           uint32_t mask = 0, QueryStats* stats = nullptr);
+
+
+// Best-bin-first search: quadrants are explored closest-box first and at most
+// maxVisits nodes are examined. exact is true when the search ended because
+// no remaining quadrant could improve the result.
+vector<double> findNearestBBF(QuadNode* root, vector<double>& target_point, int maxVisits, double& bestDist, bool& exact);
+
+
+// Distance browsing over the quadtree: see KDNearestIterator. Distances are
+// squared Euclidean; the tree must not change while an iterator is in use.
+struct QuadNearestIterator {
+    struct Entry {
+        double key;
+        QuadNode* node;
+        const vector<double>* point; // set for point entries
+        bool operator>(const Entry& other) const { return key > other.key; }
+    };
+
+    vector<double> target;
+    priority_queue<Entry, vector<Entry>, greater<Entry>> queue;
+
+    QuadNearestIterator(QuadNode* root, const vector<double>& target_point);
+
+    // Returns false once every point has been yielded.
+    bool next(vector<double>& point, double& dist);
+};
+
+
+// Copy-on-write variants: see the KD-tree versions. Nodes that are copied are
+// appended to `replaced`; untouched quadrants are shared with the old tree.
+QuadNode* insertCopyOnWrite(QuadNode* root, const vector<double>& point, vector<QuadNode*>& replaced, uint32_t attrs = 0);
 
 
-vector<double> findNearest(QuadNode* root, vector<double>& target_point, double& bestDist);
+// Removes one copy of point_rmv; with attrs set, only one carrying exactly
+// that attribute word, as removeNode does.
+QuadNode* removeCopyOnWrite(QuadNode* root, const vector<double>& point_rmv, vector<QuadNode*>& replaced,
+                            const uint32_t* attrs = nullptr);
 
 #endif 
\ No newline at end of file
@@ -0,0 +1,258 @@
+#include "reverse_nn.h"
+
+typedef KDTree2D::Point Point;
+
+static const double NO_FACILITY = numeric_limits<double>::max();
+
+// Axis-aligned region covered by a client subtree.
+struct Region {
+    double lo[2], hi[2];
+};
+
+
+static Point toPoint(const vector<double>& p) {
+    return Point{ p[0], p[1] };
+}
+
+
+static double distSq(const Point& a, const Point& b) {
+    double dx = a[0] - b[0];
+    double dy = a[1] - b[1];
+    return dx * dx + dy * dy;
+}
+
+
+static double regionDistSq(const Region& r, const Point& q) {
+    double dx = max({ 0.0, r.lo[0] - q[0], q[0] - r.hi[0] });
+    double dy = max({ 0.0, r.lo[1] - q[1], q[1] - r.hi[1] });
+    return dx * dx + dy * dy;
+}
+
+
+static Region everything() {
+    double inf = numeric_limits<double>::infinity();
+    return Region{ { -inf, -inf }, { inf, inf } };
+}
+
+
+// Squared distance from p to its nearest facility. In a monochromatic index
+// the first result is p itself (or a duplicate of it), so the second is used.
+static double nearestFacility(const RNNIndex* index, const Point& p) {
+    if (!index->monochromatic) {
+        double d;
+        return KDTree2D::findNearest(index->facilities, p, d) ? d : NO_FACILITY;
+    }
+    KDNearestIterator<double, 2> it(index->facilities, p);
+    KDNode* node;
+    double d;
+    if (!it.next(node, d) || !it.next(node, d)) return NO_FACILITY;
+    return d;
+}
+
+
+static void updateMaxRadius(RNNNode* node) {
+    node->maxRadius = node->radius;
+    if (node->left) node->maxRadius = max(node->maxRadius, node->left->maxRadius);
+    if (node->right) node->maxRadius = max(node->maxRadius, node->right->maxRadius);
+}
+
+
+static RNNNode* clientInsert(RNNNode* root, const Point& point, double radius, int depth) {
+    if (root == nullptr) {
+        return new RNNNode{ point, radius, radius, nullptr, nullptr };
+    }
+    int axis = depth % 2;
+
+    root->maxRadius = max(root->maxRadius, radius);
+    if (point[axis] < root->point[axis]) {
+        root->left = clientInsert(root->left, point, radius, depth + 1);
+    } else {
+        root->right = clientInsert(root->right, point, radius, depth + 1);
+    }
+    return root;
+}
+
+
+static RNNNode* clientFindMin(RNNNode* root, int axis, int depth) {
+    if (root == nullptr) return nullptr;
+
+    if (depth % 2 == axis) {
+        return root->left ? clientFindMin(root->left, axis, depth + 1) : root;
+    }
+
+    RNNNode* minNode = root;
+    for (RNNNode* child : { clientFindMin(root->left, axis, depth + 1), clientFindMin(root->right, axis, depth + 1) }) {
+        if (child != nullptr && child->point[axis] < minNode->point[axis]) minNode = child;
+    }
+    return minNode;
+}
+
+
+static RNNNode* clientRemove(RNNNode* root, const Point& point_rmv, int depth) {
+    if (root == nullptr) return nullptr;
+
+    int axis = depth % 2;
+
+    if (root->point == point_rmv) {
+        if (root->right == nullptr && root->left == nullptr) {
+            delete root;
+            return nullptr;
+        }
+        if (root->right == nullptr) {
+            root->right = root->left;
+            root->left = nullptr;
+        }
+        RNNNode* minNode = clientFindMin(root->right, axis, depth + 1);
+        root->point = minNode->point;
+        root->radius = minNode->radius;
+        root->right = clientRemove(root->right, root->point, depth + 1);
+        updateMaxRadius(root);
+        return root;
+    }
+
+    if (point_rmv[axis] < root->point[axis]) {
+        root->left = clientRemove(root->left, point_rmv, depth + 1);
+    } else {
+        root->right = clientRemove(root->right, point_rmv, depth + 1);
+    }
+    updateMaxRadius(root);
+    return root;
+}
+
+
+static void deleteClients(RNNNode* root) {
+    if (!root) return;
+    deleteClients(root->left);
+    deleteClients(root->right);
+    delete root;
+}
+
+
+// Revisits the clients a facility change at f can affect: after an insert,
+// those strictly closer to f than their radius shrink to d(c, f); after a
+// removal, those for which f may have been the nearest are recomputed.
+static void refreshClients(const RNNIndex* index, RNNNode* node, Region region, int depth, const Point& f, bool inserted) {
+    if (node == nullptr) return;
+
+    double bound = regionDistSq(region, f);
+    if (inserted ? bound >= node->maxRadius : bound > node->maxRadius) return;
+
+    double d = distSq(node->point, f);
+    if (inserted && d < node->radius) {
+        node->radius = d;
+    } else if (!inserted && d <= node->radius) {
+        node->radius = nearestFacility(index, node->point);
+    }
+
+    int axis = depth % 2;
+    Region lower = region, upper = region;
+    lower.hi[axis] = node->point[axis];
+    upper.lo[axis] = node->point[axis];
+    refreshClients(index, node->left, lower, depth + 1, f, inserted);
+    refreshClients(index, node->right, upper, depth + 1, f, inserted);
+    updateMaxRadius(node);
+}
+
+
+static void collectReverse(const RNNIndex* index, const RNNNode* node, Region region, int depth, const Point& q,
+                           vector<vector<double>>& result) {
+    if (node == nullptr || regionDistSq(region, q) > node->maxRadius) return;
+
+    double d = distSq(node->point, q);
+    if (d <= node->radius && !(index->monochromatic && d == 0)) {
+        result.push_back({ node->point[0], node->point[1] });
+    }
+
+    int axis = depth % 2;
+    Region lower = region, upper = region;
+    lower.hi[axis] = node->point[axis];
+    upper.lo[axis] = node->point[axis];
+    collectReverse(index, node->left, lower, depth + 1, q, result);
+    collectReverse(index, node->right, upper, depth + 1, q, result);
+}
+
+
+RNNIndex* buildBichromaticRNN(const vector<vector<double>>& clients, const vector<vector<double>>& facilities) {
+    RNNIndex* index = new RNNIndex();
+    for (const auto& f : facilities) {
+        index->facilities = insert(index->facilities, f);
+    }
+    for (const auto& c : clients) {
+        insertClient(index, c);
+    }
+    return index;
+}
+
+
+RNNIndex* buildMonochromaticRNN(const vector<vector<double>>& points) {
+    RNNIndex* index = new RNNIndex();
+    index->monochromatic = true;
+    for (const auto& p : points) {
+        index->facilities = insert(index->facilities, p);
+    }
+    for (const auto& p : points) {
+        Point point = toPoint(p);
+        index->clients = clientInsert(index->clients, point, nearestFacility(index, point), 0);
+    }
+    return index;
+}
+
+
+void deleteTree(RNNIndex* index) {
+    if (!index) return;
+    deleteClients(index->clients);
+    deleteTree(index->facilities);
+    delete index;
+}
+
+
+void insertFacility(RNNIndex* index, const vector<double>& facility) {
+    if (facility.size() < 2) return;
+    Point f = toPoint(facility);
+
+    index->facilities = insert(index->facilities, facility);
+    refreshClients(index, index->clients, everything(), 0, f, true);
+    if (index->monochromatic) {
+        index->clients = clientInsert(index->clients, f, nearestFacility(index, f), 0);
+    }
+}
+
+
+void removeFacility(RNNIndex* index, const vector<double>& facility) {
+    if (facility.size() < 2) return;
+    Point f = toPoint(facility);
+
+    vector<double> point_rmv = facility;
+    index->facilities = removeNode(index->facilities, point_rmv);
+    if (index->monochromatic) {
+        index->clients = clientRemove(index->clients, f, 0);
+    }
+    refreshClients(index, index->clients, everything(), 0, f, false);
+}
+
+
+void insertClient(RNNIndex* index, const vector<double>& client) {
+    if (client.size() < 2) return;
+    if (index->monochromatic) {
+        insertFacility(index, client);
+        return;
+    }
+    Point c = toPoint(client);
+    index->clients = clientInsert(index->clients, c, nearestFacility(index, c), 0);
+}
+
+
+void removeClient(RNNIndex* index, const vector<double>& client) {
+    if (client.size() < 2) return;
+    if (index->monochromatic) {
+        removeFacility(index, client);
+        return;
+    }
+    index->clients = clientRemove(index->clients, toPoint(client), 0);
+}
+
+
+void reverseNearest(RNNIndex* index, vector<double>& q, vector<vector<double>>& result) {
+    if (!index || q.size() < 2) return;
+    collectReverse(index, index->clients, everything(), 0, toPoint(q), result);
+}
@@ -0,0 +1,65 @@
+#ifndef REVERSE_NN_H
+#define REVERSE_NN_H
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#include "../KD-Tree/kd_tree.h"
+
+using namespace std;
+
+// Reverse nearest neighbours: the clients that have q as their nearest
+// facility. Bichromatic indexes keep clients and facilities apart;
+// monochromatic ones use one point set in both roles, and a point's
+// nearest facility is its nearest other point.
+//
+// Each client stores the squared distance to its nearest facility, and
+// every node the largest such radius below it. A client belongs to RNN(q)
+// when q is no farther than its radius, so a subtree whose region is
+// farther from q than its largest radius is skipped. Inserting or removing
+// a facility only revisits the clients it can affect, found with the same
+// pruning.
+struct RNNNode {
+    KDTree2D::Point point;
+    double radius;
+    double maxRadius;
+    RNNNode* left;
+    RNNNode* right;
+};
+
+struct RNNIndex {
+    bool monochromatic = false;
+    KDNode* facilities = nullptr; // the points themselves when monochromatic
+    RNNNode* clients = nullptr;
+};
+
+
+RNNIndex* buildBichromaticRNN(const vector<vector<double>>& clients, const vector<vector<double>>& facilities);
+
+
+RNNIndex* buildMonochromaticRNN(const vector<vector<double>>& points);
+
+
+void deleteTree(RNNIndex* index);
+
+
+// In a monochromatic index facilities and clients are the same points, so
+// these four all add or remove a point.
+void insertFacility(RNNIndex* index, const vector<double>& facility);
+
+
+void removeFacility(RNNIndex* index, const vector<double>& facility);
+
+
+void insertClient(RNNIndex* index, const vector<double>& client);
+
+
+void removeClient(RNNIndex* index, const vector<double>& client);
+
+
+// Clients whose nearest facility is no closer than q. In a monochromatic
+// index, points located at q itself are left out.
+void reverseNearest(RNNIndex* index, vector<double>& q, vector<vector<double>>& result);
+
+#endif
@@ -0,0 +1,69 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool mapFile(const string& path, MappedFile& file, string& error, bool sequential) {
+    file = MappedFile();
+
+#ifdef _WIN32
+    DWORD flags = sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_ATTRIBUTE_NORMAL;
+    HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+                                flags, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        error = "cannot open " + path;
+        return false;
+    }
+    LARGE_INTEGER size;
+    GetFileSizeEx(handle, &size);
+    file.file = handle;
+    file.size = (uint64_t)size.QuadPart;
+    if (file.size > 0) {
+        HANDLE mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        file.mapping = mapping;
+        if (mapping) file.data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error = "cannot open " + path;
+        return false;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    file.size = (uint64_t)st.st_size;
+    if (file.size > 0) {
+        void* base = mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base != MAP_FAILED) {
+            file.data = (const uint8_t*)base;
+            if (sequential) madvise(base, file.size, MADV_SEQUENTIAL);
+        }
+    }
+    close(fd);
+#endif
+
+    if (file.size > 0 && !file.data) {
+        error = "cannot map " + path;
+        unmapFile(file);
+        return false;
+    }
+    return true;
+}
+
+
+void unmapFile(MappedFile& file) {
+#ifdef _WIN32
+    if (file.data) UnmapViewOfFile(file.data);
+    if (file.mapping) CloseHandle((HANDLE)file.mapping);
+    if (file.file) CloseHandle((HANDLE)file.file);
+#else
+    if (file.data) munmap((void*)file.data, file.size);
+#endif
+    file = MappedFile();
+}
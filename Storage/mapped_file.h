@@ -0,0 +1,26 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+// A read-only memory mapping of a whole file. An empty file maps to
+// data == nullptr with size 0.
+struct MappedFile {
+    const uint8_t* data = nullptr;
+    uint64_t size = 0;
+    void* file = nullptr;    // platform handles
+    void* mapping = nullptr;
+};
+
+
+// Returns false and sets error when the file cannot be opened or mapped.
+// With sequential the kernel is told the mapping will be read front to back.
+bool mapFile(const string& path, MappedFile& file, string& error, bool sequential = false);
+
+
+void unmapFile(MappedFile& file);
+
+#endif
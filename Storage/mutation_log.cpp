@@ -0,0 +1,350 @@
+#include "mutation_log.h"
+#include "snapshot.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+static bool syncFile(int fd) {
+#ifdef _WIN32
+    return _commit(fd) == 0;
+#elif defined(__linux__)
+    return fdatasync(fd) == 0;
+#else
+    return fsync(fd) == 0;
+#endif
+}
+
+
+static bool truncateFile(int fd, uint64_t size) {
+#ifdef _WIN32
+    return _chsize_s(fd, (__int64)size) == 0;
+#else
+    return ftruncate(fd, (off_t)size) == 0;
+#endif
+}
+
+
+// Offsets go through 64-bit seeks: long is 32 bits on Windows.
+static bool seekTo(int fd, uint64_t offset) {
+#ifdef _WIN32
+    return _lseeki64(fd, (__int64)offset, SEEK_SET) == (__int64)offset;
+#else
+    return lseek(fd, (off_t)offset, SEEK_SET) == (off_t)offset;
+#endif
+}
+
+
+static bool replaceFile(const string& from, const string& to) {
+#ifdef _WIN32
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+
+static bool readAll(int fd, uint8_t* data, size_t size) {
+    while (size > 0) {
+        int n = (int)read(fd, data, (unsigned)min(size, (size_t)1 << 30));
+        if (n <= 0) return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+
+static bool writeAll(int fd, const uint8_t* data, size_t size) {
+    while (size > 0) {
+        int n = (int)write(fd, data, (unsigned)min(size, (size_t)1 << 30));
+        if (n <= 0) return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+
+static uint64_t recordChecksum(LogRecord record, const char* name) {
+    record.checksum = 0;
+    vector<uint8_t> bytes(sizeof(record) + record.nameLength);
+    memcpy(bytes.data(), &record, sizeof(record));
+    memcpy(bytes.data() + sizeof(record), name, record.nameLength);
+    return snapshotChecksum(bytes.data(), bytes.size());
+}
+
+
+static LogHeader makeHeader(uint64_t baseChecksum) {
+    LogHeader header;
+    memcpy(header.magic, LOG_MAGIC, sizeof(header.magic));
+    header.version = LOG_VERSION;
+    header.reserved = 0;
+    header.baseChecksum = baseChecksum;
+    return header;
+}
+
+
+static bool writeHeader(MutationLog* log, uint64_t baseChecksum) {
+    LogHeader header = makeHeader(baseChecksum);
+    bool ok = truncateFile(log->fd, 0) && seekTo(log->fd, 0) &&
+              writeAll(log->fd, (const uint8_t*)&header, sizeof(header)) && syncFile(log->fd);
+    log->bytes = sizeof(header);
+    return ok;
+}
+
+
+// Reads the records of an existing log and returns the length of its intact
+// prefix, or 0 when the log is missing, damaged or extends another snapshot.
+static uint64_t readLog(int fd, uint64_t baseChecksum, vector<LogEntry>& replay) {
+    vector<uint8_t> data;
+    uint8_t buffer[1 << 16];
+    int n;
+    while ((n = (int)read(fd, buffer, sizeof(buffer))) > 0) {
+        data.insert(data.end(), buffer, buffer + n);
+    }
+
+    LogHeader header;
+    if (data.size() < sizeof(header)) return 0;
+    memcpy(&header, data.data(), sizeof(header));
+    if (memcmp(header.magic, LOG_MAGIC, sizeof(header.magic)) != 0 || header.version != LOG_VERSION ||
+        header.baseChecksum != baseChecksum) {
+        return 0;
+    }
+
+    uint64_t offset = sizeof(header);
+    while (offset + sizeof(LogRecord) <= data.size()) {
+        LogRecord record;
+        memcpy(&record, data.data() + offset, sizeof(record));
+        if (offset + sizeof(record) + record.nameLength > data.size()) break;
+        const char* name = (const char*)data.data() + offset + sizeof(record);
+        if (record.checksum != recordChecksum(record, name)) break;
+
+        replay.push_back(LogEntry{ (LogOp)record.op, record.category, record.x, record.y, record.attrs, record.index,
+                                   string(name, record.nameLength) });
+        offset += sizeof(record) + record.nameLength;
+    }
+    return offset;
+}
+
+
+static void writerLoop(MutationLog* log) {
+    unique_lock<mutex> lock(log->lock);
+    for (;;) {
+        log->wake.wait(lock, [log] { return log->stopping || !log->pending.empty(); });
+        if (log->pending.empty()) return;
+
+        // Group commit: give other appends a short window to join this batch.
+        if (!log->stopping && log->groupWindowUs > 0) {
+            log->wake.wait_for(lock, chrono::microseconds(log->groupWindowUs), [log] { return log->stopping; });
+        }
+
+        vector<uint8_t> batch;
+        batch.swap(log->pending);
+        uint64_t sequence = log->appended;
+        log->writing = true;
+        lock.unlock();
+
+        bool ok = writeAll(log->fd, batch.data(), batch.size()) && syncFile(log->fd);
+
+        lock.lock();
+        log->writing = false;
+        if (ok) {
+            log->durable = sequence;
+        } else {
+            log->failed = true;
+        }
+        log->flushed.notify_all();
+    }
+}
+
+
+MutationLog* openMutationLog(const string& path, uint64_t baseChecksum, vector<LogEntry>& replay, string& error,
+                             unsigned groupWindowUs) {
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_BINARY, 0644);
+    if (fd < 0) {
+        error = "cannot open " + path;
+        return nullptr;
+    }
+
+    uint64_t intact = readLog(fd, baseChecksum, replay);
+    string next = path + LOG_NEXT_SUFFIX;
+    if (intact == 0) {
+        // A compaction that stopped after publishing its snapshot, but before
+        // renaming the rebased log into place, left that log at next.
+        int nextFd = open(next.c_str(), O_RDONLY | O_BINARY);
+        if (nextFd >= 0) {
+            intact = readLog(nextFd, baseChecksum, replay);
+            close(nextFd);
+            if (intact > 0) {
+                close(fd);
+                fd = replaceFile(next, path) ? open(path.c_str(), O_RDWR | O_BINARY) : -1;
+                if (fd < 0) {
+                    error = "cannot replace " + path;
+                    replay.clear();
+                    return nullptr;
+                }
+            }
+        }
+    }
+    remove(next.c_str());
+
+    MutationLog* log = new MutationLog();
+    log->path = path;
+    log->fd = fd;
+    log->groupWindowUs = groupWindowUs;
+
+    bool ok;
+    if (intact == 0) {
+        ok = writeHeader(log, baseChecksum);
+    } else {
+        ok = truncateFile(fd, intact) && seekTo(fd, intact) && syncFile(fd);
+        log->bytes = intact;
+    }
+    if (!ok) {
+        error = "cannot write " + path;
+        close(fd);
+        delete log;
+        replay.clear();
+        return nullptr;
+    }
+
+    log->writer = thread(writerLoop, log);
+    return log;
+}
+
+
+uint64_t appendLog(MutationLog* log, const LogEntry& entry) {
+    LogRecord record;
+    memset(&record, 0, sizeof(record));
+    record.op = (uint8_t)entry.op;
+    record.nameLength = (uint8_t)min(entry.name.size(), (size_t)SNAPSHOT_NAME_LEN - 1);
+    record.category = entry.category;
+    record.x = entry.x;
+    record.y = entry.y;
+    record.attrs = entry.attrs;
+    record.index = entry.index;
+    record.checksum = recordChecksum(record, entry.name.data());
+
+    lock_guard<mutex> lock(log->lock);
+    const uint8_t* bytes = (const uint8_t*)&record;
+    log->pending.insert(log->pending.end(), bytes, bytes + sizeof(record));
+    log->pending.insert(log->pending.end(), entry.name.begin(), entry.name.begin() + record.nameLength);
+    log->bytes += sizeof(record) + record.nameLength;
+    log->wake.notify_one();
+    return ++log->appended;
+}
+
+
+bool syncLog(MutationLog* log) {
+    unique_lock<mutex> lock(log->lock);
+    uint64_t target = log->appended;
+    log->flushed.wait(lock, [log, target] { return log->durable >= target || log->failed; });
+    return !log->failed;
+}
+
+
+bool resetLog(MutationLog* log, uint64_t baseChecksum, string& error) {
+    unique_lock<mutex> lock(log->lock);
+    log->flushed.wait(lock, [log] { return !log->writing; });
+    log->pending.clear();
+    log->durable = log->appended;
+    log->failed = false;
+    if (!writeHeader(log, baseChecksum)) {
+        log->failed = true;
+        error = "cannot write " + log->path;
+        return false;
+    }
+    return true;
+}
+
+
+uint64_t logMark(MutationLog* log) {
+    return log->bytes;
+}
+
+
+bool rebaseLog(MutationLog* log, uint64_t baseChecksum, uint64_t mark, const function<bool(string&)>& publish,
+               string& error) {
+    unique_lock<mutex> lock(log->lock);
+    log->flushed.wait(lock, [log] { return !log->writing; });
+
+    // Pending records go into the current log first, so that it stays
+    // complete for the current snapshot until the new one is published.
+    if (!writeAll(log->fd, log->pending.data(), log->pending.size()) || !syncFile(log->fd)) {
+        log->failed = true;
+        error = "cannot write " + log->path;
+        return false;
+    }
+    log->pending.clear();
+    log->durable = log->appended;
+
+    uint64_t written = log->bytes;
+    vector<uint8_t> tail(written > mark ? written - mark : 0);
+    bool ok = tail.empty() || (seekTo(log->fd, mark) && readAll(log->fd, tail.data(), tail.size()));
+    seekTo(log->fd, written);
+    if (!ok) {
+        error = "cannot read " + log->path;
+        return false;
+    }
+
+    string next = log->path + LOG_NEXT_SUFFIX;
+    LogHeader header = makeHeader(baseChecksum);
+    int nextFd = open(next.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    ok = nextFd >= 0 && writeAll(nextFd, (const uint8_t*)&header, sizeof(header)) &&
+         writeAll(nextFd, tail.data(), tail.size()) && syncFile(nextFd);
+    if (nextFd >= 0) close(nextFd);
+    if (!ok) {
+        remove(next.c_str());
+        error = "cannot write " + next;
+        return false;
+    }
+    if (!publish(error)) {
+        remove(next.c_str());
+        return false;
+    }
+
+    // The current log is stale from here on; until the rename, a restart
+    // picks up next instead. Windows cannot rename over an open file.
+    close(log->fd);
+    bool renamed = replaceFile(next, log->path);
+    log->fd = open(log->path.c_str(), O_RDWR | O_BINARY);
+    if (renamed) {
+        ok = log->fd >= 0 && seekTo(log->fd, sizeof(header) + tail.size());
+    } else {
+        // next stays on disk until the rewrite is synced.
+        ok = log->fd >= 0 && writeHeader(log, baseChecksum) && writeAll(log->fd, tail.data(), tail.size()) &&
+             syncFile(log->fd);
+        if (ok) remove(next.c_str());
+    }
+    log->bytes = sizeof(header) + tail.size();
+    log->failed = !ok;
+    if (!ok) error = "cannot replace " + log->path;
+    return ok;
+}
+
+
+void closeMutationLog(MutationLog* log) {
+    if (!log) return;
+    {
+        lock_guard<mutex> lock(log->lock);
+        log->stopping = true;
+        log->wake.notify_all();
+    }
+    log->writer.join();
+    close(log->fd);
+    delete log;
+}
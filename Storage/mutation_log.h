@@ -0,0 +1,125 @@
+#ifndef MUTATION_LOG_H
+#define MUTATION_LOG_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <functional>
+
+using namespace std;
+
+// Append-only log of the edits made since a snapshot. The log header records
+// the checksum of the snapshot it extends, so after compaction writes a new
+// snapshot, a log left over from a crash is recognised as stale and dropped.
+//
+// File layout: LogHeader, then records. Each record is a LogRecord followed
+// by nameLength bytes of name, and is covered by its own checksum, so a torn
+// write at the tail is detected and cut off on open.
+const char LOG_MAGIC[8] = { 'F', 'N', 'N', 'W', 'A', 'L', '\0', '\0' };
+const uint32_t LOG_VERSION = 1;
+const char LOG_NEXT_SUFFIX[] = ".next"; // rebased log waiting to replace the current one
+
+enum LogOp { LOG_INSERT = 1, LOG_REMOVE = 2, LOG_CREATE = 3, LOG_DELETE = 4 };
+
+struct LogHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t baseChecksum;
+};
+
+struct LogRecord {
+    uint8_t op;
+    uint8_t nameLength;
+    uint16_t reserved;
+    int32_t category;
+    int32_t x, y;
+    uint32_t attrs;    // point attributes; RGBA colour for LOG_CREATE
+    uint32_t index;    // point index for LOG_REMOVE
+    uint64_t checksum; // over the record with this field zeroed, then the name
+};
+
+static_assert(sizeof(LogHeader) == 24, "log layout");
+static_assert(sizeof(LogRecord) == 32, "log layout");
+
+
+// Categories are addressed by position, which replay reproduces exactly as
+// long as it starts from the same snapshot.
+struct LogEntry {
+    LogOp op;
+    int category;
+    int x, y;
+    uint32_t attrs;
+    uint32_t index;
+    string name;
+};
+
+
+// Appends are buffered and written by a background thread, which waits up to
+// groupWindowUs for more records so that one write and one fsync cover a
+// whole batch.
+struct MutationLog {
+    string path;
+    int fd = -1;
+    unsigned groupWindowUs = 2000;
+
+    mutex lock;
+    condition_variable wake;    // records pending or stopping
+    condition_variable flushed; // durable advanced or writer idle
+    vector<uint8_t> pending;
+    uint64_t appended = 0;      // records appended since open
+    uint64_t durable = 0;       // records known to be on disk
+    bool writing = false;
+    bool stopping = false;
+    bool failed = false;        // a write or sync failed; later appends are not durable
+
+    atomic<uint64_t> bytes{ 0 }; // log size including pending records
+    thread writer;
+};
+
+
+// Opens or creates the log at path. When the existing log extends the
+// snapshot with baseChecksum, its intact records are returned in replay and
+// any torn tail is truncated. Failing that, a rebased log left at path +
+// LOG_NEXT_SUFFIX by an interrupted rebaseLog is used if it extends that
+// snapshot. Otherwise the log is restarted empty.
+MutationLog* openMutationLog(const string& path, uint64_t baseChecksum, vector<LogEntry>& replay, string& error,
+                             unsigned groupWindowUs = 2000);
+
+
+// Queues one record and returns its sequence number; does not wait for disk.
+uint64_t appendLog(MutationLog* log, const LogEntry& entry);
+
+
+// Waits until every record appended so far is on disk. Returns false if a
+// write failed.
+bool syncLog(MutationLog* log);
+
+
+// Empties the log and binds it to a new snapshot. Pending records are
+// discarded, as the snapshot already contains them.
+bool resetLog(MutationLog* log, uint64_t baseChecksum, string& error);
+
+
+// Position just past the last record appended so far.
+uint64_t logMark(MutationLog* log);
+
+
+// Like resetLog for a snapshot taken when the log stood at mark and not yet
+// published: records appended after mark are not in it, so they are kept.
+// The new header and those records are synced to path + LOG_NEXT_SUFFIX,
+// then publish makes the snapshot current, then that file replaces the log.
+// A crash at any point leaves a log that matches whichever snapshot is on
+// disk. If publish fails, the current log carries on unchanged.
+bool rebaseLog(MutationLog* log, uint64_t baseChecksum, uint64_t mark, const function<bool(string&)>& publish,
+               string& error);
+
+
+// Flushes pending records and closes the file.
+void closeMutationLog(MutationLog* log);
+
+#endif
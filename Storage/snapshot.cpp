@@ -0,0 +1,351 @@
+#include "snapshot.h"
+
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+uint64_t snapshotChecksum(const uint8_t* data, uint64_t size) {
+    // FNV-1a over 64-bit words, then the tail bytes.
+    const uint64_t prime = 1099511628211ULL;
+    uint64_t h = 1469598103934665603ULL;
+    uint64_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        h = (h ^ word) * prime;
+    }
+    for (; i < size; ++i) {
+        h = (h ^ data[i]) * prime;
+    }
+    return h;
+}
+
+
+// Appends count elements at the next 8-byte boundary and returns their offset.
+template <class T>
+static uint64_t appendSection(vector<uint8_t>& out, const T* data, size_t count) {
+    out.resize((out.size() + 7) & ~(size_t)7);
+    uint64_t offset = out.size();
+    if (count > 0) {
+        out.resize(offset + count * sizeof(T));
+        memcpy(out.data() + offset, data, count * sizeof(T));
+    }
+    return offset;
+}
+
+
+static int32_t flattenKD(KDNode* node, vector<FlatKDNode>& out) {
+    if (!node) return -1;
+    int32_t index = (int32_t)out.size();
+    out.push_back(FlatKDNode{ node->point[0], node->point[1], -1, -1, node->attrs, node->mask });
+    int32_t left = flattenKD(node->left, out);
+    int32_t right = flattenKD(node->right, out);
+    out[index].left = left;
+    out[index].right = right;
+    return index;
+}
+
+
+// Breadth-first, so the four children of a node land next to each other.
+static void flattenQuad(QuadNode* root, vector<FlatQuadNode>& nodes, vector<FlatQuadPoint>& points) {
+    vector<QuadNode*> order = { root };
+    for (size_t i = 0; i < order.size(); ++i) {
+        QuadNode* node = order[i];
+        FlatQuadNode flat;
+        memset(&flat, 0, sizeof(flat));
+        flat.x_min = node->x_min;
+        flat.x_max = node->x_max;
+        flat.y_min = node->y_min;
+        flat.y_max = node->y_max;
+        flat.count = node->count;
+        flat.mask = node->mask;
+        flat.pointBegin = (uint32_t)points.size();
+        flat.pointCount = (uint32_t)node->points.size();
+        auto attr = node->pointAttrs.begin();
+        for (auto& p : node->points) {
+            points.push_back(FlatQuadPoint{ p[0], p[1], *attr++, 0 });
+        }
+        flat.firstChild = -1;
+        if (node->divided) {
+            flat.firstChild = (int32_t)order.size();
+            order.push_back(node->nw);
+            order.push_back(node->ne);
+            order.push_back(node->sw);
+            order.push_back(node->se);
+        }
+        nodes.push_back(flat);
+    }
+}
+
+
+bool prepareSnapshot(const string& path, const vector<SnapshotSource>& categories, string& error, uint64_t* checksum) {
+    vector<uint8_t> out(sizeof(SnapshotHeader) + categories.size() * sizeof(SnapshotCategory));
+    vector<SnapshotCategory> records(categories.size());
+
+    for (size_t c = 0; c < categories.size(); ++c) {
+        const SnapshotSource& src = categories[c];
+        SnapshotCategory& rec = records[c];
+        memset(&rec, 0, sizeof(rec));
+        strncpy(rec.name, src.name.c_str(), SNAPSHOT_NAME_LEN - 1);
+        memcpy(rec.color, src.color, 4);
+
+        KDNode* kdRoot = src.kdRoot;
+        QuadNode* quadRoot = src.quadRoot;
+        if (!kdRoot || !quadRoot) {
+            kdRoot = nullptr;
+            quadRoot = new QuadNode(0, src.width, 0, src.height, 4);
+            for (size_t i = 0; i < src.points->size(); ++i) {
+                vector<double> point = { (double)(*src.points)[i].first, (double)(*src.points)[i].second };
+                uint32_t attrs = i < src.attrs->size() ? (*src.attrs)[i] : 0;
+                kdRoot = insert(kdRoot, point, 0, attrs);
+                quadRoot = insert(quadRoot, point, attrs);
+            }
+        }
+
+        vector<SnapshotPoint> points;
+        points.reserve(src.points->size());
+        for (const auto& p : *src.points) points.push_back(SnapshotPoint{ p.first, p.second });
+        vector<uint32_t> attrs(*src.attrs);
+        attrs.resize(points.size(), 0);
+
+        vector<FlatKDNode> kdNodes;
+        flattenKD(kdRoot, kdNodes);
+        vector<FlatQuadNode> quadNodes;
+        vector<FlatQuadPoint> quadPoints;
+        flattenQuad(quadRoot, quadNodes, quadPoints);
+
+        if (kdRoot != src.kdRoot) deleteTree(kdRoot);
+        if (quadRoot != src.quadRoot) deleteTree(quadRoot);
+
+        rec.pointCount = points.size();
+        rec.pointsOffset = appendSection(out, points.data(), points.size());
+        rec.attrsOffset = appendSection(out, attrs.data(), attrs.size());
+        rec.kdCount = kdNodes.size();
+        rec.kdOffset = appendSection(out, kdNodes.data(), kdNodes.size());
+        rec.quadCount = quadNodes.size();
+        rec.quadOffset = appendSection(out, quadNodes.data(), quadNodes.size());
+        rec.quadPointCount = quadPoints.size();
+        rec.quadPointsOffset = appendSection(out, quadPoints.data(), quadPoints.size());
+    }
+    out.resize((out.size() + 7) & ~(size_t)7);
+
+    if (!records.empty()) {
+        memcpy(out.data() + sizeof(SnapshotHeader), records.data(), records.size() * sizeof(SnapshotCategory));
+    }
+    SnapshotHeader header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.categoryCount = (uint32_t)categories.size();
+    header.fileSize = out.size();
+    header.checksum = snapshotChecksum(out.data() + sizeof(SnapshotHeader), out.size() - sizeof(SnapshotHeader));
+    memcpy(out.data(), &header, sizeof(header));
+
+    string tmp = path + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (!f) {
+        error = "cannot create " + tmp;
+        return false;
+    }
+    // Flushed to disk before the rename, so the file at path is always complete.
+    bool written = fwrite(out.data(), 1, out.size(), f) == out.size() && fflush(f) == 0;
+#ifdef _WIN32
+    written = written && _commit(_fileno(f)) == 0;
+#else
+    written = written && fsync(fileno(f)) == 0;
+#endif
+    written = (fclose(f) == 0) && written;
+    if (!written) {
+        remove(tmp.c_str());
+        error = "cannot write " + tmp;
+        return false;
+    }
+    if (checksum) *checksum = header.checksum;
+    return true;
+}
+
+
+bool publishSnapshot(const string& path, string& error) {
+    string tmp = path + ".tmp";
+#ifdef _WIN32
+    bool renamed = MoveFileExA(tmp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    bool renamed = rename(tmp.c_str(), path.c_str()) == 0;
+#endif
+    if (!renamed) {
+        remove(tmp.c_str());
+        error = "cannot replace " + path;
+        return false;
+    }
+    return true;
+}
+
+
+bool writeSnapshot(const string& path, const vector<SnapshotSource>& categories, string& error, uint64_t* checksum) {
+    return prepareSnapshot(path, categories, error, checksum) && publishSnapshot(path, error);
+}
+
+
+FlatKDTree MappedSnapshot::kdTree(int i) const {
+    const SnapshotCategory& c = category(i);
+    return FlatKDTree{ (const FlatKDNode*)(base + c.kdOffset), c.kdCount };
+}
+
+
+FlatQuadTree MappedSnapshot::quadTree(int i) const {
+    const SnapshotCategory& c = category(i);
+    return FlatQuadTree{ (const FlatQuadNode*)(base + c.quadOffset), c.quadCount,
+                         (const FlatQuadPoint*)(base + c.quadPointsOffset), c.quadPointCount };
+}
+
+
+static bool sectionFits(const MappedSnapshot* s, uint64_t offset, uint64_t count, uint64_t elementSize) {
+    return offset % 8 == 0 && offset <= s->size && count <= (s->size - offset) / elementSize;
+}
+
+
+static bool validate(const MappedSnapshot* s, bool verifyChecksum, string& error) {
+    if (s->size < sizeof(SnapshotHeader)) {
+        error = "file too small";
+        return false;
+    }
+    const SnapshotHeader* h = s->header();
+    if (memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) != 0) {
+        error = "not a snapshot file";
+        return false;
+    }
+    if (h->version != SNAPSHOT_VERSION) {
+        error = "unsupported snapshot version " + to_string(h->version);
+        return false;
+    }
+    if (h->fileSize != s->size) {
+        error = "truncated snapshot";
+        return false;
+    }
+    if (!sectionFits(s, sizeof(SnapshotHeader), h->categoryCount, sizeof(SnapshotCategory))) {
+        error = "bad category table";
+        return false;
+    }
+    for (uint32_t i = 0; i < h->categoryCount; ++i) {
+        const SnapshotCategory& c = s->category(i);
+        if (!sectionFits(s, c.pointsOffset, c.pointCount, sizeof(SnapshotPoint)) ||
+            !sectionFits(s, c.attrsOffset, c.pointCount, sizeof(uint32_t)) ||
+            !sectionFits(s, c.kdOffset, c.kdCount, sizeof(FlatKDNode)) ||
+            !sectionFits(s, c.quadOffset, c.quadCount, sizeof(FlatQuadNode)) ||
+            !sectionFits(s, c.quadPointsOffset, c.quadPointCount, sizeof(FlatQuadPoint))) {
+            error = "bad section in category " + to_string(i);
+            return false;
+        }
+    }
+    if (verifyChecksum && snapshotChecksum(s->base + sizeof(SnapshotHeader), s->size - sizeof(SnapshotHeader)) != h->checksum) {
+        error = "checksum mismatch";
+        return false;
+    }
+    return true;
+}
+
+
+MappedSnapshot* openSnapshot(const string& path, bool verifyChecksum, string& error) {
+    MappedSnapshot* s = new MappedSnapshot();
+    if (!mapFile(path, s->file, error)) {
+        delete s;
+        return nullptr;
+    }
+    s->base = s->file.data;
+    s->size = s->file.size;
+
+    if (!validate(s, verifyChecksum, error)) {
+        closeSnapshot(s);
+        return nullptr;
+    }
+    return s;
+}
+
+
+void closeSnapshot(MappedSnapshot* s) {
+    if (!s) return;
+    unmapFile(s->file);
+    delete s;
+}
+
+
+// Child indices are bounds-checked and must point forward (both layouts put
+// children after their parent), so a damaged file that passed the header
+// checks without a checksum cannot send the search outside the mapping or
+// into a cycle.
+static void nearestFlat(const FlatKDTree& tree, int32_t index, double tx, double ty, int depth, uint32_t mask,
+                        const FlatKDNode*& best, double& bestDist) {
+    if (index < 0 || (uint64_t)index >= tree.count) return;
+    const FlatKDNode& node = tree.nodes[index];
+    if ((node.mask & mask) != mask) return;
+
+    if ((node.attrs & mask) == mask) {
+        double dx = node.x - tx, dy = node.y - ty;
+        double d = dx * dx + dy * dy;
+        if (d < bestDist) {
+            bestDist = d;
+            best = &node;
+        }
+    }
+
+    double diff = depth % 2 == 0 ? tx - node.x : ty - node.y;
+    int32_t next = diff < 0 ? node.left : node.right;
+    int32_t other = diff < 0 ? node.right : node.left;
+    if (next > index) nearestFlat(tree, next, tx, ty, depth + 1, mask, best, bestDist);
+    if (other > index && diff * diff < bestDist) {
+        nearestFlat(tree, other, tx, ty, depth + 1, mask, best, bestDist);
+    }
+}
+
+
+const FlatKDNode* findNearest(const FlatKDTree& tree, vector<double>& target_point, double& bestDist, uint32_t mask) {
+    const FlatKDNode* best = nullptr;
+    bestDist = numeric_limits<double>::max();
+    if (tree.count == 0 || target_point.size() < 2) return nullptr;
+    nearestFlat(tree, 0, target_point[0], target_point[1], 0, mask, best, bestDist);
+    return best;
+}
+
+
+static void nearestFlat(const FlatQuadTree& tree, int64_t index, double tx, double ty, uint32_t mask,
+                        const FlatQuadPoint*& best, double& bestDist) {
+    if (index < 0 || (uint64_t)index >= tree.count) return;
+    const FlatQuadNode& node = tree.nodes[index];
+    if (node.count == 0 || (node.mask & mask) != mask) return;
+
+    double dx = max({ 0.0, node.x_min - tx, tx - node.x_max });
+    double dy = max({ 0.0, node.y_min - ty, ty - node.y_max });
+    if (dx * dx + dy * dy > bestDist) return;
+
+    if ((uint64_t)node.pointBegin + node.pointCount <= tree.pointCount) {
+        for (uint32_t i = node.pointBegin; i < node.pointBegin + node.pointCount; ++i) {
+            const FlatQuadPoint& p = tree.points[i];
+            if ((p.attrs & mask) != mask) continue;
+            double px = p.x - tx, py = p.y - ty;
+            double d = px * px + py * py;
+            if (d < bestDist) {
+                bestDist = d;
+                best = &p;
+            }
+        }
+    }
+    if (node.firstChild > index) {
+        for (int c = 0; c < 4; ++c) {
+            nearestFlat(tree, (int64_t)node.firstChild + c, tx, ty, mask, best, bestDist);
+        }
+    }
+}
+
+
+vector<double> findNearest(const FlatQuadTree& tree, vector<double>& target_point, double& bestDist, uint32_t mask) {
+    const FlatQuadPoint* best = nullptr;
+    bestDist = numeric_limits<double>::max();
+    if (tree.count == 0 || target_point.size() < 2) return vector<double>();
+    nearestFlat(tree, 0, target_point[0], target_point[1], mask, best, bestDist);
+    return best ? vector<double>{ best->x, best->y } : vector<double>();
+}
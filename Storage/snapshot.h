@@ -0,0 +1,160 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <utility>
+
+#include "../KD-Tree/kd_tree.h"
+#include "../Quad-Tree/quadtree.h"
+#include "mapped_file.h"
+
+using namespace std;
+
+// Binary snapshot of every category: its points, attribute words and both
+// trees flattened into arrays that link by index. Every section is found by
+// its byte offset from the start of the file, so a mapped file is queried
+// in place with no parsing. All fields are native little-endian and every
+// section is 8-byte aligned.
+//
+//   SnapshotHeader
+//   SnapshotCategory[categoryCount]
+//   per category: SnapshotPoint[pointCount], uint32_t attrs[pointCount],
+//                 FlatKDNode[kdCount], FlatQuadNode[quadCount],
+//                 FlatQuadPoint[quadPointCount]
+//
+// The checksum covers every byte after the header.
+const char SNAPSHOT_MAGIC[8] = { 'F', 'N', 'N', 'S', 'N', 'A', 'P', '\0' };
+const uint32_t SNAPSHOT_VERSION = 1;
+const int SNAPSHOT_NAME_LEN = 64;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t categoryCount;
+    uint64_t fileSize;
+    uint64_t checksum;
+};
+
+struct SnapshotCategory {
+    char name[SNAPSHOT_NAME_LEN];
+    uint8_t color[4];
+    uint32_t reserved;
+    uint64_t pointCount, pointsOffset, attrsOffset;
+    uint64_t kdCount, kdOffset;
+    uint64_t quadCount, quadOffset;
+    uint64_t quadPointCount, quadPointsOffset;
+};
+
+struct SnapshotPoint {
+    int32_t x, y;
+};
+
+// K-D node; node 0 is the root and children are indices, -1 for none.
+struct FlatKDNode {
+    double x, y;
+    int32_t left, right;
+    uint32_t attrs, mask;
+};
+
+// Quadtree node; node 0 is the root. A divided node's children are stored
+// together at firstChild in nw, ne, sw, se order. Its own points are
+// FlatQuadPoint[pointBegin, pointBegin + pointCount).
+struct FlatQuadNode {
+    double x_min, x_max, y_min, y_max;
+    int32_t firstChild;
+    uint32_t pointBegin, pointCount;
+    int32_t count;
+    uint32_t mask;
+    uint32_t reserved;
+};
+
+struct FlatQuadPoint {
+    double x, y;
+    uint32_t attrs;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(SnapshotHeader) == 32, "snapshot layout");
+static_assert(sizeof(SnapshotCategory) == 144, "snapshot layout");
+static_assert(sizeof(FlatKDNode) == 32, "snapshot layout");
+static_assert(sizeof(FlatQuadNode) == 56, "snapshot layout");
+static_assert(sizeof(FlatQuadPoint) == 24, "snapshot layout");
+
+
+// One category to write. Trees may be null, in which case they are built
+// from the points for the file.
+struct SnapshotSource {
+    string name;
+    uint8_t color[4];
+    const vector<pair<int, int>>* points;
+    const vector<uint32_t>* attrs;
+    KDNode* kdRoot;
+    QuadNode* quadRoot;
+    double width, height; // quadtree bounds when it has to be built
+};
+
+
+// Writes to a temporary file next to path, syncs it and renames it over path.
+// checksum, if given, receives the new header checksum.
+bool writeSnapshot(const string& path, const vector<SnapshotSource>& categories, string& error,
+                   uint64_t* checksum = nullptr);
+
+
+// The two halves of writeSnapshot, for callers that must make something else
+// durable in between: prepareSnapshot writes and syncs the temporary file,
+// publishSnapshot renames it over path.
+bool prepareSnapshot(const string& path, const vector<SnapshotSource>& categories, string& error,
+                     uint64_t* checksum = nullptr);
+bool publishSnapshot(const string& path, string& error);
+
+
+struct FlatKDTree {
+    const FlatKDNode* nodes;
+    uint64_t count;
+};
+
+struct FlatQuadTree {
+    const FlatQuadNode* nodes;
+    uint64_t count;
+    const FlatQuadPoint* points;
+    uint64_t pointCount;
+};
+
+// A read-only mapping of a snapshot file.
+struct MappedSnapshot {
+    const uint8_t* base = nullptr;
+    uint64_t size = 0;
+    MappedFile file;
+
+    const SnapshotHeader* header() const { return (const SnapshotHeader*)base; }
+    uint32_t categoryCount() const { return header()->categoryCount; }
+    const SnapshotCategory& category(int i) const { return ((const SnapshotCategory*)(base + sizeof(SnapshotHeader)))[i]; }
+    const SnapshotPoint* points(int i) const { return (const SnapshotPoint*)(base + category(i).pointsOffset); }
+    const uint32_t* attrs(int i) const { return (const uint32_t*)(base + category(i).attrsOffset); }
+    FlatKDTree kdTree(int i) const;
+    FlatQuadTree quadTree(int i) const;
+};
+
+
+uint64_t snapshotChecksum(const uint8_t* data, uint64_t size);
+
+
+// Maps the file and checks the header and every section's bounds; with
+// verifyChecksum the payload checksum is checked as well, which reads the
+// whole file. Returns nullptr and sets error on failure.
+MappedSnapshot* openSnapshot(const string& path, bool verifyChecksum, string& error);
+
+
+void closeSnapshot(MappedSnapshot* snapshot);
+
+
+// Nearest-neighbour search directly on the mapped trees; same results and
+// mask semantics as the pointer-tree versions.
+const FlatKDNode* findNearest(const FlatKDTree& tree, vector<double>& target_point, double& bestDist, uint32_t mask = 0);
+
+
+vector<double> findNearest(const FlatQuadTree& tree, vector<double>& target_point, double& bestDist, uint32_t mask = 0);
+
+#endif
@@ -0,0 +1,247 @@
+#include "unified_index.h"
+
+#include <atomic>
+#include <thread>
+
+static UnifiedNode* build(vector<UnifiedEntry>& entries, int begin, int end, int& nextId) {
+    UnifiedNode* node = new UnifiedNode();
+    node->id = nextId++;
+    node->begin = begin;
+    node->end = end;
+    node->left = node->right = nullptr;
+    node->x_min = node->y_min = numeric_limits<double>::max();
+    node->x_max = node->y_max = numeric_limits<double>::lowest();
+    node->categories = 0;
+    for (int i = begin; i < end; ++i) {
+        const UnifiedEntry& e = entries[i];
+        node->x_min = min(node->x_min, e.x);
+        node->x_max = max(node->x_max, e.x);
+        node->y_min = min(node->y_min, e.y);
+        node->y_max = max(node->y_max, e.y);
+        node->categories |= categoryBit(e.category);
+    }
+
+    if (end - begin <= UNIFIED_LEAF_SIZE) {
+        return node;
+    }
+
+    // Split the wider side at the median.
+    bool splitX = (node->x_max - node->x_min) >= (node->y_max - node->y_min);
+    int mid = begin + (end - begin) / 2;
+    nth_element(entries.begin() + begin, entries.begin() + mid, entries.begin() + end,
+                [splitX](const UnifiedEntry& a, const UnifiedEntry& b) { return splitX ? a.x < b.x : a.y < b.y; });
+
+    node->left = build(entries, begin, mid, nextId);
+    node->right = build(entries, mid, end, nextId);
+    return node;
+}
+
+
+UnifiedIndex* buildUnifiedIndex(vector<UnifiedEntry> entries) {
+    UnifiedIndex* index = new UnifiedIndex();
+    index->entries = move(entries);
+    if (!index->entries.empty()) {
+        index->root = build(index->entries, 0, (int)index->entries.size(), index->nodeCount);
+    }
+    return index;
+}
+
+
+static void deleteNodes(UnifiedNode* node) {
+    if (!node) return;
+    deleteNodes(node->left);
+    deleteNodes(node->right);
+    delete node;
+}
+
+
+void deleteTree(UnifiedIndex* index) {
+    if (!index) return;
+    deleteNodes(index->root);
+    delete index;
+}
+
+
+static double boxDistSq(const UnifiedNode* node, double x, double y) {
+    double dx = max({ 0.0, node->x_min - x, x - node->x_max });
+    double dy = max({ 0.0, node->y_min - y, y - node->y_max });
+    return dx * dx + dy * dy;
+}
+
+
+static void nearestEntry(const UnifiedIndex* index, const UnifiedNode* node, double x, double y, uint64_t categoryMask,
+                         const UnifiedEntry*& best, double& bestDist) {
+    if ((node->categories & categoryMask) == 0 || boxDistSq(node, x, y) >= bestDist) {
+        return;
+    }
+
+    if (node->left == nullptr) {
+        for (int i = node->begin; i < node->end; ++i) {
+            const UnifiedEntry& e = index->entries[i];
+            if ((categoryBit(e.category) & categoryMask) == 0) continue;
+            double dx = e.x - x, dy = e.y - y;
+            double d = dx * dx + dy * dy;
+            if (d < bestDist) {
+                bestDist = d;
+                best = &e;
+            }
+        }
+        return;
+    }
+
+    const UnifiedNode* first = node->left;
+    const UnifiedNode* second = node->right;
+    if (boxDistSq(second, x, y) < boxDistSq(first, x, y)) swap(first, second);
+    nearestEntry(index, first, x, y, categoryMask, best, bestDist);
+    nearestEntry(index, second, x, y, categoryMask, best, bestDist);
+}
+
+
+const UnifiedEntry* findNearest(UnifiedIndex* index, vector<double>& target_point, uint64_t categoryMask, double& bestDist) {
+    const UnifiedEntry* best = nullptr;
+    bestDist = numeric_limits<double>::max();
+    if (!index || !index->root || target_point.size() < 2) {
+        return nullptr;
+    }
+
+    nearestEntry(index, index->root, target_point[0], target_point[1], categoryMask, best, bestDist);
+    return best;
+}
+
+
+// State of one join. best/bestRef are indexed by position in the query
+// entries and bound by query node id; each thread owns whole query subtrees,
+// so no slot is written by two threads.
+struct JoinState {
+    const UnifiedIndex* query;
+    const UnifiedIndex* ref;
+    uint64_t maskA, maskB;
+    vector<double> best;
+    vector<int> bestRef;
+    vector<double> bound;
+};
+
+
+static double boxBoxDistSq(const UnifiedNode* a, const UnifiedNode* b) {
+    double dx = max({ 0.0, a->x_min - b->x_max, b->x_min - a->x_max });
+    double dy = max({ 0.0, a->y_min - b->y_max, b->y_min - a->y_max });
+    return dx * dx + dy * dy;
+}
+
+
+static void joinLeaves(JoinState& s, const UnifiedNode* q, const UnifiedNode* r) {
+    double worst = 0;
+    for (int i = q->begin; i < q->end; ++i) {
+        const UnifiedEntry& a = s.query->entries[i];
+        if ((categoryBit(a.category) & s.maskA) == 0) continue;
+        if (boxDistSq(r, a.x, a.y) < s.best[i]) {
+            for (int j = r->begin; j < r->end; ++j) {
+                const UnifiedEntry& b = s.ref->entries[j];
+                if ((categoryBit(b.category) & s.maskB) == 0) continue;
+                double dx = a.x - b.x, dy = a.y - b.y;
+                double d = dx * dx + dy * dy;
+                if (d < s.best[i]) {
+                    s.best[i] = d;
+                    s.bestRef[i] = j;
+                }
+            }
+        }
+        worst = max(worst, s.best[i]);
+    }
+    s.bound[q->id] = worst;
+}
+
+
+static void joinNodes(JoinState& s, const UnifiedNode* q, const UnifiedNode* r) {
+    if ((q->categories & s.maskA) == 0 || (r->categories & s.maskB) == 0) return;
+    if (boxBoxDistSq(q, r) >= s.bound[q->id]) return;
+
+    bool qLeaf = q->left == nullptr;
+    bool rLeaf = r->left == nullptr;
+    if (qLeaf && rLeaf) {
+        joinLeaves(s, q, r);
+        return;
+    }
+
+    if (qLeaf || (!rLeaf && (r->end - r->begin) > (q->end - q->begin))) {
+        const UnifiedNode* first = r->left;
+        const UnifiedNode* second = r->right;
+        if (boxBoxDistSq(q, second) < boxBoxDistSq(q, first)) swap(first, second);
+        joinNodes(s, q, first);
+        joinNodes(s, q, second);
+        if (!qLeaf) s.bound[q->id] = max(s.bound[q->left->id], s.bound[q->right->id]);
+        return;
+    }
+
+    joinNodes(s, q->left, r);
+    joinNodes(s, q->right, r);
+    s.bound[q->id] = max(s.bound[q->left->id], s.bound[q->right->id]);
+}
+
+
+// Subtrees without any point of category A never tighten, so they start at
+// zero instead of holding their parents' bounds open.
+static void initBounds(JoinState& s, const UnifiedNode* q) {
+    if (!q) return;
+    s.bound[q->id] = (q->categories & s.maskA) ? numeric_limits<double>::max() : 0.0;
+    initBounds(s, q->left);
+    initBounds(s, q->right);
+}
+
+
+vector<JoinPair> allNearestJoin(const UnifiedIndex* queryIndex, int categoryA, const UnifiedIndex* refIndex, int categoryB,
+                                int threads) {
+    vector<JoinPair> result;
+    if (!queryIndex || !refIndex || !queryIndex->root || !refIndex->root) return result;
+    if (!(queryIndex->root->categories & categoryBit(categoryA)) || !(refIndex->root->categories & categoryBit(categoryB))) {
+        return result;
+    }
+
+    JoinState s;
+    s.query = queryIndex;
+    s.ref = refIndex;
+    s.maskA = categoryBit(categoryA);
+    s.maskB = categoryBit(categoryB);
+    s.best.assign(queryIndex->entries.size(), numeric_limits<double>::max());
+    s.bestRef.assign(queryIndex->entries.size(), -1);
+    s.bound.resize(queryIndex->nodeCount);
+    initBounds(s, queryIndex->root);
+
+    if (threads <= 0) threads = max(1, (int)thread::hardware_concurrency());
+
+    // Split the query tree into a frontier of subtrees, several per thread,
+    // and hand them out through a shared counter.
+    vector<const UnifiedNode*> tasks = { queryIndex->root };
+    while ((int)tasks.size() < threads * 4) {
+        vector<const UnifiedNode*> next;
+        for (const UnifiedNode* t : tasks) {
+            if (t->left) {
+                next.push_back(t->left);
+                next.push_back(t->right);
+            } else {
+                next.push_back(t);
+            }
+        }
+        if (next.size() == tasks.size()) break;
+        tasks.swap(next);
+    }
+
+    atomic<size_t> nextTask{ 0 };
+    auto worker = [&]() {
+        for (size_t t = nextTask++; t < tasks.size(); t = nextTask++) {
+            joinNodes(s, tasks[t], refIndex->root);
+        }
+    };
+    vector<thread> pool;
+    for (int i = 1; i < threads; ++i) pool.emplace_back(worker);
+    worker();
+    for (auto& th : pool) th.join();
+
+    for (size_t i = 0; i < queryIndex->entries.size(); ++i) {
+        const UnifiedEntry& a = queryIndex->entries[i];
+        if (a.category != categoryA) continue;
+        result.push_back({ a.id, refIndex->entries[s.bestRef[i]].id, sqrt(s.best[i]) });
+    }
+    sort(result.begin(), result.end(), [](const JoinPair& x, const JoinPair& y) { return x.a_id < y.a_id; });
+    return result;
+}
@@ -0,0 +1,72 @@
+#ifndef UNIFIED_INDEX_H
+#define UNIFIED_INDEX_H
+
+#include <vector>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+// One bucket K-D tree over the points of every category. Each node covers a
+// contiguous range of `entries` and keeps its bounding box and a bitmask of
+// the categories below it, so a query restricted to any subset of categories
+// is a single traversal. Category IDs must be below MAX_CATEGORIES.
+const int MAX_CATEGORIES = 64;
+const int UNIFIED_LEAF_SIZE = 16;
+
+struct UnifiedEntry {
+    double x, y;
+    int category;
+    int id; // index of the point within its category
+};
+
+struct UnifiedNode {
+    double x_min, x_max, y_min, y_max;
+    uint64_t categories;
+    int begin, end;
+    int id; // preorder number, for per-node scratch arrays
+    UnifiedNode* left;
+    UnifiedNode* right;
+};
+
+struct UnifiedIndex {
+    vector<UnifiedEntry> entries;
+    UnifiedNode* root = nullptr;
+    int nodeCount = 0;
+};
+
+
+inline uint64_t categoryBit(int category) { return 1ULL << category; }
+
+
+UnifiedIndex* buildUnifiedIndex(vector<UnifiedEntry> entries);
+
+
+void deleteTree(UnifiedIndex* index);
+
+
+// Nearest entry whose category bit is set in categoryMask, or nullptr.
+// bestDist is the squared distance.
+const UnifiedEntry* findNearest(UnifiedIndex* index, vector<double>& target_point, uint64_t categoryMask, double& bestDist);
+
+
+// One row of an all-nearest-neighbour join: the nearest point of category B
+// to point a_id of category A, and the (Euclidean) distance between them.
+struct JoinPair {
+    int a_id;
+    int b_id;
+    double dist;
+};
+
+
+// For every point of categoryA in queryIndex, the nearest point of categoryB
+// in refIndex (the two may be the same index). Runs a dual-tree traversal
+// that prunes node pairs by box distance, split across `threads` threads by
+// query subtree (0 = one per hardware thread). Rows are sorted by a_id; the
+// result is empty when category B has no points.
+vector<JoinPair> allNearestJoin(const UnifiedIndex* queryIndex, int categoryA, const UnifiedIndex* refIndex, int categoryB,
+                                int threads = 0);
+
+#endif
@@ -0,0 +1,242 @@
+#include "generators.h"
+
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <set>
+
+const char* distributionName(Distribution distribution) {
+    switch (distribution) {
+        case DIST_UNIFORM: return "Uniform";
+        case DIST_CLUSTERS: return "Clusters";
+        case DIST_HOTSPOTS: return "Hotspots";
+        case DIST_LINES: return "Lines";
+        case DIST_GRID: return "Grid";
+        case DIST_DUPLICATES: return "Duplicates";
+        case DIST_ROADS: return "Roads";
+        default: return "?";
+    }
+}
+
+
+const char* insertOrderName(InsertOrder order) {
+    switch (order) {
+        case ORDER_SHUFFLED: return "Shuffled";
+        case ORDER_SORTED: return "Sorted";
+        case ORDER_REVERSE_SORTED: return "Reverse sorted";
+        case ORDER_MORTON: return "Morton";
+        default: return "?";
+    }
+}
+
+
+struct Segment {
+    double ax, ay, bx, by;
+};
+
+
+struct Generator {
+    const WorkloadSpec& spec;
+    mt19937_64 rng;
+    vector<KDTree2D::Point> points;
+
+    Generator(const WorkloadSpec& s) : spec(s), rng(s.seed) {}
+
+    // Written out rather than using <random>'s distributions, whose output
+    // differs between standard libraries.
+    double uniform(double lo, double hi) { return lo + (hi - lo) * ((rng() >> 11) * 0x1.0p-53); }
+    double normal(double sigma) {
+        double u = uniform(1e-300, 1), v = uniform(0, 1);
+        return sigma * sqrt(-2 * log(u)) * cos(2 * 3.14159265358979323846 * v);
+    }
+    size_t below(size_t n) { return min((size_t)uniform(0, (double)n), n - 1); }
+
+    void add(double x, double y) {
+        x = min(max(floor(x), 0.0), spec.width - 1);
+        y = min(max(floor(y), 0.0), spec.height - 1);
+        points.push_back(KDTree2D::Point{ x, y });
+    }
+
+    // Picks an index with probability proportional to its share of the
+    // running total in cumulative.
+    size_t pick(const vector<double>& cumulative) {
+        double r = uniform(0, cumulative.back());
+        return min((size_t)(upper_bound(cumulative.begin(), cumulative.end(), r) - cumulative.begin()),
+                   cumulative.size() - 1);
+    }
+
+    void blobs(int count, double exponent, double sigmaLo, double sigmaHi) {
+        vector<double> cx, cy, sigma, cumulative;
+        double total = 0;
+        for (int i = 0; i < count; ++i) {
+            cx.push_back(uniform(0, spec.width));
+            cy.push_back(uniform(0, spec.height));
+            sigma.push_back(uniform(sigmaLo, sigmaHi) * min(spec.width, spec.height));
+            total += pow(i + 1.0, -exponent);
+            cumulative.push_back(total);
+        }
+        while (points.size() < spec.count) {
+            size_t b = pick(cumulative);
+            add(cx[b] + normal(sigma[b]), cy[b] + normal(sigma[b]));
+        }
+    }
+
+    // Points along the segments, weighted by length, jittered sideways.
+    void alongSegments(const vector<Segment>& segments, double jitter) {
+        vector<double> cumulative;
+        double total = 0;
+        for (const Segment& s : segments) {
+            total += hypot(s.bx - s.ax, s.by - s.ay) + 1e-9;
+            cumulative.push_back(total);
+        }
+        while (points.size() < spec.count) {
+            const Segment& s = segments[pick(cumulative)];
+            double t = uniform(0, 1);
+            add(s.ax + t * (s.bx - s.ax) + normal(jitter), s.ay + t * (s.by - s.ay) + normal(jitter));
+        }
+    }
+
+    void lines() {
+        vector<Segment> segments;
+        for (int i = 0; i < 12; ++i) {
+            segments.push_back(Segment{ uniform(0, spec.width), uniform(0, spec.height), uniform(0, spec.width),
+                                        uniform(0, spec.height) });
+        }
+        alongSegments(segments, 0.5);
+    }
+
+    void grid() {
+        size_t side = (size_t)ceil(sqrt((double)spec.count));
+        double stepX = max(1.0, floor(spec.width / side)), stepY = max(1.0, floor(spec.height / side));
+        for (size_t i = 0; points.size() < spec.count; ++i) {
+            add((i % side) * stepX, (i / side % side) * stepY);
+        }
+    }
+
+    // Copies of 512 locations with Zipf weights: the most popular one holds
+    // about a seventh of the points at any size.
+    void duplicates() {
+        size_t distinct = min(spec.count, (size_t)512);
+        vector<double> cumulative;
+        double total = 0;
+        for (size_t i = 0; i < distinct; ++i) {
+            add(uniform(0, spec.width), uniform(0, spec.height));
+            total += 1.0 / (i + 1);
+            cumulative.push_back(total);
+        }
+        vector<KDTree2D::Point> sites = points;
+        while (points.size() < spec.count) {
+            points.push_back(sites[pick(cumulative)]);
+        }
+    }
+
+    void roads() {
+        int townCount = 16;
+        vector<double> tx, ty, size;
+        for (int i = 0; i < townCount; ++i) {
+            tx.push_back(uniform(0.05, 0.95) * spec.width);
+            ty.push_back(uniform(0.05, 0.95) * spec.height);
+            size.push_back(pow(i + 1.0, -0.8)); // a few cities, many villages
+        }
+
+        vector<Segment> segments;
+        double scale = min(spec.width, spec.height);
+
+        // Highways: each town to its two nearest neighbours, as a meandering
+        // polyline of short pieces.
+        set<pair<int, int>> highways;
+        for (int i = 0; i < townCount; ++i) {
+            vector<pair<double, int>> byDistance;
+            for (int j = 0; j < townCount; ++j) {
+                if (j != i) byDistance.push_back({ hypot(tx[j] - tx[i], ty[j] - ty[i]), j });
+            }
+            sort(byDistance.begin(), byDistance.end());
+            for (int k = 0; k < 2 && k < (int)byDistance.size(); ++k) {
+                highways.insert({ min(i, byDistance[k].second), max(i, byDistance[k].second) });
+            }
+        }
+        for (const auto& road : highways) {
+            int i = road.first, j = road.second;
+            double dx = tx[j] - tx[i], dy = ty[j] - ty[i];
+            double length = max(hypot(dx, dy), 1e-9);
+            double px = tx[i], py = ty[i];
+            const int pieces = 12;
+            for (int s = 1; s <= pieces; ++s) {
+                double t = (double)s / pieces;
+                double bend = s < pieces ? normal(length * 0.03) : 0;
+                double nx = tx[i] + t * dx - dy / length * bend, ny = ty[i] + t * dy + dx / length * bend;
+                segments.push_back(Segment{ px, py, nx, ny });
+                px = nx;
+                py = ny;
+            }
+        }
+
+        // Streets: a rotated grid around each town, larger for bigger towns.
+        for (int i = 0; i < townCount; ++i) {
+            double extent = scale * 0.12 * sqrt(size[i]);
+            double spacing = max(2.0, scale * 0.012);
+            double angle = uniform(0, 3.14159265358979323846 / 2);
+            double ux = cos(angle), uy = sin(angle);
+            for (double o = -extent; o <= extent; o += spacing) {
+                segments.push_back(Segment{ tx[i] + o * ux - extent * uy, ty[i] + o * uy + extent * ux,
+                                            tx[i] + o * ux + extent * uy, ty[i] + o * uy - extent * ux });
+                segments.push_back(Segment{ tx[i] - o * uy - extent * ux, ty[i] + o * ux - extent * uy,
+                                            tx[i] - o * uy + extent * ux, ty[i] + o * ux + extent * uy });
+            }
+        }
+        alongSegments(segments, 0.7);
+    }
+};
+
+
+static uint64_t mortonCode(const KDTree2D::Point& p) {
+    auto spread = [](uint64_t v) {
+        v &= 0xffffffff;
+        v = (v | (v << 16)) & 0x0000ffff0000ffffULL;
+        v = (v | (v << 8)) & 0x00ff00ff00ff00ffULL;
+        v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+        v = (v | (v << 2)) & 0x3333333333333333ULL;
+        v = (v | (v << 1)) & 0x5555555555555555ULL;
+        return v;
+    };
+    return spread((uint64_t)p[0]) | (spread((uint64_t)p[1]) << 1);
+}
+
+
+vector<KDTree2D::Point> generatePoints(const WorkloadSpec& spec) {
+    Generator g(spec);
+    g.points.reserve(spec.count);
+    if (spec.count == 0) return g.points;
+
+    switch (spec.distribution) {
+        case DIST_CLUSTERS: g.blobs(16, 0, 0.02, 0.05); break;
+        case DIST_HOTSPOTS: g.blobs(256, 1.2, 0.002, 0.01); break;
+        case DIST_LINES: g.lines(); break;
+        case DIST_GRID: g.grid(); break;
+        case DIST_DUPLICATES: g.duplicates(); break;
+        case DIST_ROADS: g.roads(); break;
+        case DIST_UNIFORM:
+        default:
+            while (g.points.size() < spec.count) g.add(g.uniform(0, spec.width), g.uniform(0, spec.height));
+            break;
+    }
+
+    vector<KDTree2D::Point>& points = g.points;
+    switch (spec.order) {
+        case ORDER_SORTED:
+            sort(points.begin(), points.end());
+            break;
+        case ORDER_REVERSE_SORTED:
+            sort(points.begin(), points.end(), greater<KDTree2D::Point>());
+            break;
+        case ORDER_MORTON:
+            sort(points.begin(), points.end(),
+                 [](const KDTree2D::Point& a, const KDTree2D::Point& b) { return mortonCode(a) < mortonCode(b); });
+            break;
+        case ORDER_SHUFFLED:
+        default:
+            for (size_t i = points.size() - 1; i > 0; --i) swap(points[i], points[g.below(i + 1)]);
+            break;
+    }
+    return points;
+}
@@ -0,0 +1,49 @@
+#ifndef GENERATORS_H
+#define GENERATORS_H
+
+#include <cstdint>
+#include <vector>
+
+#include "../KD-Tree/kd_tree.h"
+
+using namespace std;
+
+// Point layouts, from the uniform best case to the shapes that unbalance
+// the trees:
+//   DIST_UNIFORM     independent uniform points
+//   DIST_CLUSTERS    Gaussian blobs of equal weight
+//   DIST_HOTSPOTS    many tight blobs whose sizes follow a power law
+//   DIST_LINES       points on a few long segments with sub-pixel jitter
+//   DIST_GRID        an exact lattice, so coordinates tie on both axes
+//   DIST_DUPLICATES  512 locations repeated with Zipf weights
+//   DIST_ROADS       towns of street grids joined by winding highways
+enum Distribution {
+    DIST_UNIFORM, DIST_CLUSTERS, DIST_HOTSPOTS, DIST_LINES, DIST_GRID, DIST_DUPLICATES, DIST_ROADS,
+    DISTRIBUTION_COUNT
+};
+
+// Order the points are returned, and so inserted, in. Sorted orders are the
+// adversarial case for incremental K-D insertion.
+enum InsertOrder { ORDER_SHUFFLED, ORDER_SORTED, ORDER_REVERSE_SORTED, ORDER_MORTON, INSERT_ORDER_COUNT };
+
+
+struct WorkloadSpec {
+    Distribution distribution = DIST_UNIFORM;
+    InsertOrder order = ORDER_SHUFFLED;
+    size_t count = 0;
+    double width = 1024, height = 1024;
+    uint64_t seed = 1;
+};
+
+
+const char* distributionName(Distribution distribution);
+
+
+const char* insertOrderName(InsertOrder order);
+
+
+// The same spec always yields the same points. Coordinates are whole numbers
+// in [0, width) x [0, height), like the application's map pixels.
+vector<KDTree2D::Point> generatePoints(const WorkloadSpec& spec);
+
+#endif
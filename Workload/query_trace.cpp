@@ -0,0 +1,78 @@
+#include "query_trace.h"
+
+#include <cstring>
+
+TraceRecorder* startTrace(const string& path, uint64_t snapshotChecksum, string& error) {
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) {
+        error = "cannot create " + path;
+        return nullptr;
+    }
+    TraceHeader header;
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.reserved = 0;
+    header.snapshotChecksum = snapshotChecksum;
+    if (fwrite(&header, sizeof(header), 1, f) != 1) {
+        fclose(f);
+        error = "cannot write " + path;
+        return nullptr;
+    }
+
+    TraceRecorder* recorder = new TraceRecorder();
+    recorder->file = f;
+    recorder->start = chrono::steady_clock::now();
+    return recorder;
+}
+
+
+void recordQuery(TraceRecorder* recorder, int category, int x, int y, uint32_t mode, uint32_t mask) {
+    TraceQuery q;
+    q.timestampUs = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - recorder->start).count();
+    q.category = category;
+    q.x = x;
+    q.y = y;
+    q.mode = mode;
+    q.mask = mask;
+    q.reserved = 0;
+    fwrite(&q, sizeof(q), 1, recorder->file);
+    recorder->count++;
+}
+
+
+bool stopTrace(TraceRecorder* recorder) {
+    if (!recorder) return true;
+    bool ok = !ferror(recorder->file);
+    ok = (fclose(recorder->file) == 0) && ok;
+    delete recorder;
+    return ok;
+}
+
+
+bool loadTrace(const string& path, vector<TraceQuery>& queries, uint64_t& snapshotChecksum, string& error) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) {
+        error = "cannot open " + path;
+        return false;
+    }
+    TraceHeader header;
+    if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0) {
+        fclose(f);
+        error = path + " is not a query trace";
+        return false;
+    }
+    if (header.version != TRACE_VERSION) {
+        fclose(f);
+        error = "unsupported trace version " + to_string(header.version);
+        return false;
+    }
+    snapshotChecksum = header.snapshotChecksum;
+
+    queries.clear();
+    TraceQuery q;
+    while (fread(&q, sizeof(q), 1, f) == 1) {
+        queries.push_back(q);
+    }
+    fclose(f);
+    return true;
+}
@@ -0,0 +1,59 @@
+#ifndef QUERY_TRACE_H
+#define QUERY_TRACE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <chrono>
+
+using namespace std;
+
+// A query trace: a TraceHeader followed by TraceQuery records in the order
+// they were issued. Categories are indices into the snapshot whose checksum
+// is in the header, which holds the data the queries ran against.
+const char TRACE_MAGIC[8] = { 'F', 'N', 'N', 'T', 'R', 'A', 'C', 'E' };
+const uint32_t TRACE_VERSION = 1;
+
+struct TraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t snapshotChecksum;
+};
+
+struct TraceQuery {
+    uint64_t timestampUs; // since recording started
+    int32_t category;
+    int32_t x, y;
+    uint32_t mode;        // SearchMode the query was issued with: 0 linear, 1 K-D tree, 2 quadtree
+    uint32_t mask;        // attribute filter
+    uint32_t reserved;
+};
+
+static_assert(sizeof(TraceHeader) == 24, "trace layout");
+static_assert(sizeof(TraceQuery) == 32, "trace layout");
+
+
+struct TraceRecorder {
+    FILE* file = nullptr;
+    chrono::steady_clock::time_point start;
+    uint64_t count = 0;
+};
+
+
+TraceRecorder* startTrace(const string& path, uint64_t snapshotChecksum, string& error);
+
+
+void recordQuery(TraceRecorder* recorder, int category, int x, int y, uint32_t mode, uint32_t mask);
+
+
+// Flushes and closes the file; returns false if any write failed.
+bool stopTrace(TraceRecorder* recorder);
+
+
+// Reads a whole trace. A partial final record, left by a crash while
+// recording, is ignored.
+bool loadTrace(const string& path, vector<TraceQuery>& queries, uint64_t& snapshotChecksum, string& error);
+
+#endif
@@ -0,0 +1,2015 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <random>
+#include <limits>
+#include <cmath>
+#include <algorithm>
+#include <fstream>
+
+#include "KD-Tree/kd_tree.h"
+#include "Quad-Tree/quadtree.h"
+#include "Concurrency/concurrent_index.h"
+#include "Distance/geo.h"
+#include "Unified-Index/unified_index.h"
+#include "Reverse-NN/reverse_nn.h"
+#include "Storage/snapshot.h"
+#include "Storage/mutation_log.h"
+#include "Ingest/point_loader.h"
+#include "Workload/query_trace.h"
+#include "Workload/generators.h"
+#include "Instrumentation/tree_shape.h"
+#include "Instrumentation/latency_histogram.h"
+#include "Instrumentation/perf_counters.h"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+const double MAP_W = 1024;
+const double MAP_H = 1024;
+
+static double option(int argc, char** argv, const char* name, double def) {
+    for (int i = 2; i + 1 < argc; ++i) {
+        if (strcmp(argv[i], name) == 0) return atof(argv[i + 1]);
+    }
+    return def;
+}
+
+static string stringOption(int argc, char** argv, const char* name, const string& def) {
+    for (int i = 2; i + 1 < argc; ++i) {
+        if (strcmp(argv[i], name) == 0) return argv[i + 1];
+    }
+    return def;
+}
+
+static vector<double> randomPoint(mt19937& rng) {
+    uniform_real_distribution<double> ux(0, MAP_W), uy(0, MAP_H);
+    return { floor(ux(rng)), floor(uy(rng)) };
+}
+
+// Readers run findNearest in a tight loop while one writer inserts and removes
+// points at a fixed rate, so the tree size stays constant during the run.
+template <class Tree>
+static void runConcurrent(const char* name, Tree& tree, int readers, double writeRate, double seconds) {
+    atomic<bool> stop(false);
+    vector<long long> reads(readers, 0);
+    vector<thread> threads;
+
+    for (int r = 0; r < readers; ++r) {
+        int slot = tree.registerReader();
+        threads.emplace_back([&, r, slot] {
+            mt19937 rng(1000 + r);
+            vector<double> nearest;
+            double bestDist;
+            long long n = 0;
+            while (!stop.load(memory_order_relaxed)) {
+                vector<double> target = randomPoint(rng);
+                tree.findNearest(slot, target, nearest, bestDist);
+                n++;
+            }
+            reads[r] = n;
+            tree.releaseReader(slot);
+        });
+    }
+
+    long long writes = 0;
+    thread writer([&] {
+        if (writeRate <= 0) return;
+        mt19937 rng(7);
+        vector<vector<double>> added;
+        auto period = chrono::duration_cast<Clock::duration>(chrono::duration<double>(1.0 / writeRate));
+        auto next = Clock::now();
+        while (!stop.load(memory_order_relaxed)) {
+            if (added.empty() || writes % 2 == 0) {
+                added.push_back(randomPoint(rng));
+                tree.insert(added.back());
+            } else {
+                size_t i = rng() % added.size();
+                tree.remove(added[i]);
+                added[i] = added.back();
+                added.pop_back();
+            }
+            writes++;
+            next += period;
+            this_thread::sleep_until(next);
+        }
+    });
+
+    auto start = Clock::now();
+    this_thread::sleep_for(chrono::duration<double>(seconds));
+    stop = true;
+    for (auto& t : threads) t.join();
+    writer.join();
+    double elapsed = chrono::duration<double>(Clock::now() - start).count();
+
+    long long total = 0;
+    for (long long n : reads) total += n;
+    printf("%-10s readers=%-3d target_writes/s=%-8.0f reads/s=%-12.0f per_reader/s=%-10.0f writes/s=%-8.0f retired_pending=%zu\n",
+           name, readers, writeRate, total / elapsed, total / elapsed / readers, writes / elapsed, tree.epochs.pending());
+}
+
+static int benchConcurrent(int argc, char** argv) {
+    int points = (int)option(argc, argv, "--points", 100000);
+    int readers = (int)option(argc, argv, "--readers", max(1u, thread::hardware_concurrency() - 1));
+    double writeRate = option(argc, argv, "--write-rate", 1000);
+    double seconds = option(argc, argv, "--seconds", 2);
+    if (readers < 1 || readers > EpochManager::MAX_READERS) {
+        printf("--readers must be between 1 and %d\n", EpochManager::MAX_READERS);
+        return 1;
+    }
+
+    printf("concurrent read throughput: %d points, %d readers, %.1f s per run\n", points, readers, seconds);
+
+    mt19937 rng(42);
+    vector<vector<double>> initial;
+    for (int i = 0; i < points; ++i) initial.push_back(randomPoint(rng));
+
+    ConcurrentKDTree kd;
+    ConcurrentQuadTree quad(0, MAP_W, 0, MAP_H, 4);
+    for (auto& p : initial) {
+        kd.insert(p);
+        quad.insert(p);
+    }
+
+    runConcurrent("K-D Tree", kd, readers, 0, seconds);
+    runConcurrent("K-D Tree", kd, readers, writeRate, seconds);
+    runConcurrent("Quadtree", quad, readers, 0, seconds);
+    runConcurrent("Quadtree", quad, readers, writeRate, seconds);
+    return 0;
+}
+
+// Builds and queries one KDTree<T, Dims> instantiation over the same integer
+// grid points, so the variants can be compared for node size and speed.
+template <typename T, int Dims>
+static void runVariant(const char* name, int points, int queries) {
+    typedef KDTree<T, Dims> Tree;
+    mt19937 rng(42);
+    uniform_int_distribution<int> coord(0, (int)MAP_W - 1);
+
+    auto start = Clock::now();
+    typename Tree::Node* root = nullptr;
+    for (int i = 0; i < points; ++i) {
+        typename Tree::Point p;
+        for (int d = 0; d < Dims; ++d) p[d] = (T)coord(rng);
+        root = Tree::insert(root, p);
+    }
+    double buildMs = chrono::duration<double, milli>(Clock::now() - start).count();
+
+    start = Clock::now();
+    double checksum = 0;
+    for (int i = 0; i < queries; ++i) {
+        typename Tree::Point q;
+        for (int d = 0; d < Dims; ++d) q[d] = (T)coord(rng);
+        typename Tree::Distance bestDist;
+        Tree::findNearest(root, q, bestDist);
+        checksum += (double)bestDist;
+    }
+    double queryUs = chrono::duration<double, micro>(Clock::now() - start).count() / queries;
+
+    printf("%-16s node_bytes=%-4zu tree_MB=%-8.2f build_ms=%-9.1f query_us=%-8.3f checksum=%.0f\n",
+           name, sizeof(typename Tree::Node), sizeof(typename Tree::Node) * (double)points / (1024 * 1024),
+           buildMs, queryUs, checksum);
+    Tree::deleteTree(root);
+}
+
+static int benchVariants(int argc, char** argv) {
+    int points = (int)option(argc, argv, "--points", 1000000);
+    int queries = (int)option(argc, argv, "--queries", 100000);
+
+    printf("KDTree<T, Dims> variants: %d points, %d queries\n", points, queries);
+    runVariant<double, 2>("double x2", points, queries);
+    runVariant<float, 2>("float x2", points, queries);
+    runVariant<int32_t, 2>("int32 x2", points, queries);
+    runVariant<double, 3>("double x3", points, queries);
+    runVariant<int32_t, 3>("int32 x3", points, queries);
+    return 0;
+}
+
+// Times both engines under one metric and checks every answer against a
+// linear scan with the same metric.
+template <class Metric>
+static void runMetric(const char* name, const Metric& metric, KDNode* kdRoot, QuadNode* quadRoot,
+                      const vector<vector<double>>& points, const vector<vector<double>>& queries) {
+    int mismatches = 0;
+    double kdUs = 0, quadUs = 0;
+    for (auto q : queries) {
+        double expected = numeric_limits<double>::max();
+        for (auto& p : points) {
+            expected = min(expected, MetricDistance<2>::eval<double>(metric, p, q));
+        }
+
+        auto start = Clock::now();
+        double kdDist;
+        KDTree2D::findNearest(kdRoot, KDTree2D::Point{ q[0], q[1] }, kdDist, metric);
+        auto mid = Clock::now();
+        double quadDist;
+        findNearest(quadRoot, q, quadDist, metric);
+        auto end = Clock::now();
+
+        kdUs += chrono::duration<double, micro>(mid - start).count();
+        quadUs += chrono::duration<double, micro>(end - mid).count();
+        if (fabs(kdDist - expected) > 1e-9 || fabs(quadDist - expected) > 1e-9) mismatches++;
+    }
+    printf("%-12s kd_query_us=%-8.3f quad_query_us=%-8.3f mismatches=%d\n",
+           name, kdUs / queries.size(), quadUs / queries.size(), mismatches);
+}
+
+static int benchMetrics(int argc, char** argv) {
+    int points = (int)option(argc, argv, "--points", 100000);
+    int queries = (int)option(argc, argv, "--queries", 2000);
+
+    mt19937 rng(42);
+    vector<vector<double>> pts, qs;
+    KDNode* kdRoot = nullptr;
+    QuadNode* quadRoot = new QuadNode(0, MAP_W, 0, MAP_H, 4);
+    for (int i = 0; i < points; ++i) {
+        pts.push_back(randomPoint(rng));
+        kdRoot = insert(kdRoot, pts.back());
+        quadRoot = insert(quadRoot, pts.back());
+    }
+    for (int i = 0; i < queries; ++i) qs.push_back(randomPoint(rng));
+
+    printf("distance metrics: %d points, %d queries (checked against a linear scan)\n", points, queries);
+    runMetric("L2", L2Metric(), kdRoot, quadRoot, pts, qs);
+    runMetric("L1", L1Metric(), kdRoot, quadRoot, pts, qs);
+    runMetric("Chebyshev", ChebyshevMetric(), kdRoot, quadRoot, pts, qs);
+    runMetric("Weighted L2", WeightedL2Metric<2>{ { 1.0, 4.0 } }, kdRoot, quadRoot, pts, qs);
+
+    deleteTree(kdRoot);
+    deleteTree(quadRoot);
+    return 0;
+}
+
+// Uniform points on the sphere, with extra queries hugging the poles and the
+// antimeridian; every answer is checked against a haversine linear scan.
+static int benchGeo(int argc, char** argv) {
+    int points = (int)option(argc, argv, "--points", 200000);
+    int queries = (int)option(argc, argv, "--queries", 2000);
+
+    mt19937 rng(42);
+    uniform_real_distribution<double> unit(-1.0, 1.0), lonDist(-180.0, 180.0);
+    vector<pair<double, double>> pts;
+    GeoNode* root = nullptr;
+    for (int i = 0; i < points; ++i) {
+        double lat = asin(unit(rng)) * 180.0 / 3.14159265358979323846;
+        double lon = lonDist(rng);
+        pts.push_back({ lat, lon });
+        root = geoInsert(root, lat, lon);
+    }
+
+    int mismatches = 0;
+    double treeUs = 0, scanUs = 0, maxErr = 0;
+    for (int i = 0; i < queries; ++i) {
+        double lat, lon;
+        if (i % 4 == 0) { lat = 89.0 + unit(rng); lon = lonDist(rng); }
+        else if (i % 4 == 1) { lat = 45.0 * unit(rng); lon = 179.9 + 0.2 * unit(rng); if (lon > 180) lon -= 360; }
+        else { lat = asin(unit(rng)) * 180.0 / 3.14159265358979323846; lon = lonDist(rng); }
+
+        auto start = Clock::now();
+        double meters;
+        geoFindNearest(root, lat, lon, meters);
+        auto mid = Clock::now();
+        double expected = numeric_limits<double>::max();
+        for (auto& p : pts) expected = min(expected, haversineMeters(lat, lon, p.first, p.second));
+        auto end = Clock::now();
+
+        treeUs += chrono::duration<double, micro>(mid - start).count();
+        scanUs += chrono::duration<double, micro>(end - mid).count();
+        maxErr = max(maxErr, fabs(meters - expected));
+        if (fabs(meters - expected) > 1e-3) mismatches++;
+    }
+
+    printf("geodesic nearest: %d points, %d queries (1 in 4 near a pole, 1 in 4 across the antimeridian)\n", points, queries);
+    printf("tree_query_us=%-8.3f haversine_scan_us=%-10.1f max_error_m=%.6f mismatches=%d\n",
+           treeUs / queries, scanUs / queries, maxErr, mismatches);
+    GeoTree::deleteTree(root);
+    return 0;
+}
+
+// Speed/accuracy curve of the (1 + eps) search: for each eps, the mean query
+// time, the speedup over the exact search and how far the returned distance
+// is from the true nearest distance.
+static int benchApprox(int argc, char** argv) {
+    int points = (int)option(argc, argv, "--points", 1000000);
+    int queries = (int)option(argc, argv, "--queries", 20000);
+    const double epsilons[] = { 0.0, 0.01, 0.02, 0.05, 0.1, 0.2, 0.5, 1.0 };
+
+    mt19937 rng(42);
+    KDNode* kdRoot = nullptr;
+    QuadNode* quadRoot = new QuadNode(0, MAP_W, 0, MAP_H, 4);
+    uniform_real_distribution<double> ux(0, MAP_W), uy(0, MAP_H);
+    for (int i = 0; i < points; ++i) {
+        vector<double> p = { ux(rng), uy(rng) };
+        kdRoot = insert(kdRoot, p);
+        quadRoot = insert(quadRoot, p);
+    }
+    vector<vector<double>> qs;
+    for (int i = 0; i < queries; ++i) qs.push_back({ ux(rng), uy(rng) });
+
+    vector<double> exactKd(queries), exactQuad(queries);
+    for (int i = 0; i < queries; ++i) {
+        findNearest(kdRoot, qs[i], exactKd[i]);
+        findNearest(quadRoot, qs[i], exactQuad[i]);
+    }
+
+    printf("approximate nearest neighbour: %d points, %d queries\n", points, queries);
+    for (int engine = 0; engine < 2; ++engine) {
+        double exactUs = 0;
+        for (double eps : epsilons) {
+            double sumRatio = 0, maxRatio = 1;
+            int exactHits = 0;
+            auto start = Clock::now();
+            for (int i = 0; i < queries; ++i) {
+                double d;
+                if (engine == 0) findNearest(kdRoot, qs[i], d, eps);
+                else findNearest(quadRoot, qs[i], d, eps);
+                double truth = engine == 0 ? exactKd[i] : exactQuad[i];
+                double ratio = truth > 0 ? sqrt(d / truth) : 1.0;
+                sumRatio += ratio;
+                maxRatio = max(maxRatio, ratio);
+                if (d == truth) exactHits++;
+            }
+            double us = chrono::duration<double, micro>(Clock::now() - start).count() / queries;
+            if (eps == 0.0) exactUs = us;
+            printf("%-10s eps=%-5.2f query_us=%-8.3f speedup=%-6.2f mean_ratio=%-8.5f max_ratio=%-8.5f exact=%.1f%%\n",
+                   engine == 0 ? "K-D Tree" : "Quadtree", eps, us, exactUs / us, sumRatio / queries, maxRatio,
+                   100.0 * exactHits / queries);
+        }
+    }
+
+    deleteTree(kdRoot);
+    deleteTree(quadRoot);
+    return 0;
+}
+
+// Tail latency of the best-bin-first search for a range of visit budgets, on
+// uniform points and on points inserted in sorted order along a line, which
+// degenerates the K-D tree into a long chain.
+static void runBudgets(const char* dataset, KDNode* kdRoot, QuadNode* quadRoot, const vector<vector<double>>& qs) {
+    const int budgets[] = { 8, 32, 128, 512, 2048, numeric_limits<int>::max() };
+    int queries = (int)qs.size();
+
+    vector<double> exactKd(queries), exactQuad(queries);
+    for (int i = 0; i < queries; ++i) {
+        vector<double> q = qs[i];
+        findNearest(kdRoot, q, exactKd[i]);
+        findNearest(quadRoot, q, exactQuad[i]);
+    }
+
+    for (int engine = 0; engine < 2; ++engine) {
+        for (int budget : budgets) {
+            vector<double> latency(queries);
+            int exactFlags = 0, exactHits = 0;
+            for (int i = 0; i < queries; ++i) {
+                vector<double> q = qs[i];
+                double d;
+                bool exact;
+                auto start = Clock::now();
+                if (engine == 0) findNearestBBF(kdRoot, q, budget, d, exact);
+                else findNearestBBF(quadRoot, q, budget, d, exact);
+                latency[i] = chrono::duration<double, micro>(Clock::now() - start).count();
+                if (exact) exactFlags++;
+                if (d == (engine == 0 ? exactKd[i] : exactQuad[i])) exactHits++;
+            }
+            sort(latency.begin(), latency.end());
+            char budgetName[16];
+            if (budget == numeric_limits<int>::max()) snprintf(budgetName, sizeof(budgetName), "none");
+            else snprintf(budgetName, sizeof(budgetName), "%d", budget);
+            printf("%-8s %-10s budget=%-6s p50_us=%-8.3f p99_us=%-8.3f max_us=%-9.3f exact_flag=%.1f%% correct=%.1f%%\n",
+                   dataset, engine == 0 ? "K-D Tree" : "Quadtree", budgetName, latency[queries / 2],
+                   latency[queries * 99 / 100], latency.back(), 100.0 * exactFlags / queries,
+                   100.0 * exactHits / queries);
+        }
+    }
+}
+
+static int benchBBF(int argc, char** argv) {
+    int points = (int)option(argc, argv, "--points", 200000);
+    int sortedPoints = (int)option(argc, argv, "--sorted-points", 5000);
+    int queries = (int)option(argc, argv, "--queries", 10000);
+
+    mt19937 rng(42);
+    uniform_real_distribution<double> ux(0, MAP_W), uy(0, MAP_H);
+    vector<vector<double>> qs;
+    for (int i = 0; i < queries; ++i) qs.push_back({ ux(rng), uy(rng) });
+
+    printf("best-bin-first search: %d uniform points, %d sorted points, %d queries\n", points, sortedPoints, queries);
+
+    KDNode* kdRoot = nullptr;
+    QuadNode* quadRoot = new QuadNode(0, MAP_W, 0, MAP_H, 4);
+    for (int i = 0; i < points; ++i) {
+        vector<double> p = { ux(rng), uy(rng) };
+        kdRoot = insert(kdRoot, p);
+        quadRoot = insert(quadRoot, p);
+    }
+    runBudgets("uniform", kdRoot, quadRoot, qs);
+    deleteTree(kdRoot);
+    deleteTree(quadRoot);
+
+    kdRoot = nullptr;
+    quadRoot = new QuadNode(0, MAP_W, 0, MAP_H, 4);
+    for (int i = 0; i < sortedPoints; ++i) {
+        double t = (double)i / sortedPoints;
+        vector<double> p = { t * MAP_W, t * MAP_H };
+        kdRoot = insert(kdRoot, p);
+        quadRoot = insert(quadRoot, p);
+    }
+    runBudgets("sorted", kdRoot, quadRoot, qs);
+    deleteTree(kdRoot);
+    deleteTree(quadRoot);
+    return 0;
+}
+
+// Deterministic "in stock" flag for a point, true for roughly `rate` of them.
+static bool inStock(const vector<double>& p, double rate) {
+    uint64_t h = (uint64_t)(p[0] * 4096) * 0x9E3779B97F4A7C15ULL ^ (uint64_t)(p[1] * 4096) * 0xC2B2AE3D27D4EB4FULL;
+    h ^= h >> 29;
+    return (h % 1000000) < rate * 1000000;
+}
+
+// Distance browsing: for each query, the iterators yield points in distance
+// order until one is in stock. Reports the mean query time and number of
+// points yielded, and checks the result against a filtered linear scan.
+static int benchBrowse(int argc, char** argv) {
+    int points = (int)option(argc, argv, "--points", 200000);
+    int queries = (int)option(argc, argv, "--queries", 5000);
+    int checked = min(queries, 200);
+    const double rates[] = { 0.5, 0.1, 0.01, 0.001 };
+
+    mt19937 rng(42);
+    uniform_real_distribution<double> ux(0, MAP_W), uy(0, MAP_H);
+    KDNode* kdRoot = nullptr;
+    QuadNode* quadRoot = new QuadNode(0, MAP_W, 0, MAP_H, 4);
+    vector<vector<double>> all;
+    for (int i = 0; i < points; ++i) {
+        vector<double> p = { ux(rng), uy(rng) };
+        all.push_back(p);
+        kdRoot = insert(kdRoot, p);
+        quadRoot = insert(quadRoot, p);
+    }
+    vector<vector<double>> qs;
+    for (int i = 0; i < queries; ++i) qs.push_back({ ux(rng), uy(rng) });
+
+    printf("distance browsing: %d points, %d queries\n", points, queries);
+    for (double rate : rates) {
+        vector<double> truth(checked, numeric_limits<double>::max());
+        for (int i = 0; i < checked; ++i) {
+            for (auto& p : all) {
+                double dx = p[0] - qs[i][0], dy = p[1] - qs[i][1];
+                if (inStock(p, rate)) truth[i] = min(truth[i], dx * dx + dy * dy);
+            }
+        }
+
+        for (int engine = 0; engine < 2; ++engine) {
+            long long yielded = 0;
+            int mismatches = 0;
+            auto start = Clock::now();
+            for (int i = 0; i < queries; ++i) {
+                double dist = numeric_limits<double>::max();
+                if (engine == 0) {
+                    KDNearestIterator<double, 2> it(kdRoot, KDTree2D::Point{ { qs[i][0], qs[i][1] } });
+                    KDNode* node;
+                    double d;
+                    while (it.next(node, d)) {
+                        yielded++;
+                        if (inStock({ node->point[0], node->point[1] }, rate)) {
+                            dist = d;
+                            break;
+                        }
+                    }
+                } else {
+                    QuadNearestIterator it(quadRoot, qs[i]);
+                    vector<double> p;
+                    double d;
+                    while (it.next(p, d)) {
+                        yielded++;
+                        if (inStock(p, rate)) {
+                            dist = d;
+                            break;
+                        }
+                    }
+                }
+                if (i < checked && dist != truth[i]) mismatches++;
+            }
+            double us = chrono::duration<double, micro>(Clock::now() - start).count() / queries;
+            printf("%-10s in_stock=%-6.3f query_us=%-9.3f yielded=%-9.1f mismatches=%d/%d\n",
+                   engine == 0 ? "K-D Tree" : "Quadtree", rate, us, (double)yielded / queries, mismatches, checked);
+        }
+    }
+
+    deleteTree(kdRoot);
+    deleteTree(quadRoot);
+    return 0;
+}
+
+// Attribute-filtered search: each point gets flags set with decreasing
+// probability, and queries ask for the nearest point carrying one flag.
+// Reports query time against a filtered linear scan and checks every answer,
+// then removes a tenth of the points and checks again so the per-node masks
+// are exercised after deletions. Some points share a location but not their
+// attributes, so removals must take out the matching one.
+static int benchAttrs(int argc, char** argv) {
+    int points = (int)option(argc, argv, "--points", 200000);
+    int queries = (int)option(argc, argv, "--queries", 2000);
+    const double rates[] = { 0.5, 0.1, 0.01, 0.001 };
+    const int flagCount = 4;
+
+    mt19937 rng(42);
+    uniform_real_distribution<double> ux(0, MAP_W), uy(0, MAP_H), coin(0, 1);
+    vector<vector<double>> all;
+    vector<uint32_t> attrs;
+    KDNode* kdRoot = nullptr;
+    QuadNode* quadRoot = new QuadNode(0, MAP_W, 0, MAP_H, 4);
+    for (int i = 0; i < points; ++i) {
+        vector<double> p = i % 8 == 7 ? all[rng() % all.size()] : vector<double>{ ux(rng), uy(rng) };
+        uint32_t a = 0;
+        for (int f = 0; f < flagCount; ++f) {
+            if (coin(rng) < rates[f]) a |= 1u << f;
+        }
+        all.push_back(p);
+        attrs.push_back(a);
+        kdRoot = insert(kdRoot, p, 0, a);
+        quadRoot = insert(quadRoot, p, a);
+    }
+    vector<vector<double>> qs;
+    for (int i = 0; i < queries; ++i) qs.push_back({ ux(rng), uy(rng) });
+
+    printf("attribute-filtered search: %d points, %d queries\n", points, queries);
+    for (int pass = 0; pass < 2; ++pass) {
+        if (pass == 1) {
+            int removed = points / 10;
+            for (int i = 0; i < removed; ++i) {
+                kdRoot = removeNode(kdRoot, all.back(), 0, &attrs.back());
+                quadRoot = removeNode(quadRoot, all.back(), &attrs.back());
+                all.pop_back();
+                attrs.pop_back();
+            }
+            printf("after removing %d points\n", removed);
+        }
+
+        for (int f = 0; f < flagCount; ++f) {
+            uint32_t mask = 1u << f;
+            vector<double> truth(queries, numeric_limits<double>::max());
+            auto start = Clock::now();
+            for (int i = 0; i < queries; ++i) {
+                for (size_t j = 0; j < all.size(); ++j) {
+                    if ((attrs[j] & mask) != mask) continue;
+                    double dx = all[j][0] - qs[i][0], dy = all[j][1] - qs[i][1];
+                    truth[i] = min(truth[i], dx * dx + dy * dy);
+                }
+            }
+            double linearUs = chrono::duration<double, micro>(Clock::now() - start).count() / queries;
+
+            for (int engine = 0; engine < 2; ++engine) {
+                int mismatches = 0;
+                start = Clock::now();
+                for (int i = 0; i < queries; ++i) {
+                    double d = numeric_limits<double>::max();
+                    if (engine == 0) findNearest(kdRoot, qs[i], d, 0.0, mask);
+                    else findNearest(quadRoot, qs[i], d, 0.0, mask);
+                    if (d != truth[i]) mismatches++;
+                }
+                double us = chrono::duration<double, micro>(Clock::now() - start).count() / queries;
+                printf("%-10s match_rate=%-6.3f query_us=%-9.3f linear_us=%-9.3f mismatches=%d\n",
+                       engine == 0 ? "K-D Tree" : "Quadtree", rates[f], us, linearUs, mismatches);
+            }
+        }
+    }
+
+    deleteTree(kdRoot);
+    deleteTree(quadRoot);
+    return 0;
+}
+
+// Cross-category nearest: C categories share one unified index, and each
+// query asks for the nearest point in a random subset of them. Compares one
+// unified traversal against querying every selected category's K-D tree in
+// turn, and checks that both give the same distance.
+static int benchUnified(int argc, char** argv) {
+    int points = (int)option(argc, argv, "--points", 200000);
+    int queries = (int)option(argc, argv, "--queries", 20000);
+    const int categoryCounts[] = { 2, 8, 32, 64 };
+
+    printf("unified multi-category index: %d points, %d queries\n", points, queries);
+    for (int categories : categoryCounts) {
+        mt19937 rng(42);
+        uniform_real_distribution<double> ux(0, MAP_W), uy(0, MAP_H);
+        vector<KDNode*> roots(categories, nullptr);
+        vector<int> sizes(categories, 0);
+        vector<UnifiedEntry> entries;
+        for (int i = 0; i < points; ++i) {
+            int c = (int)(rng() % categories);
+            vector<double> p = { ux(rng), uy(rng) };
+            roots[c] = insert(roots[c], p);
+            entries.push_back({ p[0], p[1], c, sizes[c]++ });
+        }
+
+        auto start = Clock::now();
+        UnifiedIndex* index = buildUnifiedIndex(entries);
+        double buildMs = chrono::duration<double, milli>(Clock::now() - start).count();
+
+        vector<vector<double>> qs;
+        vector<uint64_t> masks;
+        for (int i = 0; i < queries; ++i) {
+            qs.push_back({ ux(rng), uy(rng) });
+            uint64_t mask = 0;
+            while (mask == 0) {
+                for (int c = 0; c < categories; ++c) {
+                    if (rng() % 4 == 0) mask |= categoryBit(c);
+                }
+            }
+            masks.push_back(mask);
+        }
+
+        vector<double> perTree(queries);
+        start = Clock::now();
+        for (int i = 0; i < queries; ++i) {
+            double best = numeric_limits<double>::max();
+            for (int c = 0; c < categories; ++c) {
+                if (!(masks[i] & categoryBit(c)) || !roots[c]) continue;
+                double d;
+                findNearest(roots[c], qs[i], d);
+                best = min(best, d);
+            }
+            perTree[i] = best;
+        }
+        double perTreeUs = chrono::duration<double, micro>(Clock::now() - start).count() / queries;
+
+        int mismatches = 0;
+        start = Clock::now();
+        for (int i = 0; i < queries; ++i) {
+            double d;
+            findNearest(index, qs[i], masks[i], d);
+            if (d != perTree[i]) mismatches++;
+        }
+        double unifiedUs = chrono::duration<double, micro>(Clock::now() - start).count() / queries;
+
+        printf("categories=%-3d build_ms=%-8.2f unified_us=%-8.3f per_category_us=%-8.3f speedup=%-6.2f mismatches=%d\n",
+               categories, buildMs, unifiedUs, perTreeUs, perTreeUs / unifiedUs, mismatches);
+
+        deleteTree(index);
+        for (KDNode* root : roots) deleteTree(root);
+    }
+    return 0;
+}
+
+// All-nearest-neighbour join: for every point of category A, the nearest
+// point of category B. Compares |A| separate findNearest calls into B's K-D
+// tree with the dual-tree join on one shared index, single-threaded and on
+// every hardware thread, and checks the distances.
+static int benchJoin(int argc, char** argv) {
+    int sizeA = (int)option(argc, argv, "--a", 200000);
+    int sizeB = (int)option(argc, argv, "--b", 50000);
+    int threads = (int)option(argc, argv, "--threads", 0);
+    if (threads <= 0) threads = max(1, (int)thread::hardware_concurrency());
+
+    mt19937 rng(42);
+    uniform_real_distribution<double> ux(0, MAP_W), uy(0, MAP_H);
+    vector<vector<double>> a, b;
+    vector<UnifiedEntry> entries;
+    KDNode* bRoot = nullptr;
+    for (int i = 0; i < sizeA; ++i) {
+        a.push_back({ ux(rng), uy(rng) });
+        entries.push_back({ a.back()[0], a.back()[1], 0, i });
+    }
+    for (int i = 0; i < sizeB; ++i) {
+        b.push_back({ ux(rng), uy(rng) });
+        entries.push_back({ b.back()[0], b.back()[1], 1, i });
+        bRoot = insert(bRoot, b.back());
+    }
+    UnifiedIndex* index = buildUnifiedIndex(entries);
+
+    printf("all-nearest-neighbour join: |A|=%d |B|=%d\n", sizeA, sizeB);
+
+    vector<double> naive(sizeA);
+    auto start = Clock::now();
+    for (int i = 0; i < sizeA; ++i) {
+        double d;
+        findNearest(bRoot, a[i], d);
+        naive[i] = sqrt(d);
+    }
+    double naiveMs = chrono::duration<double, milli>(Clock::now() - start).count();
+    printf("%-22s ms=%-9.2f\n", "per-point findNearest", naiveMs);
+
+    for (int t : { 1, threads }) {
+        start = Clock::now();
+        vector<JoinPair> pairs = allNearestJoin(index, 0, index, 1, t);
+        double ms = chrono::duration<double, milli>(Clock::now() - start).count();
+        int mismatches = (int)pairs.size() == sizeA ? 0 : sizeA;
+        for (size_t i = 0; i < pairs.size() && mismatches == 0; ++i) {
+            const JoinPair& p = pairs[i];
+            double dx = a[p.a_id][0] - b[p.b_id][0], dy = a[p.a_id][1] - b[p.b_id][1];
+            if (p.dist != naive[p.a_id] || sqrt(dx * dx + dy * dy) != p.dist) mismatches++;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "dual-tree threads=%d", t);
+        printf("%-22s ms=%-9.2f speedup=%-6.2f rows=%-8zu mismatches=%d\n", name, ms, naiveMs / ms, pairs.size(),
+               mismatches);
+    }
+
+    deleteTree(index);
+    deleteTree(bRoot);
+    return 0;
+}
+
+// Squared distance from every client to its nearest facility by brute force
+// (its nearest other point when monochromatic); the reference for the
+// reverse nearest-neighbour checks.
+static vector<double> bruteRadii(const vector<vector<double>>& clients, const vector<vector<double>>& facilities,
+                                 bool monochromatic) {
+    vector<double> radii;
+    for (const auto& c : clients) {
+        double radius = numeric_limits<double>::max();
+        bool seenSelf = false;
+        for (const auto& f : facilities) {
+            if (monochromatic && !seenSelf && f == c) {
+                seenSelf = true;
+                continue;
+            }
+            radius = min(radius, (c[0] - f[0]) * (c[0] - f[0]) + (c[1] - f[1]) * (c[1] - f[1]));
+        }
+        radii.push_back(radius);
+    }
+    return radii;
+}
+
+// Reverse nearest neighbours, bichromatic and monochromatic: query time, the
+// cost of inserting and removing a facility, and a check of every query
+// against brute-force radii before and after those updates. scan_us is a
+// linear scan that is handed those radii for free.
+static int benchReverse(int argc, char** argv) {
+    int clientCount = (int)option(argc, argv, "--clients", 10000);
+    int facilityCount = (int)option(argc, argv, "--facilities", 500);
+    int queries = (int)option(argc, argv, "--queries", 100);
+    int updates = (int)option(argc, argv, "--updates", 100);
+
+    printf("reverse nearest neighbour: %d clients, %d facilities, %d queries, %d updates\n", clientCount, facilityCount,
+           queries, updates);
+    for (int mono = 0; mono < 2; ++mono) {
+        mt19937 rng(42);
+        vector<vector<double>> clients, facilities;
+        for (int i = 0; i < clientCount; ++i) clients.push_back(randomPoint(rng));
+        if (!mono) {
+            for (int i = 0; i < facilityCount; ++i) facilities.push_back(randomPoint(rng));
+        }
+        vector<vector<double>>& sites = mono ? clients : facilities;
+
+        auto start = Clock::now();
+        RNNIndex* index = mono ? buildMonochromaticRNN(clients) : buildBichromaticRNN(clients, facilities);
+        double buildMs = chrono::duration<double, milli>(Clock::now() - start).count();
+
+        for (int pass = 0; pass < 2; ++pass) {
+            double updateUs = 0;
+            if (pass == 1) {
+                start = Clock::now();
+                for (int i = 0; i < updates; ++i) {
+                    vector<double> added = randomPoint(rng);
+                    insertFacility(index, added);
+                    sites.push_back(added);
+                    size_t victim = rng() % sites.size();
+                    removeFacility(index, sites[victim]);
+                    sites.erase(sites.begin() + victim);
+                }
+                updateUs = chrono::duration<double, micro>(Clock::now() - start).count() / (2 * updates);
+            }
+
+            vector<double> radii = bruteRadii(clients, mono ? clients : facilities, mono);
+            double treeUs = 0, scanUs = 0;
+            size_t found = 0;
+            int mismatches = 0;
+            for (int i = 0; i < queries; ++i) {
+                vector<double> q = sites[rng() % sites.size()];
+                vector<vector<double>> result;
+                start = Clock::now();
+                reverseNearest(index, q, result);
+                treeUs += chrono::duration<double, micro>(Clock::now() - start).count();
+                start = Clock::now();
+                size_t expected = 0;
+                for (size_t c = 0; c < clients.size(); ++c) {
+                    double dx = clients[c][0] - q[0], dy = clients[c][1] - q[1];
+                    double d = dx * dx + dy * dy;
+                    if (d <= radii[c] && !(mono && d == 0)) expected++;
+                }
+                scanUs += chrono::duration<double, micro>(Clock::now() - start).count();
+                found += result.size();
+                if (result.size() != expected) mismatches++;
+            }
+            printf("%-13s %-13s build_ms=%-8.2f update_us=%-8.2f query_us=%-9.2f scan_us=%-9.2f mean_rnn=%-6.2f mismatches=%d\n",
+                   mono ? "monochromatic" : "bichromatic", pass ? "after-updates" : "initial", buildMs, updateUs,
+                   treeUs / queries, scanUs / queries, (double)found / queries, mismatches);
+        }
+        deleteTree(index);
+    }
+    return 0;
+}
+
+// Startup from a snapshot against rebuilding both trees from the points, and
+// flat-tree queries on the mapping against the pointer trees.
+static int benchSnapshot(int argc, char** argv) {
+    int points = (int)option(argc, argv, "--points", 1000000);
+    int categoryCount = (int)option(argc, argv, "--categories", 4);
+    int queries = (int)option(argc, argv, "--queries", 100000);
+    const char* path = "benchmark.snap";
+
+    mt19937 rng(42);
+    vector<vector<pair<int, int>>> catPoints(categoryCount);
+    vector<vector<uint32_t>> catAttrs(categoryCount);
+    for (int i = 0; i < points; ++i) {
+        vector<double> p = randomPoint(rng);
+        catPoints[i % categoryCount].push_back({ (int)p[0], (int)p[1] });
+        catAttrs[i % categoryCount].push_back(rng() & 7);
+    }
+
+    auto start = Clock::now();
+    vector<KDNode*> kdRoots(categoryCount, nullptr);
+    vector<QuadNode*> quadRoots(categoryCount);
+    for (int c = 0; c < categoryCount; ++c) {
+        quadRoots[c] = new QuadNode(0, MAP_W, 0, MAP_H, 4);
+        for (size_t i = 0; i < catPoints[c].size(); ++i) {
+            vector<double> p = { (double)catPoints[c][i].first, (double)catPoints[c][i].second };
+            kdRoots[c] = insert(kdRoots[c], p, 0, catAttrs[c][i]);
+            insert(quadRoots[c], p, catAttrs[c][i]);
+        }
+    }
+    double rebuildMs = chrono::duration<double, milli>(Clock::now() - start).count();
+
+    vector<SnapshotSource> sources;
+    for (int c = 0; c < categoryCount; ++c) {
+        SnapshotSource src;
+        src.name = "category" + to_string(c);
+        memset(src.color, 255, sizeof(src.color));
+        src.points = &catPoints[c];
+        src.attrs = &catAttrs[c];
+        src.kdRoot = kdRoots[c];
+        src.quadRoot = quadRoots[c];
+        src.width = MAP_W;
+        src.height = MAP_H;
+        sources.push_back(src);
+    }
+
+    string error;
+    start = Clock::now();
+    if (!writeSnapshot(path, sources, error)) {
+        printf("write failed: %s\n", error.c_str());
+        return 1;
+    }
+    double writeMs = chrono::duration<double, milli>(Clock::now() - start).count();
+
+    start = Clock::now();
+    MappedSnapshot* fast = openSnapshot(path, false, error);
+    double openMs = chrono::duration<double, milli>(Clock::now() - start).count();
+    start = Clock::now();
+    MappedSnapshot* checked = openSnapshot(path, true, error);
+    double checkedMs = chrono::duration<double, milli>(Clock::now() - start).count();
+    if (!fast || !checked) {
+        printf("open failed: %s\n", error.c_str());
+        return 1;
+    }
+
+    printf("snapshot: %d points in %d categories, file %.1f MB\n", points, categoryCount, fast->size / 1048576.0);
+    printf("rebuild_ms=%.2f write_ms=%.2f open_ms=%.3f open_checked_ms=%.2f\n", rebuildMs, writeMs, openMs, checkedMs);
+
+    vector<vector<double>> qs;
+    vector<uint32_t> masks;
+    for (int i = 0; i < queries; ++i) {
+        qs.push_back(randomPoint(rng));
+        masks.push_back(i % 2 ? rng() & 3 : 0);
+    }
+
+    for (int kind = 0; kind < 2; ++kind) {
+        double pointerUs = 0, flatUs = 0;
+        int mismatches = 0;
+        for (int i = 0; i < queries; ++i) {
+            int c = i % categoryCount;
+            double pointerDist = -1, flatDist = -1;
+            vector<double>& q = qs[i];
+            if (kind == 0) {
+                start = Clock::now();
+                KDNode* a = findNearest(kdRoots[c], q, pointerDist, 0.0, masks[i]);
+                pointerUs += chrono::duration<double, micro>(Clock::now() - start).count();
+                start = Clock::now();
+                const FlatKDNode* b = findNearest(fast->kdTree(c), q, flatDist, masks[i]);
+                flatUs += chrono::duration<double, micro>(Clock::now() - start).count();
+                if (!a != !b || (a && pointerDist != flatDist)) mismatches++;
+            } else {
+                start = Clock::now();
+                vector<double> a = findNearest(quadRoots[c], q, pointerDist, 0.0, masks[i]);
+                pointerUs += chrono::duration<double, micro>(Clock::now() - start).count();
+                start = Clock::now();
+                vector<double> b = findNearest(fast->quadTree(c), q, flatDist, masks[i]);
+                flatUs += chrono::duration<double, micro>(Clock::now() - start).count();
+                if (a.empty() != b.empty() || (!a.empty() && pointerDist != flatDist)) mismatches++;
+            }
+        }
+        printf("%-9s pointer_us=%-8.3f mapped_us=%-8.3f mismatches=%d\n", kind ? "quadtree" : "kd-tree",
+               pointerUs / queries, flatUs / queries, mismatches);
+    }
+
+    closeSnapshot(fast);
+    closeSnapshot(checked);
+    remove(path);
+    for (int c = 0; c < categoryCount; ++c) {
+        deleteTree(kdRoots[c]);
+        deleteTree(quadRoots[c]);
+    }
+    return 0;
+}
+
+// Parses a generated CSV file and its binary equivalent with loadPoints on
+// one thread and on every thread, against an ifstream reader, then compares
+// the bulk K-D build with inserting the same points one at a time.
+static int benchIngest(int argc, char** argv) {
+    int points = (int)option(argc, argv, "--points", 2000000);
+    int threads = (int)option(argc, argv, "--threads", 0);
+    int queries = (int)option(argc, argv, "--queries", 100000);
+    const char* csvPath = "benchmark_points.csv";
+    const char* binPath = "benchmark_points.bin";
+
+    mt19937 rng(42);
+    uniform_real_distribution<double> ux(0, MAP_W), uy(0, MAP_H);
+    vector<KDTree2D::Point> expected(points);
+    vector<uint32_t> expectedAttrs(points);
+    FILE* csv = fopen(csvPath, "w");
+    FILE* bin = fopen(binPath, "wb");
+    if (!csv || !bin) {
+        printf("cannot write test files\n");
+        return 1;
+    }
+    fprintf(csv, "x,y,attrs\n");
+    for (int i = 0; i < points; ++i) {
+        char line[64];
+        snprintf(line, sizeof(line), "%.4f,%.4f,%u\n", ux(rng), uy(rng), (unsigned)(rng() & 7));
+        fputs(line, csv);
+        sscanf(line, "%lf,%lf,%u", &expected[i][0], &expected[i][1], &expectedAttrs[i]);
+        fwrite(expected[i].data(), sizeof(double), 2, bin);
+    }
+    fclose(csv);
+    fclose(bin);
+
+    printf("ingest: %d points\n", points);
+
+    auto start = Clock::now();
+    vector<KDTree2D::Point> streamed;
+    {
+        ifstream in(csvPath);
+        string header;
+        getline(in, header);
+        double x, y;
+        unsigned attrs;
+        char sep;
+        while (in >> x >> sep >> y >> sep >> attrs) streamed.push_back(KDTree2D::Point{ x, y });
+    }
+    double streamSeconds = chrono::duration<double>(Clock::now() - start).count();
+    printf("%-14s %-8s MB/s=%-9.1f points/s=%-12.0f\n", "ifstream", "text",
+           ifstream(csvPath, ios::binary | ios::ate).tellg() / 1048576.0 / streamSeconds, streamed.size() / streamSeconds);
+
+    IngestResult loaded;
+    const char* paths[] = { csvPath, binPath };
+    for (int f = 0; f < 2; ++f) {
+        for (int t : { 1, threads > 0 ? threads : (int)thread::hardware_concurrency() }) {
+            IngestOptions options;
+            options.threads = t;
+            string error;
+            if (!loadPoints(paths[f], options, loaded, error)) {
+                printf("load failed: %s\n", error.c_str());
+                return 1;
+            }
+            int mismatches = loaded.points.size() == expected.size() ? 0 : 1;
+            for (size_t i = 0; !mismatches && i < expected.size(); ++i) {
+                if (loaded.points[i] != expected[i] || (f == 0 && loaded.attrs[i] != expectedAttrs[i])) mismatches++;
+            }
+            printf("loadPoints     %-8s threads=%-3d MB/s=%-9.1f points/s=%-12.0f skipped=%llu mismatches=%d\n",
+                   f ? "binary" : "text", t, loaded.megabytesPerSecond(), loaded.pointsPerSecond(),
+                   (unsigned long long)loaded.skippedLines, mismatches);
+        }
+    }
+    remove(csvPath);
+    remove(binPath);
+
+    start = Clock::now();
+    KDNode* built = KDTree2D::build(loaded.points.data(), expectedAttrs.data(), loaded.points.size());
+    double buildMs = chrono::duration<double, milli>(Clock::now() - start).count();
+    start = Clock::now();
+    KDNode* inserted = nullptr;
+    for (size_t i = 0; i < loaded.points.size(); ++i) {
+        inserted = KDTree2D::insert(inserted, loaded.points[i], 0, expectedAttrs[i]);
+    }
+    double insertMs = chrono::duration<double, milli>(Clock::now() - start).count();
+
+    double builtUs = 0, insertedUs = 0;
+    int mismatches = 0;
+    for (int i = 0; i < queries; ++i) {
+        vector<double> q = randomPoint(rng);
+        uint32_t mask = i % 2 ? rng() & 3 : 0;
+        double a, b;
+        start = Clock::now();
+        findNearest(built, q, a, 0.0, mask);
+        builtUs += chrono::duration<double, micro>(Clock::now() - start).count();
+        start = Clock::now();
+        findNearest(inserted, q, b, 0.0, mask);
+        insertedUs += chrono::duration<double, micro>(Clock::now() - start).count();
+        if (a != b) mismatches++;
+    }
+    printf("kd-tree bulk_build_ms=%-9.2f insert_build_ms=%-9.2f bulk_query_us=%-7.3f insert_query_us=%-7.3f mismatches=%d\n",
+           buildMs, insertMs, builtUs / queries, insertedUs / queries, mismatches);
+
+    deleteTree(built);
+    deleteTree(inserted);
+    return 0;
+}
+
+// Cost of making one edit durable: group-committed log appends, an fsync per
+// append, and rewriting a snapshot of --points points per edit. Then replays
+// the log, including after a torn final record and after a rebase cut short
+// once its snapshot was published.
+static int benchWal(int argc, char** argv) {
+    int records = (int)option(argc, argv, "--records", 20000);
+    int points = (int)option(argc, argv, "--points", 100000);
+    unsigned windowUs = (unsigned)option(argc, argv, "--window-us", 2000);
+    const char* logPath = "benchmark.log";
+    const char* snapPath = "benchmark.snap";
+
+    mt19937 rng(42);
+    vector<LogEntry> entries;
+    for (int i = 0; i < records; ++i) {
+        vector<double> p = randomPoint(rng);
+        entries.push_back(LogEntry{ i % 4 ? LOG_INSERT : LOG_REMOVE, (int)(rng() % 8), (int)p[0], (int)p[1],
+                                    (uint32_t)(rng() & 7), (uint32_t)(rng() % 1000), "" });
+    }
+
+    printf("wal: %d records, group window %u us\n", records, windowUs);
+    for (int grouped = 1; grouped >= 0; --grouped) {
+        remove(logPath);
+        vector<LogEntry> replay;
+        string error;
+        MutationLog* log = openMutationLog(logPath, 1, replay, error, grouped ? windowUs : 0);
+        if (!log) {
+            printf("open failed: %s\n", error.c_str());
+            return 1;
+        }
+        int count = grouped ? records : min(records, 2000);
+        double appendUs = 0;
+        auto start = Clock::now();
+        for (int i = 0; i < count; ++i) {
+            auto t = Clock::now();
+            appendLog(log, entries[i]);
+            appendUs += chrono::duration<double, micro>(Clock::now() - t).count();
+            if (!grouped) syncLog(log);
+        }
+        bool ok = syncLog(log);
+        double totalUs = chrono::duration<double, micro>(Clock::now() - start).count();
+        closeMutationLog(log);
+        printf("%-14s append_us=%-8.3f durable_us_per_record=%-9.2f records/s=%-10.0f ok=%d\n",
+               grouped ? "group-commit" : "fsync-each", appendUs / count, totalUs / count, count / (totalUs / 1e6), ok);
+    }
+
+    vector<LogEntry> replay;
+    string error;
+    auto start = Clock::now();
+    MutationLog* log = openMutationLog(logPath, 1, replay, error);
+    double replayMs = chrono::duration<double, milli>(Clock::now() - start).count();
+    closeMutationLog(log);
+    int mismatches = replay.size() == (size_t)min(records, 2000) ? 0 : 1;
+    for (size_t i = 0; !mismatches && i < replay.size(); ++i) {
+        const LogEntry& a = replay[i];
+        const LogEntry& b = entries[i];
+        if (a.op != b.op || a.category != b.category || a.x != b.x || a.y != b.y || a.attrs != b.attrs ||
+            a.index != b.index) {
+            mismatches++;
+        }
+    }
+
+    // Cut the last record short, as a crash mid-write would.
+    FILE* f = fopen(logPath, "rb");
+    vector<char> bytes;
+    int c;
+    while ((c = fgetc(f)) != EOF) bytes.push_back((char)c);
+    fclose(f);
+    f = fopen(logPath, "wb");
+    fwrite(bytes.data(), 1, bytes.size() - 5, f);
+    fclose(f);
+    vector<LogEntry> torn;
+    log = openMutationLog(logPath, 1, torn, error);
+    closeMutationLog(log);
+    vector<LogEntry> stale;
+    log = openMutationLog(logPath, 2, stale, error);
+    closeMutationLog(log);
+    remove(logPath);
+    printf("replay         records=%zu replay_ms=%.2f after_torn_write=%zu other_snapshot=%zu mismatches=%d\n",
+           replay.size(), replayMs, torn.size(), stale.size(), mismatches);
+
+    // Rebase onto snapshot 2 taken halfway, then replay the files as a crash
+    // just after the snapshot was published would have left them.
+    auto readBytes = [](const string& path) {
+        vector<char> data;
+        FILE* in = fopen(path.c_str(), "rb");
+        int ch;
+        while (in && (ch = fgetc(in)) != EOF) data.push_back((char)ch);
+        if (in) fclose(in);
+        return data;
+    };
+    auto writeBytes = [](const string& path, const vector<char>& data) {
+        FILE* out = fopen(path.c_str(), "wb");
+        fwrite(data.data(), 1, data.size(), out);
+        fclose(out);
+    };
+    int count = min(records, 2000);
+    vector<LogEntry> none;
+    log = openMutationLog(logPath, 1, none, error);
+    uint64_t mark = 0;
+    for (int i = 0; i < count; ++i) {
+        if (i == count / 2) mark = logMark(log);
+        appendLog(log, entries[i]);
+    }
+    string nextPath = string(logPath) + LOG_NEXT_SUFFIX;
+    vector<char> oldLog, nextLog;
+    bool rebased = rebaseLog(log, 2, mark, [&](string&) {
+        oldLog = readBytes(logPath);
+        nextLog = readBytes(nextPath);
+        return true;
+    }, error);
+    closeMutationLog(log);
+    vector<LogEntry> kept;
+    log = openMutationLog(logPath, 2, kept, error);
+    closeMutationLog(log);
+    writeBytes(logPath, oldLog);
+    writeBytes(nextPath, nextLog);
+    vector<LogEntry> recovered;
+    log = openMutationLog(logPath, 2, recovered, error);
+    closeMutationLog(log);
+    remove(logPath);
+    printf("rebase         ok=%d kept=%zu after_crash=%zu expected=%d\n", rebased, kept.size(), recovered.size(),
+           count - count / 2);
+
+    vector<pair<int, int>> pts;
+    vector<uint32_t> attrs;
+    for (int i = 0; i < points; ++i) {
+        vector<double> p = randomPoint(rng);
+        pts.push_back({ (int)p[0], (int)p[1] });
+        attrs.push_back(rng() & 7);
+    }
+    KDNode* kdRoot = nullptr;
+    QuadNode* quadRoot = new QuadNode(0, MAP_W, 0, MAP_H, 4);
+    for (size_t i = 0; i < pts.size(); ++i) {
+        vector<double> p = { (double)pts[i].first, (double)pts[i].second };
+        kdRoot = insert(kdRoot, p, 0, attrs[i]);
+        insert(quadRoot, p, attrs[i]);
+    }
+    SnapshotSource src;
+    src.name = "bench";
+    memset(src.color, 255, sizeof(src.color));
+    src.points = &pts;
+    src.attrs = &attrs;
+    src.kdRoot = kdRoot;
+    src.quadRoot = quadRoot;
+    src.width = MAP_W;
+    src.height = MAP_H;
+    int writes = 5;
+    start = Clock::now();
+    for (int i = 0; i < writes; ++i) writeSnapshot(snapPath, { src }, error);
+    double snapshotUs = chrono::duration<double, micro>(Clock::now() - start).count() / writes;
+    remove(snapPath);
+    printf("snapshot-each  points=%d durable_us_per_record=%.2f\n", points, snapshotUs);
+
+    deleteTree(kdRoot);
+    deleteTree(quadRoot);
+    return 0;
+}
+
+// The categories of a snapshot rebuilt as the application holds them, for
+// replaying a trace in each SearchMode.
+struct ReplayData {
+    vector<vector<pair<int, int>>> points;
+    vector<vector<uint32_t>> attrs;
+    vector<KDNode*> kdRoots;
+    vector<QuadNode*> quadRoots;
+};
+
+static bool loadReplayData(const string& path, ReplayData& data, uint64_t& checksum, string& error) {
+    MappedSnapshot* snap = openSnapshot(path, true, error);
+    if (!snap) return false;
+    checksum = snap->header()->checksum;
+    for (uint32_t c = 0; c < snap->categoryCount(); ++c) {
+        const SnapshotCategory& rec = snap->category(c);
+        vector<pair<int, int>> pts(rec.pointCount);
+        vector<KDTree2D::Point> coords(rec.pointCount);
+        for (uint64_t i = 0; i < rec.pointCount; ++i) {
+            pts[i] = { snap->points(c)[i].x, snap->points(c)[i].y };
+            coords[i] = KDTree2D::Point{ (double)pts[i].first, (double)pts[i].second };
+        }
+        vector<uint32_t> attrs(snap->attrs(c), snap->attrs(c) + rec.pointCount);
+
+        FlatQuadTree flat = snap->quadTree(c);
+        QuadNode* quadRoot = flat.count > 0
+            ? new QuadNode(flat.nodes[0].x_min, flat.nodes[0].x_max, flat.nodes[0].y_min, flat.nodes[0].y_max, 4)
+            : new QuadNode(0, MAP_W, 0, MAP_H, 4);
+        for (size_t i = 0; i < coords.size(); ++i) {
+            quadRoot = insert(quadRoot, { coords[i][0], coords[i][1] }, attrs[i]);
+        }
+        data.kdRoots.push_back(KDTree2D::build(coords.data(), attrs.data(), coords.size()));
+        data.quadRoots.push_back(quadRoot);
+        data.points.push_back(move(pts));
+        data.attrs.push_back(move(attrs));
+    }
+    closeSnapshot(snap);
+    return true;
+}
+
+static void freeReplayData(ReplayData& data) {
+    for (KDNode* root : data.kdRoots) deleteTree(root);
+    for (QuadNode* root : data.quadRoots) deleteTree(root);
+}
+
+// One search as handleInput runs it in the given SearchMode.
+static bool replayQuery(const ReplayData& data, const TraceQuery& q, int mode) {
+    vector<double> target = { (double)q.x, (double)q.y };
+    double bestDist;
+    if (mode == 1) return findNearest(data.kdRoots[q.category], target, bestDist, 0.0, q.mask) != nullptr;
+    if (mode == 2) return !findNearest(data.quadRoots[q.category], target, bestDist, 0.0, q.mask).empty();
+
+    const vector<pair<int, int>>& pts = data.points[q.category];
+    const vector<uint32_t>& attrs = data.attrs[q.category];
+    double best = 1e12;
+    int bi = -1;
+    for (size_t i = 0; i < pts.size(); ++i) {
+        if ((attrs[i] & q.mask) != q.mask) continue;
+        double dx = pts[i].first - q.x, dy = pts[i].second - q.y;
+        double d = dx * dx + dy * dy;
+        if (d < best) { best = d; bi = (int)i; }
+    }
+    return bi != -1;
+}
+
+// Percentiles, then one row per power-of-two latency bucket.
+static void printLatencies(vector<double>& ns) {
+    sort(ns.begin(), ns.end());
+    auto at = [&](double p) { return ns[min(ns.size() - 1, (size_t)(p * ns.size()))] / 1000.0; };
+    printf("    p50_us=%-8.2f p90_us=%-8.2f p99_us=%-8.2f p99.9_us=%-8.2f max_us=%.2f\n", at(0.5), at(0.9), at(0.99),
+           at(0.999), ns.back() / 1000.0);
+
+    vector<size_t> buckets(64, 0);
+    for (double v : ns) buckets[v < 1 ? 0 : (int)log2(v)]++;
+    size_t peak = *max_element(buckets.begin(), buckets.end());
+    for (int b = 0; b < 64; ++b) {
+        if (!buckets[b]) continue;
+        printf("    [%10.3f us, %10.3f us) %9zu %s\n", ldexp(1.0, b) / 1000.0, ldexp(1.0, b + 1) / 1000.0, buckets[b],
+               string((size_t)ceil(40.0 * buckets[b] / peak), '#').c_str());
+    }
+}
+
+// Writes a snapshot of uniform points and a trace of queries clustered around
+// a few hotspots, for running replay without a recording.
+static bool writeSyntheticTrace(const string& snapPath, const string& tracePath, int points, int queries, string& error) {
+    mt19937 rng(42);
+    const int categories = 4;
+    vector<vector<pair<int, int>>> pts(categories);
+    vector<vector<uint32_t>> attrs(categories);
+    for (int i = 0; i < points; ++i) {
+        vector<double> p = randomPoint(rng);
+        pts[i % categories].push_back({ (int)p[0], (int)p[1] });
+        attrs[i % categories].push_back(rng() & 7);
+    }
+    vector<SnapshotSource> sources;
+    for (int c = 0; c < categories; ++c) {
+        SnapshotSource src;
+        src.name = "category" + to_string(c);
+        memset(src.color, 255, sizeof(src.color));
+        src.points = &pts[c];
+        src.attrs = &attrs[c];
+        src.kdRoot = nullptr;
+        src.quadRoot = nullptr;
+        src.width = MAP_W;
+        src.height = MAP_H;
+        sources.push_back(src);
+    }
+    uint64_t checksum;
+    if (!writeSnapshot(snapPath, sources, error, &checksum)) return false;
+
+    TraceRecorder* recorder = startTrace(tracePath, checksum, error);
+    if (!recorder) return false;
+    vector<vector<double>> hotspots;
+    for (int h = 0; h < 8; ++h) hotspots.push_back(randomPoint(rng));
+    normal_distribution<double> spread(0, 20);
+    for (int i = 0; i < queries; ++i) {
+        const vector<double>& h = hotspots[min(rng() % 8, rng() % 8)]; // skewed towards the first hotspots
+        int x = (int)min(MAP_W - 1, max(0.0, h[0] + spread(rng)));
+        int y = (int)min(MAP_H - 1, max(0.0, h[1] + spread(rng)));
+        recordQuery(recorder, (int)(rng() % categories), x, y, 1, i % 4 ? 0 : rng() & 3);
+    }
+    return stopTrace(recorder);
+}
+
+// Replays a recorded trace against every SearchMode on one thread and on
+// --threads threads. With --speed S > 0 queries are issued at S times their
+// recorded pace and latency includes any delay behind that schedule.
+static int benchReplay(int argc, char** argv) {
+    string tracePath = stringOption(argc, argv, "--trace", "");
+    string snapPath = stringOption(argc, argv, "--snapshot", "queries.snap");
+    int threads = (int)option(argc, argv, "--threads", 0);
+    double speed = option(argc, argv, "--speed", 0);
+    if (threads <= 0) threads = max(1, (int)thread::hardware_concurrency());
+
+    string error;
+    bool synthetic = tracePath.empty();
+    if (synthetic) {
+        tracePath = "benchmark.trace";
+        snapPath = "benchmark.snap";
+        if (!writeSyntheticTrace(snapPath, tracePath, (int)option(argc, argv, "--points", 200000),
+                                 (int)option(argc, argv, "--queries", 20000), error)) {
+            printf("cannot write synthetic trace: %s\n", error.c_str());
+            return 1;
+        }
+    }
+
+    vector<TraceQuery> trace;
+    uint64_t traceChecksum, snapChecksum;
+    ReplayData data;
+    if (!loadTrace(tracePath, trace, traceChecksum, error) || !loadReplayData(snapPath, data, snapChecksum, error)) {
+        printf("%s\n", error.c_str());
+        return 1;
+    }
+    if (synthetic) {
+        remove(tracePath.c_str());
+        remove(snapPath.c_str());
+        // Recorded in a tight loop; space the queries out at --rate per second.
+        double rate = option(argc, argv, "--rate", 20000);
+        for (size_t i = 0; i < trace.size(); ++i) trace[i].timestampUs = (uint64_t)(i * 1e6 / rate);
+    }
+    size_t dropped = trace.size();
+    trace.erase(remove_if(trace.begin(), trace.end(),
+                          [&](const TraceQuery& q) { return q.category < 0 || q.category >= (int)data.kdRoots.size(); }),
+                trace.end());
+    dropped -= trace.size();
+    if (trace.empty()) {
+        printf("no replayable queries in %s\n", tracePath.c_str());
+        return 1;
+    }
+
+    printf("replay: %zu queries over %zu categories from %s%s", trace.size(), data.kdRoots.size(),
+           synthetic ? "a synthetic hotspot trace" : tracePath.c_str(),
+           traceChecksum == snapChecksum ? "" : " (WARNING: recorded against a different snapshot)");
+    if (dropped) printf(", %zu with unknown categories skipped", dropped);
+    printf("\n");
+
+    const char* modeNames[] = { "linear", "kd-tree", "quadtree" };
+    vector<int> threadCounts = { 1 };
+    if (threads > 1) threadCounts.push_back(threads);
+    for (int mode = 0; mode < 3; ++mode) {
+        for (int t : threadCounts) {
+            vector<vector<double>> latencies(t);
+            atomic<size_t> next(0);
+            atomic<size_t> found(0);
+            auto start = Clock::now();
+            auto worker = [&](int id) {
+                size_t hits = 0;
+                for (size_t i = next++; i < trace.size(); i = next++) {
+                    Clock::time_point issued = Clock::now();
+                    if (speed > 0) {
+                        issued = start + chrono::duration_cast<Clock::duration>(
+                                             chrono::duration<double, micro>(trace[i].timestampUs / speed));
+                        // Sleep most of the wait and spin the rest; sleep alone overshoots
+                        // by tens of microseconds.
+                        this_thread::sleep_until(issued - chrono::microseconds(200));
+                        while (Clock::now() < issued) {}
+                    }
+                    hits += replayQuery(data, trace[i], mode);
+                    latencies[id].push_back(chrono::duration<double, nano>(Clock::now() - issued).count());
+                }
+                found += hits;
+            };
+            vector<thread> pool;
+            for (int id = 1; id < t; ++id) pool.emplace_back(worker, id);
+            worker(0);
+            for (auto& th : pool) th.join();
+            double seconds = chrono::duration<double>(Clock::now() - start).count();
+
+            vector<double> all;
+            for (auto& l : latencies) all.insert(all.end(), l.begin(), l.end());
+            printf("%-9s threads=%-3d queries/s=%-10.0f found=%zu\n", modeNames[mode], t, trace.size() / seconds,
+                   found.load());
+            printLatencies(all);
+        }
+    }
+    freeReplayData(data);
+    return 0;
+}
+
+static int kdDepth(const KDNode* node) {
+    return node ? 1 + max(kdDepth(node->left), kdDepth(node->right)) : 0;
+}
+
+static int quadDepth(const QuadNode* node) {
+    if (!node || !node->divided) return node ? 1 : 0;
+    return 1 + max(max(quadDepth(node->nw), quadDepth(node->ne)), max(quadDepth(node->sw), quadDepth(node->se)));
+}
+
+struct WorkloadRun {
+    double insertMs, bulkMs, quadMs, kdUs, bulkUs, quadUs;
+    int kdDepth, bulkDepth, quadDepth, mismatches;
+};
+
+// Builds all three trees from the points in the given order and queries them
+// with points drawn from the same distribution.
+static WorkloadRun runWorkload(const vector<KDTree2D::Point>& pts, const vector<KDTree2D::Point>& qs) {
+    WorkloadRun run;
+    auto start = Clock::now();
+    KDNode* kdRoot = nullptr;
+    for (const auto& p : pts) kdRoot = KDTree2D::insert(kdRoot, p);
+    run.insertMs = chrono::duration<double, milli>(Clock::now() - start).count();
+
+    start = Clock::now();
+    KDNode* bulkRoot = KDTree2D::build(pts.data(), nullptr, pts.size());
+    run.bulkMs = chrono::duration<double, milli>(Clock::now() - start).count();
+
+    start = Clock::now();
+    QuadNode* quadRoot = new QuadNode(0, MAP_W, 0, MAP_H, 4);
+    for (const auto& p : pts) quadRoot = insert(quadRoot, { p[0], p[1] });
+    run.quadMs = chrono::duration<double, milli>(Clock::now() - start).count();
+
+    run.kdUs = run.bulkUs = run.quadUs = 0;
+    run.mismatches = 0;
+    for (const auto& p : qs) {
+        vector<double> q = { p[0], p[1] };
+        double a, b, c;
+        start = Clock::now();
+        findNearest(kdRoot, q, a);
+        run.kdUs += chrono::duration<double, micro>(Clock::now() - start).count();
+        start = Clock::now();
+        findNearest(bulkRoot, q, b);
+        run.bulkUs += chrono::duration<double, micro>(Clock::now() - start).count();
+        start = Clock::now();
+        findNearest(quadRoot, q, c);
+        run.quadUs += chrono::duration<double, micro>(Clock::now() - start).count();
+        if (a != b || a != c) run.mismatches++;
+    }
+    run.kdUs /= qs.size();
+    run.bulkUs /= qs.size();
+    run.quadUs /= qs.size();
+    run.kdDepth = kdDepth(kdRoot);
+    run.bulkDepth = kdDepth(bulkRoot);
+    run.quadDepth = quadDepth(quadRoot);
+
+    deleteTree(kdRoot);
+    deleteTree(bulkRoot);
+    deleteTree(quadRoot);
+    return run;
+}
+
+static void printWorkload(const char* name, const char* order, const WorkloadRun& r) {
+    printf("%-10s %-14s kd_insert_ms=%-8.1f kd_bulk_ms=%-7.1f quad_ms=%-8.1f depth kd=%-5d bulk=%-3d quad=%-4d "
+           "query_us kd=%-7.2f bulk=%-7.2f quad=%-7.2f mismatches=%d\n",
+           name, order, r.insertMs, r.bulkMs, r.quadMs, r.kdDepth, r.bulkDepth, r.quadDepth, r.kdUs, r.bulkUs, r.quadUs,
+           r.mismatches);
+}
+
+static size_t kdSize(const KDNode* node) {
+    return node ? 1 + kdSize(node->left) + kdSize(node->right) : 0;
+}
+
+// However many keys tie, the bulk build must stay within 2 log2(n) levels
+// and shuffled incremental inserts, which split ties at random, within
+// 4 log2(n); every point must still be found and removed afterwards. Returns
+// false if any input fails.
+static bool checkTies(int points, uint64_t seed) {
+    vector<pair<string, vector<KDTree2D::Point>>> inputs;
+    inputs.push_back({ "Identical", vector<KDTree2D::Point>(points, KDTree2D::Point{ 7, 7 }) });
+    vector<KDTree2D::Point> column(points);
+    for (int i = 0; i < points; ++i) column[i] = KDTree2D::Point{ 5, (double)(i % 3) };
+    inputs.push_back({ "Column", column });
+    for (Distribution d : { DIST_CLUSTERS, DIST_HOTSPOTS, DIST_GRID, DIST_DUPLICATES }) {
+        WorkloadSpec spec;
+        spec.distribution = d;
+        spec.count = points;
+        spec.width = MAP_W;
+        spec.height = MAP_H;
+        spec.seed = seed;
+        inputs.push_back({ distributionName(d), generatePoints(spec) });
+    }
+
+    bool ok = true;
+    for (auto& input : inputs) {
+        vector<KDTree2D::Point>& pts = input.second;
+        KDNode* root = KDTree2D::build(pts.data(), nullptr, pts.size());
+        int height = kdDepth(root);
+        int limit = (int)ceil(2 * log2((double)pts.size()));
+
+        mt19937 rng(seed);
+        shuffle(pts.begin(), pts.end(), rng);
+        KDNode* inserted = nullptr;
+        for (const auto& p : pts) inserted = KDTree2D::insert(inserted, p);
+        int insertHeight = kdDepth(inserted);
+        deleteTree(inserted);
+
+        size_t half = pts.size() / 2;
+        for (size_t i = 0; i < half; ++i) root = KDTree2D::removeNode(root, pts[i]);
+        size_t left = kdSize(root);
+        for (size_t i = half; i < pts.size(); ++i) root = KDTree2D::removeNode(root, pts[i]);
+
+        bool passed = height <= limit && insertHeight <= 2 * limit && left == pts.size() - half && root == nullptr;
+        printf("ties %-10s bulk_height=%-4d insert_height=%-4d limit=%d/%-4d removals=%s %s\n", input.first.c_str(),
+               height, insertHeight, limit, 2 * limit, left == pts.size() - half && root == nullptr ? "ok" : "lost",
+               passed ? "ok" : "FAILED");
+        ok = ok && passed;
+        deleteTree(root);
+    }
+    return ok;
+}
+
+// Repeated points must stop splitting at MIN_CELL_SIZE, through both the
+// in-place and the copy-on-write updates, and every copy must still be
+// counted, found and removed one at a time. Returns false if any input fails.
+static bool checkQuadMinCell(int points, uint64_t seed) {
+    WorkloadSpec spec;
+    spec.distribution = DIST_DUPLICATES;
+    spec.count = points;
+    spec.width = MAP_W;
+    spec.height = MAP_H;
+    spec.seed = seed;
+    vector<pair<string, vector<KDTree2D::Point>>> inputs;
+    inputs.push_back({ "Identical", vector<KDTree2D::Point>(points, KDTree2D::Point{ 7, 7 }) });
+    inputs.push_back({ distributionName(DIST_DUPLICATES), generatePoints(spec) });
+    // Pairs that samePoint treats as one location, stored either side of the
+    // root's vertical split line.
+    vector<KDTree2D::Point> straddling(points);
+    for (int i = 0; i < points; ++i) straddling[i] = KDTree2D::Point{ MAP_W / 2 + (i % 2) * 1e-10, (double)(i / 2 % 16) };
+    inputs.push_back({ "Split line", straddling });
+    int limit = (int)ceil(log2(min(MAP_W, MAP_H) / MIN_CELL_SIZE)) + 1;
+
+    bool ok = true;
+    for (auto& input : inputs) {
+        const vector<KDTree2D::Point>& pts = input.second;
+        vector<KDTree2D::Point> sites = pts;
+        sort(sites.begin(), sites.end());
+        sites.erase(unique(sites.begin(), sites.end()), sites.end());
+
+        for (int copyOnWrite = 0; copyOnWrite < 2; ++copyOnWrite) {
+            QuadNode* root = new QuadNode(0, MAP_W, 0, MAP_H, 4);
+            for (const auto& p : pts) {
+                if (copyOnWrite) {
+                    vector<QuadNode*> replaced;
+                    root = insertCopyOnWrite(root, { p[0], p[1] }, replaced);
+                    for (QuadNode* node : replaced) delete node;
+                } else {
+                    root = insert(root, { p[0], p[1] });
+                }
+            }
+            int height = quadDepth(root);
+            int counted = root->count;
+
+            int lost = 0;
+            for (const auto& p : sites) {
+                vector<double> q = { p[0], p[1] };
+                double bestDist;
+                findNearest(root, q, bestDist);
+                if (bestDist != 0) lost++;
+            }
+            // Each removal must take exactly one copy, including points that
+            // lie on a split line and so inside two quadrants.
+            int expected = counted, miscounted = 0;
+            for (const auto& p : pts) {
+                vector<double> q = { p[0], p[1] };
+                if (copyOnWrite) {
+                    vector<QuadNode*> replaced;
+                    root = removeCopyOnWrite(root, q, replaced);
+                    for (QuadNode* node : replaced) delete node;
+                } else {
+                    root = removeNode(root, q);
+                }
+                if (root->count != --expected) miscounted++;
+            }
+            lost += miscounted;
+            bool passed = height <= limit && counted == (int)pts.size() && lost == 0 && root->count == 0;
+            printf("quad min cell %-10s %-13s height=%-4d limit=%-4d count=%-7d lost=%-4d left=%-5d %s\n",
+                   input.first.c_str(), copyOnWrite ? "copy-on-write" : "in place", height, limit, counted, lost,
+                   root->count, passed ? "ok" : "FAILED");
+            ok = ok && passed;
+            deleteTree(root);
+        }
+    }
+    return ok;
+}
+
+// Every generator in shuffled order, then every insertion order on a smaller
+// set, since sorted input makes incremental K-D insertion quadratic. Ends with
+// checkTies and checkQuadMinCell, and fails if either does.
+static int benchWorkloads(int argc, char** argv) {
+    int points = (int)option(argc, argv, "--points", 200000);
+    int orderedPoints = (int)option(argc, argv, "--sorted-points", 20000);
+    int queries = (int)option(argc, argv, "--queries", 10000);
+    uint64_t seed = (uint64_t)option(argc, argv, "--seed", 1);
+
+    printf("workloads: %d points, %d points per insertion order, %d queries, seed %llu\n", points, orderedPoints,
+           queries, (unsigned long long)seed);
+    for (int d = 0; d < DISTRIBUTION_COUNT; ++d) {
+        WorkloadSpec spec;
+        spec.distribution = (Distribution)d;
+        spec.count = points;
+        spec.width = MAP_W;
+        spec.height = MAP_H;
+        spec.seed = seed;
+        vector<KDTree2D::Point> pts = generatePoints(spec);
+        spec.count = queries;
+        spec.seed = seed + 1;
+        vector<KDTree2D::Point> qs = generatePoints(spec);
+        printWorkload(distributionName(spec.distribution), insertOrderName(ORDER_SHUFFLED), runWorkload(pts, qs));
+    }
+
+    for (Distribution d : { DIST_UNIFORM, DIST_ROADS }) {
+        for (int o = 0; o < INSERT_ORDER_COUNT; ++o) {
+            WorkloadSpec spec;
+            spec.distribution = d;
+            spec.order = (InsertOrder)o;
+            spec.count = orderedPoints;
+            spec.width = MAP_W;
+            spec.height = MAP_H;
+            spec.seed = seed;
+            vector<KDTree2D::Point> pts = generatePoints(spec);
+            spec.order = ORDER_SHUFFLED;
+            spec.count = queries;
+            spec.seed = seed + 1;
+            vector<KDTree2D::Point> qs = generatePoints(spec);
+            printWorkload(distributionName(d), insertOrderName(spec.order = (InsertOrder)o), runWorkload(pts, qs));
+        }
+    }
+    bool ok = checkTies(orderedPoints, seed);
+    ok = checkQuadMinCell(orderedPoints / 4, seed) && ok; // each copy-on-write insert copies the whole leaf
+    return ok ? 0 : 1;
+}
+
+static void printQueryStats(const char* name, const char* tree, double plainUs, double countedUs,
+                            const QueryStats& stats) {
+    double n = (double)max(stats.queries, (uint64_t)1);
+    printf("%-10s %-4s query_us=%-7.2f with_stats_us=%-7.2f nodes=%-8.1f leaves=%-7.1f dists=%-8.1f pruned=%-7.1f "
+           "backtracks=%-7.1f max_depth=%d\n",
+           name, tree, plainUs, countedUs, stats.nodesVisited / n, stats.leavesScanned / n, stats.distanceEvals / n,
+           stats.prunedSubtrees / n, stats.backtracks / n, stats.maxDepth);
+}
+
+// Per-query counters for each generator, and what collecting them costs.
+static int benchStats(int argc, char** argv) {
+    int points = (int)option(argc, argv, "--points", 100000);
+    int queries = (int)option(argc, argv, "--queries", 10000);
+    printf("stats: %d points, %d queries, counters %s\n", points, queries, QUERY_STATS ? "compiled in" : "compiled out");
+
+    for (int d = 0; d < DISTRIBUTION_COUNT; ++d) {
+        WorkloadSpec spec;
+        spec.distribution = (Distribution)d;
+        spec.count = points;
+        spec.width = MAP_W;
+        spec.height = MAP_H;
+        vector<KDTree2D::Point> pts = generatePoints(spec);
+        spec.count = queries;
+        spec.seed = 2;
+        vector<vector<double>> qs;
+        for (const auto& p : generatePoints(spec)) qs.push_back({ p[0], p[1] });
+
+        KDNode* kdRoot = KDTree2D::build(pts.data(), nullptr, pts.size());
+        QuadNode* quadRoot = new QuadNode(0, MAP_W, 0, MAP_H, 4);
+        for (const auto& p : pts) quadRoot = insert(quadRoot, { p[0], p[1] });
+
+        QueryStats kdStats, quadStats;
+        double bestDist, kdUs[2], quadUs[2];
+        for (int counted = 0; counted < 2; ++counted) {
+            auto start = Clock::now();
+            for (auto& q : qs) findNearest(kdRoot, q, bestDist, 0.0, 0, counted ? &kdStats : nullptr);
+            kdUs[counted] = chrono::duration<double, micro>(Clock::now() - start).count() / queries;
+            start = Clock::now();
+            for (auto& q : qs) findNearest(quadRoot, q, bestDist, 0.0, 0, counted ? &quadStats : nullptr);
+            quadUs[counted] = chrono::duration<double, micro>(Clock::now() - start).count() / queries;
+        }
+        printQueryStats(distributionName(spec.distribution), "kd", kdUs[0], kdUs[1], kdStats);
+        printQueryStats(distributionName(spec.distribution), "quad", quadUs[0], quadUs[1], quadStats);
+
+        // A traced search lists exactly the nodes its counters counted.
+        int traceMismatches = 0;
+        for (size_t i = 0; i < qs.size() && i < 1000; ++i) {
+            for (int tree = 0; tree < 2; ++tree) {
+                vector<TraceEvent> trace;
+                QueryStats stats;
+                stats.trace = &trace;
+                if (tree == 0) {
+                    findNearest(kdRoot, qs[i], bestDist, 0.0, 0, &stats);
+                } else {
+                    findNearest(quadRoot, qs[i], bestDist, 0.0, 0, &stats);
+                }
+                uint64_t visited = 0, pruned = 0;
+                for (const auto& event : trace) (event.outcome == TRACE_VISITED ? visited : pruned)++;
+                if (visited != stats.nodesVisited || pruned != stats.prunedSubtrees) traceMismatches++;
+            }
+        }
+        if (traceMismatches) printf("%-10s trace_mismatches=%d\n", distributionName(spec.distribution), traceMismatches);
+
+        deleteTree(kdRoot);
+        deleteTree(quadRoot);
+    }
+    return 0;
+}
+
+static void printShape(const char* name, const char* tree, const TreeShape& shape) {
+    printf("%-10s %-18s nodes=%-8zu height=%-6d balance=%-6.2f leaves=%-7zu empty=%-5.1f%% bytes/point=%-6.1f "
+           "node=%-8zu point=%-8zu slack=%zu\n",
+           name, tree, shape.nodes, shape.height, shape.balanceFactor(), shape.leaves, 100.0 * shape.emptyRatio(),
+           shape.points ? (double)shape.totalBytes() / shape.points : 0.0, shape.nodeBytes, shape.pointBytes,
+           shape.slackBytes);
+}
+
+// Shape of each tree per generator, then the two ways a tree decays: K-D
+// insertion in sorted order, and a quadtree after most points are removed.
+static int benchShape(int argc, char** argv) {
+    int points = (int)option(argc, argv, "--points", 100000);
+    int sortedPoints = (int)option(argc, argv, "--sorted-points", 20000);
+    printf("shape: %d points, %d sorted points\n", points, sortedPoints);
+
+    for (int d = 0; d < DISTRIBUTION_COUNT; ++d) {
+        WorkloadSpec spec;
+        spec.distribution = (Distribution)d;
+        spec.count = points;
+        spec.width = MAP_W;
+        spec.height = MAP_H;
+        vector<KDTree2D::Point> pts = generatePoints(spec);
+        const char* name = distributionName(spec.distribution);
+
+        KDNode* kdRoot = nullptr;
+        for (const auto& p : pts) kdRoot = KDTree2D::insert(kdRoot, p);
+        KDNode* bulkRoot = KDTree2D::build(pts.data(), nullptr, pts.size());
+        QuadNode* quadRoot = new QuadNode(0, MAP_W, 0, MAP_H, 4);
+        for (const auto& p : pts) quadRoot = insert(quadRoot, { p[0], p[1] });
+
+        printShape(name, "kd insert", measureTree(kdRoot));
+        printShape(name, "kd bulk", measureTree(bulkRoot));
+        printShape(name, "quad", measureTree(quadRoot));
+
+        deleteTree(kdRoot);
+        deleteTree(bulkRoot);
+        deleteTree(quadRoot);
+    }
+
+    WorkloadSpec spec;
+    spec.order = ORDER_SORTED;
+    spec.count = sortedPoints;
+    spec.width = MAP_W;
+    spec.height = MAP_H;
+    vector<KDTree2D::Point> sorted = generatePoints(spec);
+    KDNode* kdRoot = nullptr;
+    for (const auto& p : sorted) kdRoot = KDTree2D::insert(kdRoot, p);
+    printShape("Uniform", "kd sorted insert", measureTree(kdRoot));
+    deleteTree(kdRoot);
+
+    spec.order = ORDER_SHUFFLED;
+    spec.count = points;
+    vector<KDTree2D::Point> pts = generatePoints(spec);
+    QuadNode* quadRoot = new QuadNode(0, MAP_W, 0, MAP_H, 4);
+    for (const auto& p : pts) quadRoot = insert(quadRoot, { p[0], p[1] });
+    for (size_t i = 0; i < pts.size() * 9 / 10; ++i) {
+        vector<double> p = { pts[i][0], pts[i][1] };
+        quadRoot = removeNode(quadRoot, p);
+    }
+    TreeShape removed = measureTree(quadRoot);
+    printShape("Uniform", "quad 90% removed", removed);
+    printf("\n%s\n", describeShape(removed).c_str());
+    deleteTree(quadRoot);
+    return 0;
+}
+
+// Checks the bucket layout, times recording from several threads into one
+// histogram, and compares its percentiles with exact ones on real queries.
+static int benchLatency(int argc, char** argv) {
+    int records = (int)option(argc, argv, "--records", 10000000);
+    int maxThreads = (int)option(argc, argv, "--threads", 8);
+    int points = (int)option(argc, argv, "--points", 100000);
+    int queries = (int)option(argc, argv, "--queries", 200000);
+    string jsonPath = stringOption(argc, argv, "--json", "");
+
+    mt19937_64 rng(7);
+    int badBuckets = 0;
+    double worstError = 0;
+    for (int i = 0; i < 1000000; ++i) {
+        uint64_t v = rng() >> (24 + rng() % 40);
+        int b = latencyBucket(v);
+        uint64_t lo = latencyBucketLow(b), hi = latencyBucketHigh(b);
+        if (v < lo || v > hi || (b > 0 && latencyBucketHigh(b - 1) + 1 != lo)) badBuckets++;
+        if (lo > 0) worstError = max(worstError, (double)(hi - lo) / lo);
+    }
+    printf("latency: %d buckets, %d layout errors, worst bucket width %.2f%% of its value\n", LATENCY_BUCKETS,
+           badBuckets, 100 * worstError);
+
+    for (int threads = 1; threads <= maxThreads; threads *= 2) {
+        LatencyHistogram histogram;
+        auto start = Clock::now();
+        vector<thread> workers;
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&histogram, records, threads, t] {
+                uint64_t v = 1000 + t;
+                for (int i = 0; i < records / threads; ++i) {
+                    recordLatency(histogram, v);
+                    v = v * 6364136223846793005ULL + 1442695040888963407ULL;
+                    v = (v >> 44) + 100; // 100 ns to about 1 ms
+                }
+            });
+        }
+        for (auto& w : workers) w.join();
+        double ns = chrono::duration<double, nano>(Clock::now() - start).count();
+        LatencySummary summary = summarizeLatency(histogram);
+        printf("  record threads=%-2d ns_per_record=%-6.2f records_per_sec=%-12.0f counted=%llu\n", threads,
+               ns * threads / max(summary.count, (uint64_t)1), summary.count / (ns / 1e9),
+               (unsigned long long)summary.count);
+    }
+
+    vector<KDTree2D::Point> pts(points);
+    mt19937 prng(3);
+    for (auto& p : pts) {
+        vector<double> r = randomPoint(prng);
+        p = KDTree2D::Point{ r[0], r[1] };
+    }
+    KDNode* kdRoot = KDTree2D::build(pts.data(), nullptr, pts.size());
+    QuadNode* quadRoot = new QuadNode(0, MAP_W, 0, MAP_H, 4);
+    for (const auto& p : pts) quadRoot = insert(quadRoot, { p[0], p[1] });
+
+    vector<string> names = { "kd", "quad" };
+    vector<LatencySummary> summaries;
+    for (const string& engine : names) {
+        LatencyHistogram histogram;
+        vector<double> exact;
+        double bestDist;
+        for (int i = 0; i < queries; ++i) {
+            vector<double> q = randomPoint(prng);
+            auto start = Clock::now();
+            if (engine == "kd") {
+                findNearest(kdRoot, q, bestDist);
+            } else {
+                findNearest(quadRoot, q, bestDist);
+            }
+            uint64_t ns = (uint64_t)chrono::duration_cast<chrono::nanoseconds>(Clock::now() - start).count();
+            recordLatency(histogram, ns);
+            exact.push_back((double)ns);
+        }
+        sort(exact.begin(), exact.end());
+        auto at = [&exact](double p) { return exact[(size_t)max(1.0, ceil(p * exact.size())) - 1]; };
+        LatencySummary summary = summarizeLatency(histogram);
+        printf("  %-4s exact  p50_ns=%-8.0f p90_ns=%-8.0f p99_ns=%-8.0f p99.9_ns=%-8.0f max_ns=%.0f\n", engine.c_str(),
+               at(0.5), at(0.9), at(0.99), at(0.999), exact.back());
+        printf("  %-4s hdr    p50_ns=%-8llu p90_ns=%-8llu p99_ns=%-8llu p99.9_ns=%-8llu max_ns=%llu\n", engine.c_str(),
+               (unsigned long long)summary.p50Ns, (unsigned long long)summary.p90Ns, (unsigned long long)summary.p99Ns,
+               (unsigned long long)summary.p999Ns, (unsigned long long)summary.maxNs);
+        summaries.push_back(summary);
+    }
+    deleteTree(kdRoot);
+    deleteTree(quadRoot);
+
+    if (!jsonPath.empty()) {
+        ofstream out(jsonPath);
+        out << latencyJson(names, summaries);
+        printf("  wrote %s\n", jsonPath.c_str());
+    }
+    return 0;
+}
+
+// Hardware counters per query for each engine. Events the kernel will not
+// give us print as n/a, and with none at all only the timing is reported.
+static int benchPerf(int argc, char** argv) {
+    int points = (int)option(argc, argv, "--points", 100000);
+    int queries = (int)option(argc, argv, "--queries", 50000);
+    int linearQueries = (int)option(argc, argv, "--linear-queries", 500);
+
+    PerfCounters counters;
+    int opened = openPerfCounters(counters);
+    printf("perf: %d points, %d queries (%d linear), %d of %d hardware events available\n", points, queries,
+           linearQueries, opened, PERF_EVENT_COUNT);
+    for (int e = 0; e < PERF_EVENT_COUNT; ++e) {
+        if (!perfAvailable(counters, (PerfEvent)e)) {
+            printf("  %s: %s\n", perfEventName((PerfEvent)e), counters.errors[e].c_str());
+        }
+    }
+
+    for (Distribution d : { DIST_UNIFORM, DIST_ROADS }) {
+        WorkloadSpec spec;
+        spec.distribution = d;
+        spec.count = points;
+        spec.width = MAP_W;
+        spec.height = MAP_H;
+        vector<KDTree2D::Point> pts = generatePoints(spec);
+        spec.count = queries;
+        spec.seed = 2;
+        vector<vector<double>> qs;
+        for (const auto& p : generatePoints(spec)) qs.push_back({ p[0], p[1] });
+
+        KDNode* kdRoot = KDTree2D::build(pts.data(), nullptr, pts.size());
+        QuadNode* quadRoot = new QuadNode(0, MAP_W, 0, MAP_H, 4);
+        for (const auto& p : pts) quadRoot = insert(quadRoot, { p[0], p[1] });
+
+        const char* engines[] = { "linear", "kd", "quad" };
+        for (const char* engine : engines) {
+            string name = engine;
+            int n = name == "linear" ? min(linearQueries, queries) : queries;
+            double bestDist;
+            volatile double sink = 0; // keeps the linear scan from being optimised away
+            uint64_t values[PERF_EVENT_COUNT];
+
+            auto start = Clock::now();
+            startPerfCounters(counters);
+            for (int i = 0; i < n; ++i) {
+                vector<double>& q = qs[i];
+                if (name == "kd") {
+                    findNearest(kdRoot, q, bestDist);
+                } else if (name == "quad") {
+                    findNearest(quadRoot, q, bestDist);
+                } else {
+                    bestDist = numeric_limits<double>::max();
+                    for (const auto& p : pts) {
+                        double dx = p[0] - q[0], dy = p[1] - q[1];
+                        bestDist = min(bestDist, dx * dx + dy * dy);
+                    }
+                }
+                sink += bestDist;
+            }
+            stopPerfCounters(counters, values);
+            double ns = chrono::duration<double, nano>(Clock::now() - start).count() / n;
+
+            auto perQuery = [&](PerfEvent e) {
+                char text[32];
+                if (!perfAvailable(counters, e)) return string("n/a");
+                snprintf(text, sizeof(text), "%.1f", (double)values[e] / n);
+                return string(text);
+            };
+            string ipc = "n/a";
+            if (perfAvailable(counters, PERF_CYCLES) && perfAvailable(counters, PERF_INSTRUCTIONS) &&
+                values[PERF_CYCLES] > 0) {
+                char text[32];
+                snprintf(text, sizeof(text), "%.2f", (double)values[PERF_INSTRUCTIONS] / values[PERF_CYCLES]);
+                ipc = text;
+            }
+            printf("%-8s %-6s ns=%-9.1f cycles=%-10s instructions=%-10s ipc=%-5s l1d_misses=%-8s llc_misses=%-8s "
+                   "branch_misses=%-8s dtlb_misses=%s\n",
+                   distributionName(d), engine, ns, perQuery(PERF_CYCLES).c_str(), perQuery(PERF_INSTRUCTIONS).c_str(),
+                   ipc.c_str(), perQuery(PERF_L1D_MISSES).c_str(), perQuery(PERF_LLC_MISSES).c_str(),
+                   perQuery(PERF_BRANCH_MISSES).c_str(), perQuery(PERF_DTLB_MISSES).c_str());
+        }
+
+        deleteTree(kdRoot);
+        deleteTree(quadRoot);
+    }
+    closePerfCounters(counters);
+    return 0;
+}
+
+static void usage() {
+    printf("usage: benchmark <mode> [options]\n");
+    printf("  concurrent [--points N] [--readers R] [--write-rate W] [--seconds S]\n");
+    printf("  variants [--points N] [--queries Q]\n");
+    printf("  metrics [--points N] [--queries Q]\n");
+    printf("  geo [--points N] [--queries Q]\n");
+    printf("  approx [--points N] [--queries Q]\n");
+    printf("  bbf [--points N] [--sorted-points N] [--queries Q]\n");
+    printf("  browse [--points N] [--queries Q]\n");
+    printf("  attrs [--points N] [--queries Q]\n");
+    printf("  unified [--points N] [--queries Q]\n");
+    printf("  join [--a N] [--b N] [--threads T]\n");
+    printf("  reverse [--clients N] [--facilities M] [--queries Q] [--updates U]\n");
+    printf("  snapshot [--points N] [--categories C] [--queries Q]\n");
+    printf("  ingest [--points N] [--threads T] [--queries Q]\n");
+    printf("  wal [--records N] [--points N] [--window-us W]\n");
+    printf("  workloads [--points N] [--sorted-points N] [--queries Q] [--seed S]\n");
+    printf("  stats [--points N] [--queries Q]\n");
+    printf("  shape [--points N] [--sorted-points N]\n");
+    printf("  latency [--records N] [--threads T] [--points N] [--queries Q] [--json FILE]\n");
+    printf("  perf [--points N] [--queries Q] [--linear-queries Q]\n");
+    printf("  replay [--trace FILE --snapshot FILE | --points N --queries Q --rate R] [--threads T] [--speed S]\n");
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        usage();
+        return 1;
+    }
+
+    string mode = argv[1];
+    if (mode == "concurrent") return benchConcurrent(argc, argv);
+    if (mode == "variants") return benchVariants(argc, argv);
+    if (mode == "metrics") return benchMetrics(argc, argv);
+    if (mode == "geo") return benchGeo(argc, argv);
+    if (mode == "approx") return benchApprox(argc, argv);
+    if (mode == "bbf") return benchBBF(argc, argv);
+    if (mode == "browse") return benchBrowse(argc, argv);
+    if (mode == "attrs") return benchAttrs(argc, argv);
+    if (mode == "unified") return benchUnified(argc, argv);
+    if (mode == "join") return benchJoin(argc, argv);
+    if (mode == "reverse") return benchReverse(argc, argv);
+    if (mode == "snapshot") return benchSnapshot(argc, argv);
+    if (mode == "ingest") return benchIngest(argc, argv);
+    if (mode == "wal") return benchWal(argc, argv);
+    if (mode == "replay") return benchReplay(argc, argv);
+    if (mode == "workloads") return benchWorkloads(argc, argv);
+    if (mode == "stats") return benchStats(argc, argv);
+    if (mode == "shape") return benchShape(argc, argv);
+    if (mode == "latency") return benchLatency(argc, argv);
+    if (mode == "perf") return benchPerf(argc, argv);
+
+    usage();
+    return 1;
+}
@@ -1,8 +1,16 @@
 @echo off
 echo Compiling K-D Tree SDL Application...
-g++ framework.cpp KD-Tree\kd_tree.cpp Quad-Tree\quadtree.cpp -o my_map_app.exe -Ilibs/include/SDL2 -Llibs/lib -lmingw32 -lSDL2main -lSDL2 -lSDL2_ttf
+g++ framework.cpp KD-Tree\kd_tree.cpp Quad-Tree\quadtree.cpp Unified-Index\unified_index.cpp Storage\mapped_file.cpp Storage\snapshot.cpp Storage\mutation_log.cpp Ingest\point_loader.cpp Workload\query_trace.cpp Workload\generators.cpp Instrumentation\tree_shape.cpp Instrumentation\latency_histogram.cpp -o my_map_app.exe -Ilibs/include/SDL2 -Llibs/lib -lmingw32 -lSDL2main -lSDL2 -lSDL2_ttf -pthread
 if %ERRORLEVEL% EQU 0 (
     echo Compilation successful! 
 ) else (
     echo Compilation failed! Check errors above.
-)
\ No newline at end of file
+)
+
+echo Compiling headless benchmark...
+g++ -O2 benchmark.cpp KD-Tree\kd_tree.cpp Quad-Tree\quadtree.cpp Concurrency\epoch.cpp Concurrency\concurrent_index.cpp Distance\geo.cpp Unified-Index\unified_index.cpp Reverse-NN\reverse_nn.cpp Storage\mapped_file.cpp Storage\snapshot.cpp Storage\mutation_log.cpp Ingest\point_loader.cpp Workload\query_trace.cpp Workload\generators.cpp Instrumentation\tree_shape.cpp Instrumentation\latency_histogram.cpp Instrumentation\perf_counters.cpp -o benchmark.exe -pthread
+if %ERRORLEVEL% EQU 0 (
+    echo Compilation successful! 
+) else (
+    echo Compilation failed! Check errors above.
+)
@@ -10,9 +10,25 @@
 #include <ctime>
 #include <algorithm>
 #include <sstream>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <random>
+#include <unordered_map>
 
 #include "KD-Tree\kd_tree.h"
 #include "Quad-Tree\quadtree.h"
+#include "Unified-Index\unified_index.h"
+#include "Storage\snapshot.h"
+#include "Storage\mutation_log.h"
+#include "Ingest\point_loader.h"
+#include "Workload\query_trace.h"
+#include "Workload\generators.h"
+#include "Instrumentation\tree_shape.h"
+#include "Instrumentation\latency_histogram.h"
 
 using namespace std;
 
@@ -23,64 +39,115 @@ const int AXIS_PADDING = 30;
 
 struct Color { Uint8 r, g, b, a; };
 
-struct Category {
-    string name;
-    Color color;
+// Attribute bits stored with every indexed point.
+enum PointFlag { FLAG_OPEN = 1, FLAG_ACCESSIBLE = 2, FLAG_CARD = 4 };
+const uint32_t ALL_FLAGS = FLAG_OPEN | FLAG_ACCESSIBLE | FLAG_CARD;
+
+// A category's points and both trees. Background jobs build a fresh snapshot
+// and swap it in atomically; readers hold a shared_ptr so the snapshot they
+// query stays alive until they finish. Single-point edits are applied in place
+// on the UI thread, and only while no job for the category is queued; a
+// queued compaction counts as one.
+struct CategoryIndex {
     vector<pair<int, int>> points;
-    KDNode* kdRoot;
-    QuadNode* quadRoot;
-    bool selected = false;
+    vector<uint32_t> attrs; // parallel to points
+    unsigned edits = 0;     // in-place edits since the snapshot was built
+    KDNode* kdRoot = nullptr;
+    QuadNode* quadRoot = nullptr;
+
+    // Set for categories loaded from a snapshot file: searches run on the
+    // mapped trees until the background build supplies kdRoot/quadRoot.
+    shared_ptr<MappedSnapshot> mapped;
+    int mappedCategory = -1;
+
+    CategoryIndex() {}
+    CategoryIndex(const CategoryIndex&) = delete;
+    CategoryIndex& operator=(const CategoryIndex&) = delete;
+
+    ~CategoryIndex() {
+        if (kdRoot) deleteTree(kdRoot);
+        if (quadRoot) deleteTree(quadRoot);
+    }
+};
 
-    Category() : kdRoot(nullptr), quadRoot(nullptr), selected(false) {}
+struct IndexSlot {
+    shared_ptr<CategoryIndex> current;
+    atomic<int> pendingJobs{ 0 };
 
-    Category(const string& n, Color c, const vector<pair<int, int>>& pts)
-        : name(n), color(c), points(pts), kdRoot(nullptr), quadRoot(nullptr), selected(false) {
-    }
+    shared_ptr<CategoryIndex> load() const { return atomic_load(&current); }
+    void publish(const shared_ptr<CategoryIndex>& next) { atomic_store(&current, next); }
+};
 
-    ~Category() {
-        if (kdRoot) {
-            deleteTree(kdRoot);
-            kdRoot = nullptr;
+void scheduleIndexJob(const shared_ptr<IndexSlot>& slot, int randomToAdd, int mapW, int mapH, const string& ingestPath = "");
+
+// Owns a cached layer texture. A copy starts empty and is redrawn, so two
+// groups never share (and both destroy) one texture.
+struct LayerTexture {
+    SDL_Texture* texture = nullptr;
+
+    LayerTexture() {}
+    LayerTexture(const LayerTexture&) {}
+    LayerTexture(LayerTexture&& other) noexcept : texture(other.texture) { other.texture = nullptr; }
+    ~LayerTexture() { reset(); }
+
+    LayerTexture& operator=(const LayerTexture& other) {
+        if (this != &other) reset();
+        return *this;
+    }
+    LayerTexture& operator=(LayerTexture&& other) noexcept {
+        if (this != &other) {
+            reset();
+            texture = other.texture;
+            other.texture = nullptr;
         }
-        if (quadRoot) {
-            deleteTree(quadRoot);
-            quadRoot = nullptr;
+        return *this;
+    }
+
+    void reset() {
+        if (texture) {
+            SDL_DestroyTexture(texture);
+            texture = nullptr;
         }
     }
+};
 
-    void buildDataStructures(int mapW, int mapH) {
-        if (kdRoot) { deleteTree(kdRoot); kdRoot = nullptr; }
-        if (quadRoot) { deleteTree(quadRoot); quadRoot = nullptr; }
+struct Category {
+    string name;
+    Color color;
+    shared_ptr<IndexSlot> slot;
+    bool selected = false;
+    size_t renderedCount = 0;
+
+    // Search counters summed over this group's K-D and quadtree searches.
+    QueryStats kdStats, quadStats;
 
-        quadRoot = new QuadNode(0, mapW, 0, mapH, 4);
+    LayerTexture layer;
+    bool layerDirty = true;
+    bool layerHighlighted = false;
 
-        for (const auto& p : points) {
-            vector<double> point = {(double)p.first, (double)p.second};
-            kdRoot = insert(kdRoot, point);
-            quadRoot = insert(quadRoot, point);
+    Category() : Category("", Color{ 0,0,0,255 }, {}) {}
+
+    Category(const string& n, Color c, const vector<pair<int, int>>& pts)
+        : name(n), color(c), slot(make_shared<IndexSlot>()), selected(false) {
+        auto initial = make_shared<CategoryIndex>();
+        initial->points = pts;
+        for (size_t i = 0; i < pts.size(); ++i) {
+            initial->attrs.push_back(rand() & ALL_FLAGS);
         }
+        slot->publish(initial);
     }
 
-    Category(const Category& other)
-        : name(other.name), color(other.color), points(other.points),
-          kdRoot(nullptr), quadRoot(nullptr), selected(other.selected) {
-    }
+    shared_ptr<CategoryIndex> snapshot() const { return slot->load(); }
 
-    Category& operator=(const Category& other) {
-        if (this != &other) {
-            if (kdRoot) { deleteTree(kdRoot); kdRoot = nullptr; }
-            if (quadRoot) { deleteTree(quadRoot); quadRoot = nullptr; }
+    bool isRebuilding() const { return slot->pendingJobs > 0; }
 
-            name = other.name;
-            color = other.color;
-            points = other.points;
-            selected = other.selected;
-        }
-        return *this;
+    void buildDataStructures(int mapW, int mapH) {
+        scheduleIndexJob(slot, 0, mapW, mapH);
     }
 };
 
 enum SearchMode { LINEAR, KDTREE, QUADTREE };
+enum LodMode { LOD_OFF, LOD_DENSITY, LOD_REPRESENTATIVE };
 enum UIState { MAIN_VIEW, VENDING_VIEW };
 
 SDL_Window* win = nullptr;
@@ -109,11 +176,23 @@ Uint32 messageTimer = 0;
 
 bool isAddingRandom = false;
 string addPointsInput = "1000";
+Distribution randomDistribution = DIST_UNIFORM;
 SDL_Rect numPointsInputRect;
 
 int maxPointsToRender = 5000;
 SDL_Rect renderLimitSliderRect{ 20, 0, 0, 24 };
 bool isDraggingLimit = false;
+LodMode lodMode = LOD_DENSITY;
+
+// Searches only consider points carrying every bit of searchFilter.
+const uint32_t SEARCH_FILTERS[] = { 0, FLAG_OPEN, FLAG_ACCESSIBLE, FLAG_CARD, FLAG_OPEN | FLAG_ACCESSIBLE };
+const int SEARCH_FILTER_COUNT = sizeof(SEARCH_FILTERS) / sizeof(SEARCH_FILTERS[0]);
+int searchFilterIdx = 0;
+uint32_t searchFilter = 0;
+
+bool useLayerCache = true;
+SDL_Texture* backgroundLayer = nullptr;
+bool backgroundDirty = true;
 
 bool isAddingPoint = false;
 bool isRemovingPoint = false;
@@ -122,9 +201,67 @@ int lastSearchIdx = -1;
 
 SearchMode searchMode = KDTREE;
 
-static SDL_Texture* createTextTexture(SDL_Renderer* rend, TTF_Font* font, const string& text, SDL_Color col, int& w, int& h) {
+// Shape panel for the open group (I). The text is remeasured only when the
+// group's snapshot or its edit count changes.
+bool showTreeShape = false;
+weak_ptr<CategoryIndex> shapeSource;
+unsigned shapeEdits = 0;
+string shapeText;
+
+// Latency of every search, per SearchMode: since startup, and over the last
+// one to two LATENCY_WINDOW_MS periods for the panel (H).
+const char* SEARCH_MODE_NAMES[] = { "Linear", "K-D Tree", "Quadtree" };
+const char* LATENCY_FILE = "latency.json";
+const Uint32 LATENCY_WINDOW_MS = 10000;
+LatencyHistogram searchLatency[3];
+RollingLatency recentLatency[3];
+Uint32 latencyRotatedAt = 0;
+bool showLatency = false;
+
+// Search overlay (V): the open group's K-D splits or quadtree cells, coloured
+// by the trace the last search left: visited, pruned, or never reached.
+bool showSearchOverlay = false;
+vector<TraceEvent> overlayTrace;
+weak_ptr<CategoryIndex> overlaySource;
+unsigned overlayEdits = 0;
+SearchMode overlayMode = KDTREE;
+const int OVERLAY_MIN_CELL_PX = 6; // unreached cells smaller than this are not drawn
+
+const Uint32 MESSAGE_DURATION_MS = 4000;
+const Uint32 CURSOR_BLINK_MS = 500;
+
+bool needsRedraw = true;
+
+struct CompactionJob;
+struct UnifiedJob;
+
+struct IndexJob {
+    shared_ptr<IndexSlot> slot;
+    int randomToAdd;
+    int mapW, mapH;
+    unsigned seed;
+    Distribution distribution;
+    string ingestPath; // points file to append, if any
+    shared_ptr<CompactionJob> compaction; // set for a snapshot write instead of a build
+    shared_ptr<UnifiedJob> unified;       // set for a unified index build instead
+};
+
+mutex jobMutex;
+condition_variable jobReady;
+deque<IndexJob> jobQueue;
+bool workerStopping = false;
+thread indexWorker;
+Uint32 indexDoneEvent = (Uint32)-1;
+Uint32 compactionDoneEvent = (Uint32)-1;
+
+void runCompaction(const CompactionJob& job);
+
+// With wrapWidth > 0 the text is broken at newlines and at that width.
+static SDL_Texture* createTextTexture(SDL_Renderer* rend, TTF_Font* font, const string& text, SDL_Color col, int& w, int& h,
+                                      int wrapWidth = 0) {
     if (!font) return nullptr;
-    SDL_Surface* surf = TTF_RenderUTF8_Blended(font, text.c_str(), col);
+    SDL_Surface* surf = wrapWidth > 0 ? TTF_RenderUTF8_Blended_Wrapped(font, text.c_str(), col, (Uint32)wrapWidth)
+                                      : TTF_RenderUTF8_Blended(font, text.c_str(), col);
     if (!surf) return nullptr;
     SDL_Texture* tex = SDL_CreateTextureFromSurface(rend, surf);
     w = surf->w; h = surf->h;
@@ -194,6 +331,95 @@ void computeLayout(int w, int h) {
     mapInnerH = mapH - 2 * AXIS_PADDING;
 }
 
+const char* lodModeName(LodMode mode) {
+    switch (mode) {
+        case LOD_DENSITY: return "Density heatmap";
+        case LOD_REPRESENTATIVE: return "One per cell";
+        case LOD_OFF:
+        default: return "Off (first N points)";
+    }
+}
+
+string filterName(uint32_t mask) {
+    if (mask == 0) return "Any";
+    string name;
+    if (mask & FLAG_OPEN) name += "Open now";
+    if (mask & FLAG_ACCESSIBLE) name += string(name.empty() ? "" : " + ") + "Accessible";
+    if (mask & FLAG_CARD) name += string(name.empty() ? "" : " + ") + "Card";
+    return name;
+}
+
+// Shared index over every category, used for map clicks and joins in
+// MAIN_VIEW. The index worker builds it from the published snapshots and
+// swaps it in. Until it matches every category's snapshot and edit count,
+// the UI searches each category's own tree instead.
+struct UnifiedSource {
+    weak_ptr<CategoryIndex> snapshot;
+    unsigned edits;
+};
+
+struct UnifiedSnapshot {
+    UnifiedIndex* index = nullptr;
+    vector<UnifiedSource> sources;
+
+    UnifiedSnapshot() {}
+    UnifiedSnapshot(const UnifiedSnapshot&) = delete;
+    UnifiedSnapshot& operator=(const UnifiedSnapshot&) = delete;
+    ~UnifiedSnapshot() { deleteTree(index); }
+};
+
+// A unified build handed to the index worker: each category's snapshot as
+// it stood when the job was queued. The slots count the job as pending until
+// the worker has copied the points out, so none is edited in place meanwhile.
+struct UnifiedJob {
+    vector<shared_ptr<CategoryIndex>> snaps;
+    vector<shared_ptr<IndexSlot>> slots;
+};
+
+shared_ptr<UnifiedSnapshot> unifiedCurrent; // read and swapped with atomic_load/atomic_store
+atomic<bool> unifiedBuilding{ false };
+
+void scheduleUnifiedBuild(size_t count);
+
+// The unified index if it is up to date, else null, in which case a rebuild
+// is queued unless one already is.
+shared_ptr<UnifiedSnapshot> currentUnifiedIndex() {
+    auto unified = atomic_load(&unifiedCurrent);
+    size_t count = min(categories.size(), (size_t)MAX_CATEGORIES);
+    bool stale = !unified || unified->sources.size() != count;
+    for (size_t i = 0; i < count && !stale; ++i) {
+        auto snap = categories[i].snapshot();
+        stale = unified->sources[i].snapshot.lock() != snap || unified->sources[i].edits != snap->edits;
+    }
+    if (!stale) return unified;
+    if (!unifiedBuilding) scheduleUnifiedBuild(count);
+    return nullptr;
+}
+
+// Nearest point of one category through its own tree: the pointer tree, the
+// mapped one while that is being rebuilt, or a scan when there is neither.
+// bestDist is squared; false when the category has no points.
+bool nearestInCategory(const CategoryIndex& snap, vector<double>& target, double& bestDist) {
+    bestDist = numeric_limits<double>::max();
+    if (snap.kdRoot) {
+        return findNearest(snap.kdRoot, target, bestDist) != nullptr;
+    }
+    if (snap.mapped) {
+        return findNearest(snap.mapped->kdTree(snap.mappedCategory), target, bestDist) != nullptr;
+    }
+    for (const auto& p : snap.points) {
+        bestDist = min(bestDist, dist2((int)target[0], (int)target[1], p.first, p.second));
+    }
+    return !snap.points.empty();
+}
+
+void invalidateLayers() {
+    backgroundDirty = true;
+    for (auto& cat : categories) {
+        cat.layerDirty = true;
+    }
+}
+
 void drawButton(const string& text, SDL_Rect rect, Color bg, bool glow) {
     SDL_SetRenderDrawBlendMode(ren, SDL_BLENDMODE_BLEND);
     SDL_SetRenderDrawColor(ren, bg.r, bg.g, bg.b, bg.a);
@@ -220,17 +446,524 @@ void drawButton(const string& text, SDL_Rect rect, Color bg, bool glow) {
     }
 }
 
+// A plain rebuild (nothing to add) is folded into any job already queued for
+// the slot, since every job rebuilds both trees: the queued jobs take the new
+// bounds instead. Resizing the window therefore leaves at most one rebuild
+// pending per category however many resize events arrive.
+void scheduleIndexJob(const shared_ptr<IndexSlot>& slot, int randomToAdd, int mapW, int mapH, const string& ingestPath) {
+    lock_guard<mutex> lock(jobMutex);
+    if (randomToAdd == 0 && ingestPath.empty()) {
+        bool queued = false;
+        for (auto& job : jobQueue) {
+            if (job.slot != slot) continue;
+            job.mapW = mapW;
+            job.mapH = mapH;
+            queued = true;
+        }
+        if (queued) return;
+    }
+    slot->pendingJobs++;
+    jobQueue.push_back(IndexJob{ slot, randomToAdd, mapW, mapH, (unsigned)rand(), randomDistribution, ingestPath, nullptr,
+                                 nullptr });
+    jobReady.notify_one();
+}
+
+void scheduleUnifiedBuild(size_t count) {
+    auto job = make_shared<UnifiedJob>();
+    for (size_t i = 0; i < count; ++i) {
+        job->snaps.push_back(categories[i].snapshot());
+        job->slots.push_back(categories[i].slot);
+        categories[i].slot->pendingJobs++;
+    }
+    unifiedBuilding = true;
+
+    lock_guard<mutex> lock(jobMutex);
+    IndexJob indexJob{};
+    indexJob.unified = job;
+    jobQueue.push_back(indexJob);
+    jobReady.notify_one();
+}
+
+// Runs on the index worker. Edits wait only for the copy, not the build.
+void runUnifiedBuild(const UnifiedJob& job) {
+    auto next = make_shared<UnifiedSnapshot>();
+    vector<UnifiedEntry> entries;
+    for (size_t i = 0; i < job.snaps.size(); ++i) {
+        const CategoryIndex& snap = *job.snaps[i];
+        next->sources.push_back({ job.snaps[i], snap.edits });
+        for (size_t j = 0; j < snap.points.size(); ++j) {
+            entries.push_back({ (double)snap.points[j].first, (double)snap.points[j].second, (int)i, (int)j });
+        }
+    }
+    for (auto& slot : job.slots) slot->pendingJobs--;
+
+    next->index = buildUnifiedIndex(move(entries));
+    atomic_store(&unifiedCurrent, next);
+    unifiedBuilding = false;
+}
+
+// Builds each new snapshot from the latest published one, so queued jobs for
+// the same category compose. The UI thread keeps querying the old snapshot
+// until the swap and learns about it through indexDoneEvent, whose data2 may
+// carry a heap-allocated status message.
+void indexWorkerLoop() {
+    for (;;) {
+        IndexJob job;
+        {
+            unique_lock<mutex> lock(jobMutex);
+            jobReady.wait(lock, [] { return workerStopping || !jobQueue.empty(); });
+            if (jobQueue.empty()) return;
+            job = jobQueue.front();
+            jobQueue.pop_front();
+        }
+        if (job.compaction) {
+            runCompaction(*job.compaction);
+            continue;
+        }
+        if (job.unified) {
+            runUnifiedBuild(*job.unified);
+            continue;
+        }
+
+        auto base = job.slot->load();
+        auto next = make_shared<CategoryIndex>();
+        next->points.reserve(base->points.size() + job.randomToAdd);
+        next->points.insert(next->points.end(), base->points.begin(), base->points.end());
+        next->attrs.reserve(next->points.capacity());
+        next->attrs.insert(next->attrs.end(), base->attrs.begin(), base->attrs.end());
+
+        mt19937 rng(job.seed);
+        if (job.randomToAdd > 0) {
+            WorkloadSpec spec;
+            spec.distribution = job.distribution;
+            spec.count = job.randomToAdd;
+            spec.width = job.mapW;
+            spec.height = job.mapH;
+            spec.seed = job.seed;
+            for (const auto& p : generatePoints(spec)) {
+                next->points.push_back({ (int)p[0], (int)p[1] });
+                next->attrs.push_back(rng() & ALL_FLAGS);
+            }
+        }
+
+        string* status = nullptr;
+        if (!job.ingestPath.empty()) {
+            IngestResult loaded;
+            string error;
+            if (loadPoints(job.ingestPath, IngestOptions(), loaded, error)) {
+                // The map shows integer coordinates; points outside it are dropped.
+                size_t kept = 0;
+                for (size_t i = 0; i < loaded.points.size(); ++i) {
+                    double x = loaded.points[i][0], y = loaded.points[i][1];
+                    if (!(x >= 0 && x < job.mapW && y >= 0 && y < job.mapH)) continue;
+                    next->points.push_back({ (int)x, (int)y });
+                    next->attrs.push_back(loaded.hasAttrs ? loaded.attrs[i] : rng() & ALL_FLAGS);
+                    kept++;
+                }
+                ostringstream os;
+                os << "Loaded " << kept << " points (" << (int)loaded.megabytesPerSecond() << " MB/s, "
+                   << (long long)loaded.pointsPerSecond() << " points/s)";
+                if (kept < loaded.points.size()) os << ", " << loaded.points.size() - kept << " outside the map";
+                os << ".";
+                status = new string(os.str());
+            } else {
+                status = new string("Load failed: " + error);
+            }
+        }
+
+        vector<KDTree2D::Point> coords(next->points.size());
+        for (size_t i = 0; i < coords.size(); ++i) {
+            coords[i] = KDTree2D::Point{ (double)next->points[i].first, (double)next->points[i].second };
+        }
+        next->kdRoot = KDTree2D::build(coords.data(), next->attrs.data(), coords.size());
+        next->quadRoot = new QuadNode(0, job.mapW, 0, job.mapH, 4);
+        for (size_t i = 0; i < coords.size(); ++i) {
+            next->quadRoot = insert(next->quadRoot, { coords[i][0], coords[i][1] }, next->attrs[i]);
+        }
+
+        job.slot->publish(next);
+        job.slot->pendingJobs--;
+
+        if (indexDoneEvent != (Uint32)-1) {
+            SDL_Event done;
+            SDL_zero(done);
+            done.type = indexDoneEvent;
+            done.user.code = job.randomToAdd;
+            done.user.data1 = job.slot.get();
+            done.user.data2 = status;
+            if (SDL_PushEvent(&done) <= 0) delete status;
+        } else {
+            delete status;
+        }
+    }
+}
+
+const char* SNAPSHOT_FILE = "categories.snap";
+
+// Restores the categories written by saveCategories(). Points and attributes
+// are copied out of the mapping; both trees stay mapped for searching until
+// the background build replaces them.
+bool loadCategories(uint64_t& checksum) {
+    string error;
+    MappedSnapshot* raw = openSnapshot(SNAPSHOT_FILE, true, error);
+    if (!raw) {
+        SDL_Log("No snapshot loaded: %s", error.c_str());
+        return false;
+    }
+    shared_ptr<MappedSnapshot> mapped(raw, closeSnapshot);
+    checksum = mapped->header()->checksum;
+
+    for (uint32_t i = 0; i < mapped->categoryCount(); ++i) {
+        const SnapshotCategory& rec = mapped->category(i);
+        const SnapshotPoint* pts = mapped->points(i);
+        vector<pair<int, int>> points(rec.pointCount);
+        for (uint64_t j = 0; j < rec.pointCount; ++j) {
+            points[j] = { pts[j].x, pts[j].y };
+        }
+
+        string name(rec.name, find(rec.name, rec.name + SNAPSHOT_NAME_LEN, '\0'));
+        categories.push_back(Category(name, Color{ rec.color[0], rec.color[1], rec.color[2], rec.color[3] }, points));
+        auto snap = categories.back().snapshot();
+        snap->attrs.assign(mapped->attrs(i), mapped->attrs(i) + rec.pointCount);
+        snap->mapped = mapped;
+        snap->mappedCategory = (int)i;
+    }
+    return true;
+}
+
+// One source per category, pointing into its current snapshot; snaps keeps
+// those snapshots alive for as long as the sources are used.
+void captureCategories(vector<shared_ptr<CategoryIndex>>& snaps, vector<SnapshotSource>& sources) {
+    for (auto& cat : categories) {
+        auto snap = cat.snapshot();
+        snaps.push_back(snap);
+
+        SnapshotSource src;
+        src.name = cat.name;
+        src.color[0] = cat.color.r;
+        src.color[1] = cat.color.g;
+        src.color[2] = cat.color.b;
+        src.color[3] = cat.color.a;
+        src.points = &snap->points;
+        src.attrs = &snap->attrs;
+        src.kdRoot = snap->kdRoot;
+        src.quadRoot = snap->quadRoot;
+        src.width = mapInnerW;
+        src.height = mapInnerH;
+        sources.push_back(src);
+    }
+}
+
+bool saveCategories(string& error, uint64_t* checksum = nullptr, const char* path = SNAPSHOT_FILE) {
+    vector<shared_ptr<CategoryIndex>> snaps;
+    vector<SnapshotSource> sources;
+    captureCategories(snaps, sources);
+    return writeSnapshot(path, sources, error, checksum);
+}
+
+// Edits since the last snapshot are appended to LOG_FILE and replayed on
+// startup; once the log passes LOG_COMPACT_BYTES it is folded into a new
+// snapshot. Bulk additions are not logged point by point: finishing one
+// compacts instead. Compactions run on the index worker, one at a time.
+const char* LOG_FILE = "categories.log";
+const uint64_t LOG_COMPACT_BYTES = 1 << 20;
+MutationLog* mutationLog = nullptr;
+bool compactionDue = false;
+bool compactionRunning = false;
+
+uint32_t packColor(Color c) {
+    return ((uint32_t)c.r << 24) | ((uint32_t)c.g << 16) | ((uint32_t)c.b << 8) | c.a;
+}
+
+// Queues the record and returns without waiting for the disk, so an edit the
+// UI has already reported can still be lost by a crash within the log's
+// group-commit window (MutationLog::groupWindowUs, 2 ms).
+void logMutation(LogOp op, int category, int x = 0, int y = 0, uint32_t attrs = 0, uint32_t index = 0,
+                 const string& name = "") {
+    if (mutationLog) appendLog(mutationLog, LogEntry{ op, category, x, y, attrs, index, name });
+}
+
+// Re-applies a logged edit at startup, before any tree is built.
+void applyLogEntry(const LogEntry& entry) {
+    if (entry.op == LOG_CREATE) {
+        Color c{ Uint8(entry.attrs >> 24), Uint8(entry.attrs >> 16), Uint8(entry.attrs >> 8), Uint8(entry.attrs) };
+        categories.push_back(Category(entry.name, c, {}));
+        return;
+    }
+    if (entry.category < 0 || entry.category >= (int)categories.size()) return;
+    if (entry.op == LOG_DELETE) {
+        categories.erase(categories.begin() + entry.category);
+        return;
+    }
+
+    auto snap = categories[entry.category].snapshot();
+    snap->mapped.reset(); // the mapped trees no longer match the points
+    if (entry.op == LOG_INSERT) {
+        snap->points.push_back({ entry.x, entry.y });
+        snap->attrs.push_back(entry.attrs);
+    }
+    else if (entry.op == LOG_REMOVE && entry.index < snap->points.size()) {
+        snap->points.erase(snap->points.begin() + entry.index);
+        snap->attrs.erase(snap->attrs.begin() + entry.index);
+    }
+}
+
+// Synchronous compaction, for shutdown once the worker has stopped. The
+// snapshot is written before the log is emptied. If either step fails or the
+// process dies in between, the log still matches whichever snapshot is on
+// disk, so no edit is lost.
+bool compactLog(string& error) {
+    uint64_t checksum;
+    if (!saveCategories(error, &checksum)) return false;
+    compactionDue = false;
+    return !mutationLog || resetLog(mutationLog, checksum, error);
+}
+
+// A compaction handed to the index worker: every category as it stood when
+// the job was queued, and the log position at that moment. Each slot counts
+// the job as pending, so none of the snapshots is edited in place while it
+// is written, and edits logged after logMark are carried into the new log.
+struct CompactionJob {
+    vector<shared_ptr<CategoryIndex>> snaps;
+    vector<SnapshotSource> sources;
+    vector<shared_ptr<IndexSlot>> slots;
+    uint64_t logMark = 0;
+    bool announce = false; // report success, not only failure
+};
+
+void scheduleCompaction(bool announce) {
+    auto job = make_shared<CompactionJob>();
+    captureCategories(job->snaps, job->sources);
+    for (auto& cat : categories) {
+        cat.slot->pendingJobs++;
+        job->slots.push_back(cat.slot);
+    }
+    job->logMark = mutationLog ? logMark(mutationLog) : 0;
+    job->announce = announce;
+    compactionDue = false;
+    compactionRunning = true;
+
+    lock_guard<mutex> lock(jobMutex);
+    IndexJob indexJob{};
+    indexJob.compaction = job;
+    jobQueue.push_back(indexJob);
+    jobReady.notify_one();
+}
+
+// Runs on the index worker. The result goes back through compactionDoneEvent,
+// whose data2 may carry a heap-allocated status message.
+void runCompaction(const CompactionJob& job) {
+    auto start = chrono::steady_clock::now();
+    string error;
+    uint64_t checksum;
+    auto publish = [](string& publishError) { return publishSnapshot(SNAPSHOT_FILE, publishError); };
+    bool ok = prepareSnapshot(SNAPSHOT_FILE, job.sources, error, &checksum) &&
+              (mutationLog ? rebaseLog(mutationLog, checksum, job.logMark, publish, error) : publish(error));
+    for (auto& slot : job.slots) slot->pendingJobs--;
+
+    string* status = nullptr;
+    if (!ok) {
+        status = new string("Save failed: " + error);
+    } else if (job.announce) {
+        auto ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+        status = new string("Saved " + to_string(job.sources.size()) + " groups to " + SNAPSHOT_FILE + " in " +
+                            to_string(ms) + " ms.");
+    }
+
+    SDL_Event done;
+    SDL_zero(done);
+    done.type = compactionDoneEvent;
+    done.user.data2 = status;
+    if (compactionDoneEvent == (Uint32)-1 || SDL_PushEvent(&done) <= 0) delete status;
+}
+
+// While recording, every search is appended to TRACE_FILE. The data it ran
+// against is saved to TRACE_SNAPSHOT_FILE when recording starts, so the pair
+// can be replayed headless with `benchmark replay`.
+const char* TRACE_FILE = "queries.trace";
+const char* TRACE_SNAPSHOT_FILE = "queries.snap";
+TraceRecorder* traceRecorder = nullptr;
+
+void toggleTraceRecording() {
+    string error;
+    if (traceRecorder) {
+        uint64_t count = traceRecorder->count;
+        bool ok = stopTrace(traceRecorder);
+        traceRecorder = nullptr;
+        message = ok ? "Recorded " + to_string(count) + " queries to " + TRACE_FILE + "."
+                     : string("Trace write failed: ") + TRACE_FILE;
+        return;
+    }
+    uint64_t checksum;
+    if (saveCategories(error, &checksum, TRACE_SNAPSHOT_FILE)) {
+        traceRecorder = startTrace(TRACE_FILE, checksum, error);
+    }
+    message = traceRecorder ? string("Recording searches to ") + TRACE_FILE + ", press T to stop."
+                            : "Cannot record: " + error;
+}
+
+string formatMicros(uint64_t ns) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.3f us", ns / 1000.0);
+    return text;
+}
+
+// Starts a new recent-latency window every LATENCY_WINDOW_MS; after a long
+// idle spell both windows are cleared.
+void rotateLatencyWindows() {
+    Uint32 now = SDL_GetTicks();
+    Uint32 elapsed = now - latencyRotatedAt;
+    if (elapsed < LATENCY_WINDOW_MS) return;
+    for (auto& recent : recentLatency) {
+        rotateLatency(recent);
+        if (elapsed >= 2 * LATENCY_WINDOW_MS) rotateLatency(recent);
+    }
+    latencyRotatedAt = now;
+}
+
+bool exportLatency(string& error) {
+    vector<string> names;
+    vector<LatencySummary> summaries;
+    for (int m = 0; m < 3; ++m) {
+        names.push_back(SEARCH_MODE_NAMES[m]);
+        summaries.push_back(summarizeLatency(searchLatency[m]));
+        names.push_back(string(SEARCH_MODE_NAMES[m]) + " (recent)");
+        summaries.push_back(summarizeLatency(recentLatency[m]));
+    }
+    string json = latencyJson(names, summaries);
+    FILE* f = fopen(LATENCY_FILE, "wb");
+    if (!f) {
+        error = string("cannot open ") + LATENCY_FILE;
+        return false;
+    }
+    bool ok = fwrite(json.data(), 1, json.size(), f) == json.size();
+    ok = fclose(f) == 0 && ok;
+    if (!ok) error = string("cannot write ") + LATENCY_FILE;
+    return ok;
+}
+
+// D picks the layout used by "Add N Points".
+void cycleRandomDistribution() {
+    randomDistribution = (Distribution)((randomDistribution + 1) % DISTRIBUTION_COUNT);
+    message = string("New points will be ") + distributionName(randomDistribution) + ", press D to change.";
+    messageTimer = SDL_GetTicks();
+}
+
+void maybeCompactLog() {
+    if (!mutationLog || compactionRunning || (!compactionDue && mutationLog->bytes < LOG_COMPACT_BYTES)) return;
+    scheduleCompaction(false);
+}
+
+// Queued bulk loads are finished first: their points are not in the mutation
+// log, so the snapshot saved at exit is the only place they can land. Plain
+// rebuilds, compactions and unified builds are dropped, as that save covers
+// them.
+void stopIndexWorker() {
+    {
+        lock_guard<mutex> lock(jobMutex);
+        workerStopping = true;
+        deque<IndexJob> loads;
+        for (auto& job : jobQueue) {
+            if (job.randomToAdd > 0 || !job.ingestPath.empty()) loads.push_back(move(job));
+        }
+        jobQueue.swap(loads);
+        if (!jobQueue.empty()) SDL_Log("Finishing %d queued point loads before exit.", (int)jobQueue.size());
+    }
+    jobReady.notify_all();
+    if (indexWorker.joinable()) indexWorker.join();
+}
+
+bool followsMouse() {
+    return isDraggingSize || isDraggingLimit || isAddingPoint || isRemovingPoint || isSearchingPoint;
+}
+
+// Milliseconds until the screen changes on its own (message expiry, text
+// cursor blink), or -1 to sleep until input or a background job finishes.
+int nextWakeup() {
+    Uint32 now = SDL_GetTicks();
+    int timeout = -1;
+    if (!message.empty()) {
+        Uint32 elapsed = now - messageTimer;
+        timeout = elapsed < MESSAGE_DURATION_MS ? (int)(MESSAGE_DURATION_MS - elapsed) : 0;
+    }
+    if (isNamingCategory || isAddingRandom) {
+        int blink = (int)(CURSOR_BLINK_MS - now % CURSOR_BLINK_MS);
+        timeout = timeout < 0 ? blink : min(timeout, blink);
+    }
+    if (showLatency && state == VENDING_VIEW) {
+        Uint32 elapsed = now - latencyRotatedAt;
+        int rotation = elapsed < LATENCY_WINDOW_MS ? (int)(LATENCY_WINDOW_MS - elapsed) : 0;
+        timeout = timeout < 0 ? rotation : min(timeout, rotation);
+    }
+    return timeout;
+}
+
 void handleInput(bool& running) {
     SDL_Event e;
-    while (SDL_PollEvent(&e)) {
+    int timeout = nextWakeup();
+    if (!SDL_WaitEventTimeout(&e, timeout)) {
+        if (timeout >= 0) needsRedraw = true;
+        return;
+    }
+
+    do {
+        if (e.type != SDL_MOUSEMOTION || followsMouse()) {
+            needsRedraw = true;
+        }
+
         if (e.type == SDL_QUIT) {
             running = false;
         }
+        else if (e.type == indexDoneEvent) {
+            string* status = (string*)e.user.data2;
+            for (auto& cat : categories) {
+                if (cat.slot.get() != e.user.data1) continue;
+                cat.layerDirty = true;
+                if (status) {
+                    message = cat.name + ": " + *status;
+                    messageTimer = SDL_GetTicks();
+                    compactionDue = true;
+                }
+                else if (e.user.code > 0) {
+                    message = "Added " + to_string(e.user.code) + " generated points to " + cat.name + ".";
+                    messageTimer = SDL_GetTicks();
+                    compactionDue = true;
+                }
+            }
+            delete status;
+        }
+        else if (e.type == compactionDoneEvent) {
+            string* status = (string*)e.user.data2;
+            compactionRunning = false;
+            if (status) {
+                message = *status;
+                messageTimer = SDL_GetTicks();
+            }
+            delete status;
+        }
+        else if (e.type == SDL_DROPFILE) {
+            // A dropped CSV/TSV or .bin points file becomes a new group.
+            string path = e.drop.file;
+            SDL_free(e.drop.file);
+            size_t slash = path.find_last_of("/\\");
+            string name = path.substr(slash == string::npos ? 0 : slash + 1);
+            name = name.substr(0, name.find_last_of('.'));
+            categories.push_back(Category(name.empty() ? "Imported" : name, makeColor(), {}));
+            logMutation(LOG_CREATE, (int)categories.size() - 1, 0, 0, packColor(categories.back().color), 0,
+                        categories.back().name);
+            scheduleIndexJob(categories.back().slot, 0, mapInnerW, mapInnerH, path);
+            message = "Loading " + path + "...";
+            messageTimer = SDL_GetTicks();
+        }
         else if (e.type == SDL_WINDOWEVENT && e.window.event == SDL_WINDOWEVENT_RESIZED) {
             computeLayout(e.window.data1, e.window.data2);
             for (auto& cat : categories) {
                 cat.buildDataStructures(mapInnerW, mapInnerH);
             }
+            invalidateLayers();
+        }
+        else if (e.type == SDL_RENDER_TARGETS_RESET || e.type == SDL_RENDER_DEVICE_RESET) {
+            invalidateLayers();
         }
         else if (e.type == SDL_MOUSEBUTTONDOWN) {
             int mx = e.button.x, my = e.button.y;
@@ -260,6 +993,9 @@ void handleInput(bool& running) {
 
                     SDL_Rect removeAllBtn{ 20, 290, mapX - 40, 40 };
                     if (isMouseInRect(mx, my, removeAllBtn)) {
+                        // Logged as one delete per group, last first, so replay
+                        // removes the same groups by index.
+                        for (int i = (int)categories.size() - 1; i >= 0; --i) logMutation(LOG_DELETE, i);
                         categories.clear();
                         activeCatIdx = -1;
                         state = MAIN_VIEW;
@@ -268,11 +1004,30 @@ void handleInput(bool& running) {
                         continue;
                     }
 
+                    SDL_Rect lodBtn{ 20, 340, mapX - 40, 40 };
+                    if (isMouseInRect(mx, my, lodBtn)) {
+                        lodMode = (LodMode)((lodMode + 1) % 3);
+                        invalidateLayers();
+                        message = string("Level of detail: ") + lodModeName(lodMode);
+                        messageTimer = SDL_GetTicks();
+                        continue;
+                    }
+
+                    SDL_Rect filterBtn{ 20, 390, mapX - 40, 40 };
+                    if (isMouseInRect(mx, my, filterBtn)) {
+                        searchFilterIdx = (searchFilterIdx + 1) % SEARCH_FILTER_COUNT;
+                        searchFilter = SEARCH_FILTERS[searchFilterIdx];
+                        message = "Search filter: " + filterName(searchFilter);
+                        messageTimer = SDL_GetTicks();
+                        continue;
+                    }
+
                     if (isMouseInRect(mx, my, sliderRect)) {
                         isDraggingSize = true;
                         isDraggingLimit = false;
                         float t = float(mx - sliderRect.x) / float(sliderRect.w);
                         pointRadius = int(4 + t * 20);
+                        invalidateLayers();
                         continue;
                     }
 
@@ -282,15 +1037,24 @@ void handleInput(bool& running) {
                         float t = float(mx - renderLimitSliderRect.x) / float(renderLimitSliderRect.w);
                         t = max(0.0f, min(1.0f, t));
                         maxPointsToRender = int(100 + t * 19900);
+                        invalidateLayers();
                         continue;
                     }
                 } else {
                     auto gp = worldToGraph(mx, my);
-                    double bestDist2 = 1e12; int bestCat = -1;
-                    for (size_t i = 0; i < categories.size(); ++i) {
-                        for (auto& p : categories[i].points) {
-                            double d2 = dist2(gp.first, gp.second, p.first, p.second);
-                            if (d2 < bestDist2) { bestDist2 = d2; bestCat = (int)i; }
+                    vector<double> target = { (double)gp.first, (double)gp.second };
+                    double bestDist2 = numeric_limits<double>::max();
+                    int bestCat = -1;
+                    if (auto unified = currentUnifiedIndex()) {
+                        const UnifiedEntry* nearest = findNearest(unified->index, target, ~0ULL, bestDist2);
+                        if (nearest) bestCat = nearest->category;
+                    } else {
+                        for (size_t i = 0; i < categories.size() && i < (size_t)MAX_CATEGORIES; ++i) {
+                            double d;
+                            if (nearestInCategory(*categories[i].snapshot(), target, d) && d < bestDist2) {
+                                bestDist2 = d;
+                                bestCat = (int)i;
+                            }
                         }
                     }
                     if (bestCat != -1 && bestDist2 < (pointRadius + 10) * (pointRadius + 10)) {
@@ -347,6 +1111,7 @@ void handleInput(bool& running) {
                     else if (isMouseInRect(mx, my, deleteCatBtn)) {
                         string n = categories[activeCatIdx].name;
                         categories.erase(categories.begin() + activeCatIdx);
+                        logMutation(LOG_DELETE, activeCatIdx);
                         activeCatIdx = -1; state = MAIN_VIEW;
                         message = "Deleted group: " + n; messageTimer = SDL_GetTicks();
                         isAddingPoint = false;
@@ -382,13 +1147,21 @@ void handleInput(bool& running) {
                 } else {
                     auto gp = worldToGraph(e.button.x, e.button.y);
                     auto& cat = categories[activeCatIdx];
-                    auto& pts = cat.points;
+                    auto snap = cat.snapshot();
+                    auto& pts = snap->points;
 
-                    if (isAddingPoint) {
+                    if ((isAddingPoint || isRemovingPoint) && cat.isRebuilding()) {
+                        message = "Index is being rebuilt or saved, try again shortly.";
+                    }
+                    else if (isAddingPoint) {
                         pts.push_back({ gp.first, gp.second });
+                        snap->attrs.push_back(searchFilter);
                         vector<double> point = {(double)gp.first, (double)gp.second};
-                        cat.kdRoot = insert(cat.kdRoot, point);
-                        cat.quadRoot = insert(cat.quadRoot, point);
+                        snap->kdRoot = insert(snap->kdRoot, point, 0, searchFilter);
+                        snap->quadRoot = insert(snap->quadRoot, point, searchFilter);
+                        snap->edits++;
+                        logMutation(LOG_INSERT, activeCatIdx, gp.first, gp.second, searchFilter);
+                        cat.layerDirty = true;
                         message = "New point added at (" + to_string(gp.first) + ", " + to_string(gp.second) + ").";
                         isAddingPoint = false;
                     }
@@ -403,9 +1176,13 @@ void handleInput(bool& running) {
                             }
                             string coords = "(" + to_string(pts[bi].first) + ", " + to_string(pts[bi].second) + ")";
                             vector<double> pointToRemove = {(double)pts[bi].first, (double)pts[bi].second};
-                            cat.kdRoot = removeNode(cat.kdRoot, pointToRemove);
-                            cat.quadRoot = removeNode(cat.quadRoot, pointToRemove);
+                            snap->kdRoot = removeNode(snap->kdRoot, pointToRemove, 0, &snap->attrs[bi]);
+                            snap->quadRoot = removeNode(snap->quadRoot, pointToRemove, &snap->attrs[bi]);
                             pts.erase(pts.begin() + bi);
+                            snap->attrs.erase(snap->attrs.begin() + bi);
+                            snap->edits++;
+                            logMutation(LOG_REMOVE, activeCatIdx, 0, 0, 0, bi);
+                            cat.layerDirty = true;
                             message = "Removed point at " + coords + ".";
                         }
                         isRemovingPoint = false;
@@ -420,23 +1197,35 @@ void handleInput(bool& running) {
                             pair<int, int> foundPoint;
                             vector<double> target = {(double)gp.first, (double)gp.second};
                             string searchModeStr;
+                            QueryStats stats;
+                            vector<TraceEvent> trace;
+                            if (showSearchOverlay) stats.trace = &trace;
 
                             switch (searchMode) {
                                 case KDTREE:
                                     searchModeStr = "K-D Tree";
-                                    if (cat.kdRoot) {
+                                    if (snap->kdRoot) {
                                         double bestDist;
-                                        KDNode* nearest = findNearest(cat.kdRoot, target, bestDist);
+                                        KDNode* nearest = findNearest(snap->kdRoot, target, bestDist, 0.0, searchFilter, &stats);
                                         if (nearest) {
                                             foundPoint = {(int)nearest->point[0], (int)nearest->point[1]};
                                         }
+                                    } else if (snap->mapped) {
+                                        double bestDist;
+                                        const FlatKDNode* nearest = findNearest(snap->mapped->kdTree(snap->mappedCategory), target,
+                                                                                bestDist, searchFilter);
+                                        if (nearest) {
+                                            foundPoint = {(int)nearest->x, (int)nearest->y};
+                                        }
                                     }
                                     break;
                                 case QUADTREE:
                                     searchModeStr = "Quadtree";
-                                    if (cat.quadRoot) {
+                                    if (snap->quadRoot || snap->mapped) {
                                         double bestDist;
-                                        vector<double> nearest = findNearest(cat.quadRoot, target, bestDist);
+                                        vector<double> nearest = snap->quadRoot
+                                            ? findNearest(snap->quadRoot, target, bestDist, 0.0, searchFilter, &stats)
+                                            : findNearest(snap->mapped->quadTree(snap->mappedCategory), target, bestDist, searchFilter);
                                         if (!nearest.empty()) {
                                             foundPoint = {(int)nearest[0], (int)nearest[1]};
                                         }
@@ -447,6 +1236,7 @@ void handleInput(bool& running) {
                                     searchModeStr = "Linear";
                                     double best = 1e12;
                                     for (size_t i = 0; i < pts.size(); ++i) {
+                                        if ((snap->attrs[i] & searchFilter) != searchFilter) continue;
                                         double d = dist2(gp.first, gp.second, pts[i].first, pts[i].second);
                                         if (d < best) { best = d; bi = (int)i; }
                                     }
@@ -455,13 +1245,17 @@ void handleInput(bool& running) {
                                     }
                                     break;
                             }
+                            // Only the search is timed. The trees return the point, not its
+                            // position in pts, so the lookup below is display bookkeeping.
+                            auto end = std::chrono::high_resolution_clock::now();
 
                             if (searchMode == KDTREE || searchMode == QUADTREE) {
                                 if (!foundPoint.first && !foundPoint.second && pts.empty()) {
                                     bi = -1;
                                 } else {
                                     for (size_t i = 0; i < pts.size(); ++i) {
-                                        if (pts[i].first == foundPoint.first && pts[i].second == foundPoint.second) {
+                                        if (pts[i].first == foundPoint.first && pts[i].second == foundPoint.second &&
+                                            (snap->attrs[i] & searchFilter) == searchFilter) {
                                             bi = (int)i;
                                             break;
                                         }
@@ -469,8 +1263,19 @@ void handleInput(bool& running) {
                                 }
                             }
 
-                            auto end = std::chrono::high_resolution_clock::now();
-                            auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+                            uint64_t ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+                            rotateLatencyWindows();
+                            recordLatency(searchLatency[searchMode], ns);
+                            recordLatency(recentLatency[searchMode], ns);
+                            if (showSearchOverlay) {
+                                overlayTrace.swap(trace);
+                                overlaySource = snap;
+                                overlayEdits = snap->edits;
+                                overlayMode = searchMode;
+                            }
+                            if (traceRecorder) {
+                                recordQuery(traceRecorder, activeCatIdx, gp.first, gp.second, searchMode, searchFilter);
+                            }
 
                             lastSearchIdx = bi;
                             if (bi != -1) {
@@ -478,8 +1283,15 @@ void handleInput(bool& running) {
                             } else {
                                 message = "Could not find point. ";
                             }
-                            message += "Time: " + to_string(duration) + " us ";
+                            message += "Time: " + formatMicros(ns) + " ";
                             message += "(" + searchModeStr + ")";
+                            if (searchFilter != 0) message += " [" + filterName(searchFilter) + "]";
+                            if (stats.queries > 0) {
+                                QueryStats& total = searchMode == KDTREE ? cat.kdStats : cat.quadStats;
+                                accumulate(total, stats);
+                                message += "\nThis search: " + describeStats(stats) + "\nAverage of " +
+                                           to_string(total.queries) + ": " + describeStats(total);
+                            }
                         }
                         isSearchingPoint = false;
                     }
@@ -496,13 +1308,21 @@ void handleInput(bool& running) {
                 int mx = e.motion.x;
                 float t = float(mx - sliderRect.x) / float(sliderRect.w);
                 t = max(0.0f, min(1.0f, t));
-                pointRadius = int(4 + t * 20);
+                int radius = int(4 + t * 20);
+                if (radius != pointRadius) {
+                    pointRadius = radius;
+                    invalidateLayers();
+                }
             }
             else if (isDraggingLimit) {
                 int mx = e.motion.x;
                 float t = float(mx - renderLimitSliderRect.x) / float(renderLimitSliderRect.w);
                 t = max(0.0f, min(1.0f, t));
-                maxPointsToRender = int(100 + t * 19900);
+                int limit = int(100 + t * 19900);
+                if (limit != maxPointsToRender) {
+                    maxPointsToRender = limit;
+                    invalidateLayers();
+                }
             }
         }
         else if (e.type == SDL_KEYDOWN) {
@@ -512,6 +1332,7 @@ void handleInput(bool& running) {
                     if (!name.empty()) {
                         categories.push_back(Category(name, makeColor(), {}));
                         categories.back().buildDataStructures(mapInnerW, mapInnerH);
+                        logMutation(LOG_CREATE, (int)categories.size() - 1, 0, 0, packColor(categories.back().color), 0, name);
                         message = "Added the group: " + name; messageTimer = SDL_GetTicks();
                     }
                     else {
@@ -533,18 +1354,9 @@ void handleInput(bool& running) {
                     catch (...) { numToAdd = 0; }
 
                     if (numToAdd > 0 && activeCatIdx >= 0) {
-                        auto& cat = categories[activeCatIdx];
-                        auto& pts = cat.points;
-                        for (int i = 0; i < numToAdd; ++i) {
-                            int rx = rand() % mapInnerW;
-                            int ry = rand() % mapInnerH;
-                            pts.push_back({ rx, ry });
-
-                            vector<double> point = {(double)rx, (double)ry};
-                            cat.kdRoot = insert(cat.kdRoot, point);
-                            cat.quadRoot = insert(cat.quadRoot, point);
-                        }
-                        message = "Added " + to_string(numToAdd) + " random points.";
+                        scheduleIndexJob(categories[activeCatIdx].slot, numToAdd, mapInnerW, mapInnerH);
+                        message = "Adding " + to_string(numToAdd) + " " + distributionName(randomDistribution) +
+                                  " points in the background...";
                         messageTimer = SDL_GetTicks();
                     }
                     isAddingRandom = false;
@@ -557,6 +1369,93 @@ void handleInput(bool& running) {
                 else if (e.key.keysym.sym == SDLK_BACKSPACE && !addPointsInput.empty()) {
                     addPointsInput.pop_back();
                 }
+                else if (e.key.keysym.sym == SDLK_d) {
+                    cycleRandomDistribution();
+                }
+            }
+            else if (state == MAIN_VIEW && e.key.keysym.sym == SDLK_s) {
+                if (compactionRunning) {
+                    message = "A save is already in progress.";
+                } else {
+                    scheduleCompaction(true);
+                    message = string("Saving to ") + SNAPSHOT_FILE + "...";
+                }
+                messageTimer = SDL_GetTicks();
+            }
+            else if (state == MAIN_VIEW && e.key.keysym.sym == SDLK_t) {
+                toggleTraceRecording();
+                messageTimer = SDL_GetTicks();
+            }
+            else if (state == MAIN_VIEW && e.key.keysym.sym == SDLK_j) {
+                // Join the first two selected groups: nearest B for every A.
+                vector<int> picked;
+                for (size_t i = 0; i < categories.size() && i < (size_t)MAX_CATEGORIES && picked.size() < 2; ++i) {
+                    if (categories[i].selected) picked.push_back((int)i);
+                }
+                if (picked.size() < 2) {
+                    message = "Select two groups, then press J to join them.";
+                } else {
+                    // Without an up-to-date unified index, each point of A
+                    // searches B's own tree instead of the dual-tree join.
+                    auto unified = currentUnifiedIndex();
+                    auto snapB = categories[picked[1]].snapshot();
+                    if (!unified && !snapB->kdRoot && !snapB->mapped) {
+                        message = "Groups are still being indexed, try again shortly.";
+                        messageTimer = SDL_GetTicks();
+                        continue;
+                    }
+                    auto start = std::chrono::high_resolution_clock::now();
+                    size_t joined = 0;
+                    double total = 0;
+                    if (unified) {
+                        vector<JoinPair> pairs = allNearestJoin(unified->index, picked[0], unified->index, picked[1]);
+                        for (const auto& p : pairs) total += p.dist;
+                        joined = pairs.size();
+                    } else {
+                        auto snapA = categories[picked[0]].snapshot();
+                        for (const auto& p : snapA->points) {
+                            vector<double> target = { (double)p.first, (double)p.second };
+                            double d;
+                            if (!nearestInCategory(*snapB, target, d)) break;
+                            total += sqrt(d);
+                            joined++;
+                        }
+                    }
+                    auto end = std::chrono::high_resolution_clock::now();
+                    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+                    const string& nameA = categories[picked[0]].name;
+                    const string& nameB = categories[picked[1]].name;
+                    if (joined == 0) {
+                        message = "Nothing to join between " + nameA + " and " + nameB + ".";
+                    } else {
+                        message = "Nearest " + nameB + " for " + to_string(joined) + " " + nameA +
+                                  " points, mean distance " + to_string((int)(total / joined)) +
+                                  ". Time: " + to_string(duration) + " us";
+                    }
+                }
+                messageTimer = SDL_GetTicks();
+            }
+            else if (state == VENDING_VIEW && e.key.keysym.sym == SDLK_d) {
+                cycleRandomDistribution();
+            }
+            else if (state == VENDING_VIEW && e.key.keysym.sym == SDLK_i) {
+                showTreeShape = !showTreeShape;
+            }
+            else if (state == VENDING_VIEW && e.key.keysym.sym == SDLK_v) {
+                showSearchOverlay = !showSearchOverlay;
+                message = showSearchOverlay ? "Search overlay on: green visited, red pruned, grey not reached."
+                                            : "Search overlay off.";
+                messageTimer = SDL_GetTicks();
+            }
+            else if (state == VENDING_VIEW && e.key.keysym.sym == SDLK_h) {
+                showLatency = !showLatency;
+            }
+            else if (state == VENDING_VIEW && e.key.keysym.sym == SDLK_e) {
+                string error;
+                message = exportLatency(error) ? string("Wrote search latencies to ") + LATENCY_FILE + "."
+                                               : "Export failed: " + error;
+                messageTimer = SDL_GetTicks();
             }
             else if (state == VENDING_VIEW && e.key.keysym.sym == SDLK_BACKSPACE) {
                 state = MAIN_VIEW; activeCatIdx = -1; isAddingPoint = false; lastSearchIdx = -1;
@@ -577,10 +1476,95 @@ void handleInput(bool& running) {
                 }
             }
         }
+    } while (SDL_PollEvent(&e));
+
+    maybeCompactLog();
+    if (state == MAIN_VIEW) currentUnifiedIndex(); // start a stale rebuild before the next click
+}
+
+// Draws a category at screen resolution instead of point resolution: the
+// quadtree is cut at nodes no larger than a point marker and the cut is binned
+// into a screen grid, so the work depends on the map size, not the point count.
+size_t drawCategoryLOD(const Category& cat, const CategoryIndex& snap, bool isHighlighted, int originX, int originY) {
+    int cellSize = max(2, pointRadius);
+    vector<QuadCell> cells;
+    collectCells(snap.quadRoot, (double)cellSize, cells);
+
+    int gridW = mapInnerW / cellSize + 1;
+    int gridH = mapInnerH / cellSize + 1;
+    vector<int> counts(gridW * gridH, 0);
+    vector<pair<int, int>> reps(gridW * gridH);
+
+    for (auto& c : cells) {
+        int rx = (int)c.representative[0], ry = (int)c.representative[1];
+        int gx = min(gridW - 1, max(0, rx / cellSize));
+        int gy = min(gridH - 1, max(0, ry / cellSize));
+        int idx = gy * gridW + gx;
+        if (counts[idx] == 0) reps[idx] = { rx, ry };
+        counts[idx] += c.count;
     }
+
+    int maxCount = 1;
+    for (int c : counts) maxCount = max(maxCount, c);
+    double logMax = log(1.0 + maxCount);
+
+    size_t drawn = 0;
+    for (int gy = 0; gy < gridH; ++gy) {
+        for (int gx = 0; gx < gridW; ++gx) {
+            int idx = gy * gridW + gx;
+            if (counts[idx] == 0) continue;
+            drawn++;
+
+            if (lodMode == LOD_REPRESENTATIVE) {
+                auto p_world = graphToWorld(reps[idx].first, reps[idx].second);
+                int wx = p_world.first - originX;
+                int wy = p_world.second - originY;
+                if (isHighlighted) {
+                    SDL_SetRenderDrawColor(ren, cat.color.r, cat.color.g, cat.color.b, 120);
+                    drawFilledCircle(ren, wx, wy, pointRadius + 4);
+                }
+                SDL_SetRenderDrawColor(ren, cat.color.r, cat.color.g, cat.color.b, 255);
+                drawFilledCircle(ren, wx, wy, pointRadius);
+            } else {
+                auto topLeft = graphToWorld(gx * cellSize, (gy + 1) * cellSize);
+                SDL_Rect cell{ topLeft.first - originX, topLeft.second - originY, cellSize, cellSize };
+                Uint8 alpha = (Uint8)(60 + 195 * log(1.0 + counts[idx]) / logMax);
+                SDL_SetRenderDrawColor(ren, cat.color.r, cat.color.g, cat.color.b, alpha);
+                SDL_RenderFillRect(ren, &cell);
+            }
+        }
+    }
+    return drawn;
 }
 
-void render() {
+void drawCategoryPoints(Category& cat, bool isHighlighted, int originX, int originY) {
+    auto snap = cat.snapshot();
+    size_t totalPoints = snap->points.size();
+    size_t renderLimit = min(totalPoints, (size_t)maxPointsToRender);
+
+    if (lodMode != LOD_OFF && totalPoints > (size_t)maxPointsToRender && snap->quadRoot) {
+        cat.renderedCount = drawCategoryLOD(cat, *snap, isHighlighted, originX, originY);
+        return;
+    }
+    cat.renderedCount = renderLimit;
+
+    for (size_t j = 0; j < renderLimit; ++j) {
+        auto p_graph = snap->points[j];
+        auto p_world = graphToWorld(p_graph.first, p_graph.second);
+        int wx = p_world.first - originX;
+        int wy = p_world.second - originY;
+
+        if (isHighlighted) {
+            SDL_SetRenderDrawColor(ren, cat.color.r, cat.color.g, cat.color.b, 120);
+            drawFilledCircle(ren, wx, wy, pointRadius + 4);
+        }
+
+        SDL_SetRenderDrawColor(ren, cat.color.r, cat.color.g, cat.color.b, 255);
+        drawFilledCircle(ren, wx, wy, pointRadius);
+    }
+}
+
+void drawBackground() {
     SDL_SetRenderDrawColor(ren, 240, 240, 240, 255);
     SDL_RenderClear(ren);
 
@@ -614,33 +1598,223 @@ void render() {
             if (tex) { SDL_Rect dst{ axisX - 30, ty - 8, w, h }; SDL_RenderCopy(ren, tex, nullptr, &dst); SDL_DestroyTexture(tex); }
         }
     }
+}
+
+// Points and axes only change on edits, radius/limit/LOD changes and resizes,
+// so they are drawn once into render-target textures and composited every
+// frame underneath the dynamic UI.
+bool beginLayer(SDL_Texture*& tex, int w, int h) {
+    int tw = 0, th = 0;
+    if (tex) SDL_QueryTexture(tex, nullptr, nullptr, &tw, &th);
+    if (!tex || tw != w || th != h) {
+        if (tex) SDL_DestroyTexture(tex);
+        tex = SDL_CreateTexture(ren, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, w, h);
+        if (!tex) return false;
+        SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_BLEND);
+    }
+    if (SDL_SetRenderTarget(ren, tex) != 0) return false;
+    SDL_SetRenderDrawBlendMode(ren, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(ren, 0, 0, 0, 0);
+    SDL_RenderClear(ren);
+    return true;
+}
+
+void renderLayers() {
+    if (!useLayerCache) {
+        drawBackground();
+        for (size_t i = 0; i < categories.size(); ++i) {
+            auto& cat = categories[i];
+            bool isHighlighted = cat.selected || (state == VENDING_VIEW && (int)i == activeCatIdx);
+            drawCategoryPoints(cat, isHighlighted, 0, 0);
+        }
+        return;
+    }
 
+    if (backgroundDirty || !backgroundLayer) {
+        if (beginLayer(backgroundLayer, windowW, windowH)) {
+            drawBackground();
+            backgroundDirty = false;
+        }
+        SDL_SetRenderTarget(ren, nullptr);
+    }
+    SDL_RenderCopy(ren, backgroundLayer, nullptr, nullptr);
+
+    SDL_Rect mapRect{ mapX, mapY, mapW, mapH };
     for (size_t i = 0; i < categories.size(); ++i) {
         auto& cat = categories[i];
         bool isHighlighted = cat.selected || (state == VENDING_VIEW && (int)i == activeCatIdx);
 
-        size_t totalPoints = cat.points.size();
-        size_t renderLimit = min(totalPoints, (size_t)maxPointsToRender);
+        if (cat.layerDirty || !cat.layer.texture || cat.layerHighlighted != isHighlighted) {
+            if (beginLayer(cat.layer.texture, mapW, mapH)) {
+                drawCategoryPoints(cat, isHighlighted, mapX, mapY);
+                cat.layerDirty = false;
+                cat.layerHighlighted = isHighlighted;
+            }
+            SDL_SetRenderTarget(ren, nullptr);
+        }
+        SDL_RenderCopy(ren, cat.layer.texture, nullptr, &mapRect);
+    }
+}
+
+void renderTreeShape(const shared_ptr<CategoryIndex>& snap) {
+    if (!font) return;
+    if (shapeSource.lock() != snap || shapeEdits != snap->edits) {
+        shapeSource = snap;
+        shapeEdits = snap->edits;
+        shapeText = "Tree shape (press I to hide)\nK-D tree: ";
+        shapeText += snap->kdRoot ? describeShape(measureTree(snap->kdRoot)) : "not built yet";
+        shapeText += "\nQuadtree: ";
+        shapeText += snap->quadRoot ? describeShape(measureTree(snap->quadRoot)) : "not built yet";
+    }
 
-        for (size_t j = 0; j < renderLimit; ++j) {
-            auto p_graph = cat.points[j];
-            auto p_world = graphToWorld(p_graph.first, p_graph.second);
-            int wx = p_world.first;
-            int wy = p_world.second;
+    int tw, th;
+    SDL_Texture* tex = createTextTexture(ren, font, shapeText, { 255,255,255,255 }, tw, th, max(100, windowW - mapX - 60));
+    if (!tex) return;
+    int padding = 10;
+    SDL_Rect dst{ mapX + 20, windowH - AXIS_PADDING - th - 20, tw, th };
+    SDL_Rect bgRect{ dst.x - padding, dst.y - padding, dst.w + 2 * padding, dst.h + 2 * padding };
+    SDL_SetRenderDrawColor(ren, 48, 48, 48, 220);
+    SDL_RenderFillRect(ren, &bgRect);
+    SDL_RenderCopy(ren, tex, nullptr, &dst);
+    SDL_DestroyTexture(tex);
+}
 
-            if (isHighlighted) {
-                SDL_SetRenderDrawColor(ren, cat.color.r, cat.color.g, cat.color.b, 120);
-                drawFilledCircle(ren, wx, wy, pointRadius + 4);
-            }
+// A one-pixel line between graph points, as a rect so lines can be batched.
+static void addOverlayLine(vector<SDL_Rect>& lines, double x1, double y1, double x2, double y2) {
+    auto a = graphToWorld((int)x1, (int)y1), b = graphToWorld((int)x2, (int)y2);
+    lines.push_back(SDL_Rect{ min(a.first, b.first), min(a.second, b.second), abs(b.first - a.first) + 1,
+                              abs(b.second - a.second) + 1 });
+}
 
-            if (state == VENDING_VIEW && (int)i == activeCatIdx && (int)j == lastSearchIdx) {
-                SDL_SetRenderDrawColor(ren, 255, 32, 32, 255);
-                drawFilledCircle(ren, wx, wy, pointRadius + 8);
+static void addOverlayBox(vector<SDL_Rect>& lines, double x1, double y1, double x2, double y2) {
+    addOverlayLine(lines, x1, y1, x2, y1);
+    addOverlayLine(lines, x1, y2, x2, y2);
+    addOverlayLine(lines, x1, y1, x1, y2);
+    addOverlayLine(lines, x2, y1, x2, y2);
+}
+
+// Draws from the recorded trace only; the search is not run again. Nodes in
+// the trace are always drawn; the rest, including everything below a pruned
+// node, only down to OVERLAY_MIN_CELL_PX so large trees stay cheap to show.
+void renderSearchOverlay(const shared_ptr<CategoryIndex>& snap) {
+    unordered_map<const void*, TraceOutcome> outcome;
+    SearchMode mode = searchMode;
+    if (overlaySource.lock() == snap && overlayEdits == snap->edits) {
+        mode = overlayMode;
+        for (const auto& event : overlayTrace) outcome[event.node] = event.outcome;
+    }
+    auto outcomeOf = [&outcome](const void* node) {
+        auto it = outcome.find(node);
+        return it == outcome.end() ? (TraceOutcome)0 : it->second;
+    };
+
+    vector<SDL_Rect> lines[3]; // not reached, pruned, visited
+    struct Region {
+        const void* node;
+        double x1, y1, x2, y2;
+        int depth;
+        bool inPruned;
+    };
+    vector<Region> stack;
+
+    if (mode == KDTREE && snap->kdRoot) {
+        stack.push_back(Region{ snap->kdRoot, 0, 0, (double)mapInnerW, (double)mapInnerH, 0, false });
+        while (!stack.empty()) {
+            Region r = stack.back();
+            stack.pop_back();
+            const KDNode* node = (const KDNode*)r.node;
+            TraceOutcome traced = outcomeOf(node);
+            TraceOutcome o = traced ? traced : r.inPruned ? TRACE_PRUNED : (TraceOutcome)0;
+            if (!traced && (r.x2 - r.x1 < OVERLAY_MIN_CELL_PX || r.y2 - r.y1 < OVERLAY_MIN_CELL_PX)) continue;
+
+            vector<SDL_Rect>& out = lines[o == TRACE_VISITED ? 2 : o == TRACE_PRUNED ? 1 : 0];
+            double split = node->point[r.depth % 2];
+            if (r.depth % 2 == 0) {
+                split = min(max(split, r.x1), r.x2);
+                addOverlayLine(out, split, r.y1, split, r.y2);
+                if (node->left) stack.push_back(Region{ node->left, r.x1, r.y1, split, r.y2, r.depth + 1, o == TRACE_PRUNED });
+                if (node->right) stack.push_back(Region{ node->right, split, r.y1, r.x2, r.y2, r.depth + 1, o == TRACE_PRUNED });
+            } else {
+                split = min(max(split, r.y1), r.y2);
+                addOverlayLine(out, r.x1, split, r.x2, split);
+                if (node->left) stack.push_back(Region{ node->left, r.x1, r.y1, r.x2, split, r.depth + 1, o == TRACE_PRUNED });
+                if (node->right) stack.push_back(Region{ node->right, r.x1, split, r.x2, r.y2, r.depth + 1, o == TRACE_PRUNED });
+            }
+        }
+    } else if (mode == QUADTREE && snap->quadRoot) {
+        stack.push_back(Region{ snap->quadRoot, 0, 0, 0, 0, 0, false });
+        while (!stack.empty()) {
+            Region r = stack.back();
+            stack.pop_back();
+            const QuadNode* node = (const QuadNode*)r.node;
+            TraceOutcome traced = outcomeOf(node);
+            TraceOutcome o = traced ? traced : r.inPruned ? TRACE_PRUNED : (TraceOutcome)0;
+            double w = node->x_max - node->x_min, h = node->y_max - node->y_min;
+            if (!traced && (w < OVERLAY_MIN_CELL_PX || h < OVERLAY_MIN_CELL_PX)) continue;
+
+            addOverlayBox(lines[o == TRACE_VISITED ? 2 : o == TRACE_PRUNED ? 1 : 0], node->x_min, node->y_min,
+                          node->x_max, node->y_max);
+            if (node->divided) {
+                for (const QuadNode* child : { node->nw, node->ne, node->sw, node->se }) {
+                    stack.push_back(Region{ child, 0, 0, 0, 0, r.depth + 1, o == TRACE_PRUNED });
+                }
             }
+        }
+    }
+
+    const SDL_Color colors[3] = { { 150, 150, 150, 90 }, { 230, 80, 60, 200 }, { 40, 190, 80, 255 } };
+    for (int i = 0; i < 3; ++i) {
+        if (lines[i].empty()) continue;
+        SDL_SetRenderDrawColor(ren, colors[i].r, colors[i].g, colors[i].b, colors[i].a);
+        SDL_RenderFillRects(ren, lines[i].data(), (int)lines[i].size());
+    }
+}
+
+void renderLatency() {
+    rotateLatencyWindows();
+    if (!font) return;
+    string text = "Search latency, last " + to_string(LATENCY_WINDOW_MS / 1000) + "-" +
+                  to_string(2 * LATENCY_WINDOW_MS / 1000) + " s (H to hide, E to export)";
+    for (int m = 0; m < 3; ++m) {
+        LatencySummary recent = summarizeLatency(recentLatency[m]);
+        text += string("\n") + SEARCH_MODE_NAMES[m] + ": ";
+        if (recent.count == 0) {
+            text += "no searches";
+            continue;
+        }
+        text += to_string(recent.count) + " searches, p50 " + formatMicros(recent.p50Ns) + ", p90 " +
+                formatMicros(recent.p90Ns) + ", p99 " + formatMicros(recent.p99Ns) + ", p99.9 " +
+                formatMicros(recent.p999Ns) + ", max " + formatMicros(recent.maxNs);
+    }
+
+    int tw, th;
+    SDL_Texture* tex = createTextTexture(ren, font, text, { 255,255,255,255 }, tw, th, max(100, windowW - mapX - 60));
+    if (!tex) return;
+    int padding = 10;
+    SDL_Rect dst{ windowW - tw - 30, 70, tw, th };
+    SDL_Rect bgRect{ dst.x - padding, dst.y - padding, dst.w + 2 * padding, dst.h + 2 * padding };
+    SDL_SetRenderDrawColor(ren, 48, 48, 48, 220);
+    SDL_RenderFillRect(ren, &bgRect);
+    SDL_RenderCopy(ren, tex, nullptr, &dst);
+    SDL_DestroyTexture(tex);
+}
+
+void render() {
+    renderLayers();
 
+    if (state == VENDING_VIEW && activeCatIdx >= 0 && activeCatIdx < (int)categories.size()) {
+        auto& cat = categories[activeCatIdx];
+        auto snap = cat.snapshot();
+        if (showSearchOverlay) renderSearchOverlay(snap);
+        if (lastSearchIdx >= 0 && lastSearchIdx < (int)snap->points.size()) {
+            auto p_world = graphToWorld(snap->points[lastSearchIdx].first, snap->points[lastSearchIdx].second);
+            SDL_SetRenderDrawColor(ren, 255, 32, 32, 255);
+            drawFilledCircle(ren, p_world.first, p_world.second, pointRadius + 8);
             SDL_SetRenderDrawColor(ren, cat.color.r, cat.color.g, cat.color.b, 255);
-            drawFilledCircle(ren, wx, wy, pointRadius);
+            drawFilledCircle(ren, p_world.first, p_world.second, pointRadius);
         }
+        if (showTreeShape) renderTreeShape(snap);
+        if (showLatency) renderLatency();
     }
 
     if (state == MAIN_VIEW) {
@@ -656,6 +1830,12 @@ void render() {
         SDL_Rect removeAllBtn{ 20, 290, mapX - 40, 40 };
         drawButton("Remove All", removeAllBtn, Color{ 180,70,70,255 }, false);
 
+        SDL_Rect lodBtn{ 20, 340, mapX - 40, 40 };
+        drawButton(string("LOD: ") + lodModeName(lodMode), lodBtn, Color{ 90,90,140,255 }, lodMode != LOD_OFF);
+
+        SDL_Rect filterBtn{ 20, 390, mapX - 40, 40 };
+        drawButton("Search filter: " + filterName(searchFilter), filterBtn, Color{ 70,140,110,255 }, searchFilter != 0);
+
         int rsw = renderLimitSliderRect.w; int rsx = renderLimitSliderRect.x; int rsy = renderLimitSliderRect.y; int rsh = renderLimitSliderRect.h;
         if (font) {
             int labelW, labelH;
@@ -693,7 +1873,7 @@ void render() {
                     SDL_RenderCopy(ren, ttex, nullptr, &dst);
                     SDL_DestroyTexture(ttex);
                 }
-                bool cursorVisible = (SDL_GetTicks() / 500) % 2 == 0;
+                bool cursorVisible = (SDL_GetTicks() / CURSOR_BLINK_MS) % 2 == 0;
                 if (cursorVisible) {
                     int textWidth, textHeight;
                     TTF_SizeUTF8(font, categoryNameInput.c_str(), &textWidth, &textHeight);
@@ -740,7 +1920,7 @@ void render() {
 
         by += (bh + gap);
         SDL_Rect addRandomBtn{ bx, by, bw, bh };
-        drawButton("Add N Random Points", addRandomBtn, Color{ 200, 140, 40, 255 }, isAddingRandom);
+        drawButton(string("Add N Points: ") + distributionName(randomDistribution), addRandomBtn, Color{ 200, 140, 40, 255 }, isAddingRandom);
 
         by += (bh + gap);
         SDL_Rect kdTreeToggleBtn{ bx, by, bw, bh };
@@ -774,7 +1954,7 @@ void render() {
                     SDL_RenderCopy(ren, ttex, nullptr, &dst);
                     SDL_DestroyTexture(ttex);
                 }
-                bool cursorVisible = (SDL_GetTicks() / 500) % 2 == 0;
+                bool cursorVisible = (SDL_GetTicks() / CURSOR_BLINK_MS) % 2 == 0;
                 if (cursorVisible) {
                     int textWidth, textHeight;
                     TTF_SizeUTF8(font, addPointsInput.c_str(), &textWidth, &textHeight);
@@ -787,10 +1967,17 @@ void render() {
 
         if (font && !isAddingRandom) {
             int tw, th;
-            size_t total = currentCat.points.size();
-            size_t rendered = min(total, (size_t)maxPointsToRender);
+            size_t total = currentCat.snapshot()->points.size();
             string info = "Total Points: " + to_string(total);
-            string info2 = "Rendering: " + to_string(rendered);
+            string info2 = "Rendering: " + to_string(currentCat.renderedCount);
+            if (currentCat.renderedCount < total && lodMode != LOD_OFF) {
+                info2 += " cells (LOD)";
+            }
+            if (compactionRunning) {
+                info += " (saving...)";
+            } else if (currentCat.isRebuilding()) {
+                info += " (rebuilding index...)";
+            }
 
             SDL_Texture* ttex = createTextTexture(ren, font, info, { 200,200,200,255 }, tw, th);
             if (ttex) {
@@ -808,10 +1995,11 @@ void render() {
     }
 
     if (!message.empty()) {
-        if (SDL_GetTicks() - messageTimer < 4000) {
+        if (SDL_GetTicks() - messageTimer < MESSAGE_DURATION_MS) {
             if (font) {
                 int tw, th;
-                SDL_Texture* tex = createTextTexture(ren, font, message, { 0,0,0,255 }, tw, th);
+                SDL_Texture* tex = createTextTexture(ren, font, message, { 0,0,0,255 }, tw, th,
+                                                     max(100, windowW - mapX - 60));
                 if (tex) {
                     int padding = 10;
                     SDL_Rect dst{ mapX + 20, 20, tw, th };
@@ -929,23 +2117,50 @@ int main(int argc, char** argv) {
 
     srand((unsigned)time(nullptr));
 
-    categories.push_back(Category("Vending", makeColor(), {{100,100},{200,150},{180,80}}));
-    categories.push_back(Category("Dustbin", makeColor(), {{300,200},{360,220}}));
-    categories.push_back(Category("GDFGHJ", makeColor(), {{120,320},{220,300},{420,120}}));
-
     computeLayout(WINDOW_W, WINDOW_H);
 
+    uint64_t baseChecksum = 0;
+    if (!loadCategories(baseChecksum)) {
+        categories.push_back(Category("Vending", makeColor(), {{100,100},{200,150},{180,80}}));
+        categories.push_back(Category("Dustbin", makeColor(), {{300,200},{360,220}}));
+        categories.push_back(Category("GDFGHJ", makeColor(), {{120,320},{220,300},{420,120}}));
+    }
+
+    vector<LogEntry> replay;
+    string logError;
+    mutationLog = openMutationLog(LOG_FILE, baseChecksum, replay, logError);
+    if (!mutationLog) SDL_Log("Edits will not be logged: %s", logError.c_str());
+    for (const auto& entry : replay) {
+        applyLogEntry(entry);
+    }
+
+    indexDoneEvent = SDL_RegisterEvents(2);
+    if (indexDoneEvent != (Uint32)-1) compactionDoneEvent = indexDoneEvent + 1;
+    indexWorker = thread(indexWorkerLoop);
+
     for (auto& cat : categories) {
         cat.buildDataStructures(mapInnerW, mapInnerH);
     }
 
+    useLayerCache = SDL_RenderTargetSupported(ren) == SDL_TRUE;
+
     bool running = true;
     while (running) {
         handleInput(running);
-        render();
-        SDL_Delay(10);
+        if (needsRedraw) {
+            needsRedraw = false;
+            render();
+        }
     }
 
+    stopIndexWorker();
+    string saveError;
+    if (!compactLog(saveError)) SDL_Log("Snapshot not saved: %s", saveError.c_str());
+    closeMutationLog(mutationLog);
+    stopTrace(traceRecorder);
+    atomic_store(&unifiedCurrent, shared_ptr<UnifiedSnapshot>());
+    categories.clear();
+    if (backgroundLayer) SDL_DestroyTexture(backgroundLayer);
     if (font) TTF_CloseFont(font);
     SDL_DestroyRenderer(ren);
     SDL_DestroyWindow(win);